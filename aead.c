@@ -0,0 +1,283 @@
+#include <string.h>
+#include "aead.h"
+
+#define LANES 4             //ChaCha20 blocks computed together
+#define BLOCK 64            //size of a ChaCha20 block
+#define MASK44 0xFFFFFFFFFFFULL
+#define MASK42 0x3FFFFFFFFFFULL
+
+#define ROTL32(x, b) (((x) << (b)) | ((x) >> (32 - (b))))
+
+/**
+ * Word of the ChaCha20 state in all lanes - one SIMD register (vector extension of GCC and Clang)
+ */
+typedef unsigned int laneWord __attribute__((vector_size(4 * LANES)));
+
+/**
+ * Quarter round on the words a, b, c, d of all lanes
+ */
+#define QUARTER(s, a, b, c, d) \
+    s[a] += s[b]; s[d] = ROTL32(s[d] ^ s[a], 16); \
+    s[c] += s[d]; s[b] = ROTL32(s[b] ^ s[c], 12); \
+    s[a] += s[b]; s[d] = ROTL32(s[d] ^ s[a], 8); \
+    s[c] += s[d]; s[b] = ROTL32(s[b] ^ s[c], 7);
+
+/**
+ * Poly1305 state - 130-bit accumulator and key in 44/44/42-bit limbs
+ */
+typedef struct polyState {
+    unsigned long long r[3], h[3], pad[2];
+} polyState;
+
+static unsigned int load32(const unsigned char *p) {
+    return (unsigned int) p[0] | (unsigned int) p[1] << 8 | (unsigned int) p[2] << 16 | (unsigned int) p[3] << 24;
+}
+
+static unsigned long long load64(const unsigned char *p) {
+    return (unsigned long long) load32(p) | (unsigned long long) load32(p + 4) << 32;
+}
+
+static void store64(unsigned char *p, unsigned long long v) {
+    int i;
+    for (i = 0; i < 8; i++)
+        p[i] = (unsigned char) (v >> (8 * i));
+}
+
+/**
+ * Initial state of a ChaCha20 block (the counter and the nonce are filled by the caller)
+ */
+static void chachaSetup(unsigned int *state, const unsigned char *key) {
+    int i;
+    state[0] = 0x61707865;
+    state[1] = 0x3320646e;
+    state[2] = 0x79622d32;
+    state[3] = 0x6b206574;
+    for (i = 0; i < 8; i++)
+        state[4 + i] = load32(key + 4 * i);
+}
+
+/**
+ * Computes the ChaCha20 blocks of the LANES input states
+ * @param in Input state by word and lane
+ * @param out Keystream of every lane (BLOCK bytes each)
+ */
+static void chachaLanes(const laneWord in[16], unsigned char out[LANES][BLOCK]) {
+    laneWord s[16];
+    int i, l, w;
+    memcpy(s, in, sizeof(s));
+    for (i = 0; i < 10; i++) {
+        QUARTER(s, 0, 4, 8, 12)
+        QUARTER(s, 1, 5, 9, 13)
+        QUARTER(s, 2, 6, 10, 14)
+        QUARTER(s, 3, 7, 11, 15)
+        QUARTER(s, 0, 5, 10, 15)
+        QUARTER(s, 1, 6, 11, 12)
+        QUARTER(s, 2, 7, 8, 13)
+        QUARTER(s, 3, 4, 9, 14)
+    }
+    for (w = 0; w < 16; w++) {
+        s[w] += in[w];
+        for (l = 0; l < LANES; l++) {
+            unsigned int v = s[w][l];
+            out[l][4 * w] = (unsigned char) v;
+            out[l][4 * w + 1] = (unsigned char) (v >> 8);
+            out[l][4 * w + 2] = (unsigned char) (v >> 16);
+            out[l][4 * w + 3] = (unsigned char) (v >> 24);
+        }
+    }
+}
+
+/**
+ * XORs the data with the keystream of the nonce from block 1 (block 0 gives the Poly1305 key)
+ */
+static void chachaXor(const unsigned int *setup, const unsigned char *nonce, unsigned char *data, size_t length) {
+    laneWord in[16];
+    unsigned char stream[LANES][BLOCK];
+    size_t offset, i, end;
+    int l, w;
+
+    for (w = 0; w < 12; w++)
+        in[w] = (laneWord) { 0 } + setup[w];
+    for (w = 0; w < 3; w++)
+        in[13 + w] = (laneWord) { 0 } + load32(nonce + 4 * w);
+    for (l = 0; l < LANES; l++)
+        in[12][l] = 1 + (unsigned int) l;
+    for (offset = 0; offset < length; offset += LANES * BLOCK, in[12] += LANES) {
+        chachaLanes(in, stream);
+        end = length - offset < LANES * BLOCK ? length - offset : LANES * BLOCK;
+        for (i = 0; i < end; i++)
+            data[offset + i] ^= ((const unsigned char *) stream)[i];
+    }
+}
+
+/**
+ * Computes the one-time Poly1305 keys (block 0 of every nonce) of up to LANES packets
+ */
+static void polyKeys(const unsigned int *setup, const aeadPacket *packets, int count, unsigned char keys[LANES][BLOCK]) {
+    laneWord in[16];
+    int l, w;
+    for (w = 0; w < 12; w++)
+        in[w] = (laneWord) { 0 } + setup[w];
+    for (l = 0; l < LANES; l++) {
+        const unsigned char *nonce = packets[l < count ? l : 0].nonce;
+        in[12][l] = 0;
+        for (w = 0; w < 3; w++)
+            in[13 + w][l] = load32(nonce + 4 * w);
+    }
+    chachaLanes(in, keys);
+}
+
+static void polyInit(polyState *st, const unsigned char *key) {
+    unsigned long long t0 = load64(key), t1 = load64(key + 8);
+    st->r[0] = t0 & 0xFFC0FFFFFFFULL;
+    st->r[1] = ((t0 >> 44) | (t1 << 20)) & 0xFFFFFC0FFFFULL;
+    st->r[2] = (t1 >> 24) & 0x00FFFFFFC0FULL;
+    st->h[0] = st->h[1] = st->h[2] = 0;
+    st->pad[0] = load64(key + 16);
+    st->pad[1] = load64(key + 24);
+}
+
+/**
+ * Absorbs the data in 16-byte blocks, the last partial block padded with zeros (the AEAD padding of RFC 8439)
+ */
+static void polyUpdate(polyState *st, const unsigned char *data, size_t length) {
+    unsigned long long r0 = st->r[0], r1 = st->r[1], r2 = st->r[2], h0 = st->h[0], h1 = st->h[1], h2 = st->h[2];
+    unsigned long long s1 = r1 * 20, s2 = r2 * 20, t0, t1, c;
+    unsigned __int128 d0, d1, d2;
+    unsigned char last[16];
+
+    while (length > 0) {
+        if (length < 16) {
+            memset(last, 0, sizeof(last));
+            memcpy(last, data, length);
+            data = last;
+            length = 16;
+        }
+        t0 = load64(data);
+        t1 = load64(data + 8);
+        h0 += t0 & MASK44;
+        h1 += ((t0 >> 44) | (t1 << 20)) & MASK44;
+        h2 += ((t1 >> 24) & MASK42) | (1ULL << 40);
+        d0 = (unsigned __int128) h0 * r0 + (unsigned __int128) h1 * s2 + (unsigned __int128) h2 * s1;
+        d1 = (unsigned __int128) h0 * r1 + (unsigned __int128) h1 * r0 + (unsigned __int128) h2 * s2;
+        d2 = (unsigned __int128) h0 * r2 + (unsigned __int128) h1 * r1 + (unsigned __int128) h2 * r0;
+        c = (unsigned long long) (d0 >> 44);
+        h0 = (unsigned long long) d0 & MASK44;
+        d1 += c;
+        c = (unsigned long long) (d1 >> 44);
+        h1 = (unsigned long long) d1 & MASK44;
+        d2 += c;
+        c = (unsigned long long) (d2 >> 42);
+        h2 = (unsigned long long) d2 & MASK42;
+        h0 += c * 5;
+        c = h0 >> 44;
+        h0 &= MASK44;
+        h1 += c;
+        data += 16;
+        length -= 16;
+    }
+    st->h[0] = h0;
+    st->h[1] = h1;
+    st->h[2] = h2;
+}
+
+static void polyFinish(polyState *st, unsigned char *tag) {
+    unsigned long long h0 = st->h[0], h1 = st->h[1], h2 = st->h[2], g0, g1, g2, c;
+    c = h1 >> 44;
+    h1 &= MASK44;
+    h2 += c;
+    c = h2 >> 42;
+    h2 &= MASK42;
+    h0 += c * 5;
+    c = h0 >> 44;
+    h0 &= MASK44;
+    h1 += c;
+    c = h1 >> 44;
+    h1 &= MASK44;
+    h2 += c;
+    c = h2 >> 42;
+    h2 &= MASK42;
+    h0 += c * 5;
+    c = h0 >> 44;
+    h0 &= MASK44;
+    h1 += c;
+    //h - p, selected if h >= p
+    g0 = h0 + 5;
+    c = g0 >> 44;
+    g0 &= MASK44;
+    g1 = h1 + c;
+    c = g1 >> 44;
+    g1 &= MASK44;
+    g2 = h2 + c - (1ULL << 42);
+    c = (g2 >> 63) - 1;
+    h0 = (h0 & ~c) | (g0 & c);
+    h1 = (h1 & ~c) | (g1 & c);
+    h2 = (h2 & ~c) | (g2 & c);
+    //h + pad mod 2^128
+    h0 += st->pad[0] & MASK44;
+    c = h0 >> 44;
+    h0 &= MASK44;
+    h1 += (((st->pad[0] >> 44) | (st->pad[1] << 20)) & MASK44) + c;
+    c = h1 >> 44;
+    h1 &= MASK44;
+    h2 += ((st->pad[1] >> 24) & MASK42) + c;
+    h2 &= MASK42;
+    store64(tag, h0 | (h1 << 44));
+    store64(tag + 8, (h1 >> 20) | (h2 << 24));
+}
+
+/**
+ * Computes the tag of the packet (additional data and ciphertext) with its one-time key
+ */
+static void packetTag(const unsigned char *polyKey, const aeadPacket *packet, unsigned char *tag) {
+    polyState st;
+    unsigned char lengths[16];
+    polyInit(&st, polyKey);
+    polyUpdate(&st, packet->aad, packet->aadLength);
+    polyUpdate(&st, packet->data, packet->length);
+    store64(lengths, packet->aadLength);
+    store64(lengths + 8, packet->length);
+    polyUpdate(&st, lengths, sizeof(lengths));
+    polyFinish(&st, tag);
+}
+
+void aeadSealBatch(const unsigned char *key, const aeadPacket *packets, int count) {
+    unsigned int setup[12];
+    unsigned char keys[LANES][BLOCK];
+    int first, l;
+
+    chachaSetup(setup, key);
+    for (first = 0; first < count; first += LANES) {
+        polyKeys(setup, packets + first, count - first, keys);
+        for (l = 0; l < LANES && first + l < count; l++) {
+            const aeadPacket *packet = &packets[first + l];
+            chachaXor(setup, packet->nonce, packet->data, packet->length);
+            packetTag(keys[l], packet, packet->tag);
+        }
+    }
+}
+
+unsigned long long aeadOpenBatch(const unsigned char *key, const aeadPacket *packets, int count) {
+    unsigned long long valid = 0;
+    unsigned int setup[12];
+    unsigned char keys[LANES][BLOCK], tag[AEAD_TAG_SIZE], diff;
+    int first, l, i;
+
+    if (count > AEAD_BATCH_MAX)
+        count = AEAD_BATCH_MAX;
+    chachaSetup(setup, key);
+    for (first = 0; first < count; first += LANES) {
+        polyKeys(setup, packets + first, count - first, keys);
+        for (l = 0; l < LANES && first + l < count; l++) {
+            const aeadPacket *packet = &packets[first + l];
+            packetTag(keys[l], packet, tag);
+            for (diff = 0, i = 0; i < AEAD_TAG_SIZE; i++)     //constant time comparison
+                diff |= (unsigned char) (tag[i] ^ packet->tag[i]);
+            if (diff != 0)
+                continue;
+            chachaXor(setup, packet->nonce, packet->data, packet->length);
+            valid |= 1ULL << (first + l);
+        }
+    }
+    return valid;
+}
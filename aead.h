@@ -0,0 +1,43 @@
+#ifndef AEAD_H
+#define AEAD_H
+
+#include <stddef.h>
+
+/**
+ * @brief ChaCha20-Poly1305 authenticated encryption (RFC 8439) in portable C. The ChaCha20 keystream is generated
+ * four blocks at a time with every word of the state kept in a vector of four lanes, so the rounds run as SIMD
+ * operations; the batch functions also generate the one-time Poly1305 keys of four packets at once.
+ */
+
+#define AEAD_KEY_SIZE 32
+#define AEAD_NONCE_SIZE 12
+#define AEAD_TAG_SIZE 16
+#define AEAD_BATCH_MAX 64   //maximum number of the packets of one aeadOpenBatch call
+
+/**
+ * Packet of a batch - data are encrypted or decrypted in place
+ */
+typedef struct aeadPacket {
+    const unsigned char *nonce;     //AEAD_NONCE_SIZE bytes, unique for every packet sealed with the key
+    const unsigned char *aad;       //additional data - authenticated, not encrypted
+    size_t aadLength;
+    unsigned char *data;
+    size_t length;
+    unsigned char *tag;             //AEAD_TAG_SIZE bytes - written by sealing, verified by opening
+} aeadPacket;
+
+/**
+ * Encrypts the packets in place and computes their tags
+ * @param key AEAD_KEY_SIZE bytes
+ */
+void aeadSealBatch(const unsigned char *key, const aeadPacket *packets, int count);
+
+/**
+ * Verifies the tags of the packets and decrypts the valid ones in place (the others are left untouched)
+ * @param key AEAD_KEY_SIZE bytes
+ * @param count Number of the packets, at most AEAD_BATCH_MAX
+ * @return bitmask with bit i set if packet i is valid
+ */
+unsigned long long aeadOpenBatch(const unsigned char *key, const aeadPacket *packets, int count);
+
+#endif //AEAD_H
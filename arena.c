@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "arena.h"
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define BLOCK_HEADER 16         //header before every block - keeps the blocks aligned to 16 bytes
+#define MIN_CLASS_SHIFT 6       //smallest block is 64 bytes (including the header)
+#define CLASSES 20              //largest block is 32 MB
+#define MAX_NODES 1024          //nodes the node mask of mbind can hold
+
+/**
+ * Header of a block, a free block links to the next free block of its class
+ */
+typedef struct blockHeader {
+    unsigned int sizeClass;
+    struct blockHeader *nextFree;
+} blockHeader;
+
+struct memArena {
+    char *base;
+    size_t size;
+    size_t used;                        //bytes carved from the mapping
+    unsigned long long fallbacks;       //requests served by malloc
+    blockHeader *freeBlocks[CLASSES];   //released blocks of each class
+    int pages;
+    int node;
+};
+
+/**
+ * @return size class of the block holding size bytes, CLASSES if it is too large
+ */
+static int sizeClass(size_t size) {
+    int c = 0;
+    size += BLOCK_HEADER;
+    while (c < CLASSES && ((size_t) 1 << (c + MIN_CLASS_SHIFT)) < size)
+        c++;
+    return c;
+}
+
+/**
+ * Maps the memory aligned to the huge page size, so transparent huge pages can back all of it
+ * @return mapping or MAP_FAILED
+ */
+static char *mapAligned(size_t size) {
+    char *map = mmap(NULL, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                     -1, 0);
+    size_t head;
+    if (map == MAP_FAILED)
+        return map;
+    head = (HUGE_PAGE_SIZE - (size_t) map % HUGE_PAGE_SIZE) % HUGE_PAGE_SIZE;
+    if (head > 0)
+        munmap(map, head);
+    munmap(map + head + size, HUGE_PAGE_SIZE - head);
+    return map + head;
+}
+
+memArena *arenaCreate(size_t size, int pages, int node) {
+    memArena *arena = calloc(1, sizeof(memArena));
+    if (arena == NULL)
+        return NULL;
+    arena->size = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    arena->node = -1;
+    arena->base = MAP_FAILED;
+    if (pages == ARENA_PAGES_EXPLICIT) {
+        //pages are reserved from the pool now (without MAP_NORESERVE a short pool fails here, not with SIGBUS later)
+        arena->base = mmap(NULL, arena->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (arena->base != MAP_FAILED)
+            arena->pages = ARENA_PAGES_EXPLICIT;
+        else
+            pages = ARENA_PAGES_TRANSPARENT;    //hugetlbfs pool is not configured or too small
+    }
+    if (arena->base == MAP_FAILED) {
+        if ((arena->base = mapAligned(arena->size)) == MAP_FAILED) {
+            int err = errno;
+            free(arena);
+            errno = err;
+            return NULL;
+        }
+        if (pages == ARENA_PAGES_TRANSPARENT && madvise(arena->base, arena->size, MADV_HUGEPAGE) == 0)
+            arena->pages = ARENA_PAGES_TRANSPARENT;
+    }
+    //preferred, not strict policy - if the node runs out of memory, the pages come from another node
+    if (node >= 0 && node < MAX_NODES) {
+        unsigned long mask[MAX_NODES / (8 * sizeof(unsigned long))] = { 0 };
+        mask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+        if (syscall(SYS_mbind, arena->base, arena->size, MPOL_PREFERRED, mask, MAX_NODES + 1, 0) == 0)
+            arena->node = node;
+    }
+    return arena;
+}
+
+void *arenaAlloc(memArena *arena, size_t size) {
+    blockHeader *block;
+    size_t blockSize;
+    int c;
+
+    if (arena == NULL)
+        return malloc(size);
+    if ((c = sizeClass(size)) == CLASSES) {
+        arena->fallbacks++;     //larger than the largest block
+        return malloc(size);
+    }
+    if ((block = arena->freeBlocks[c]) != NULL) {
+        arena->freeBlocks[c] = block->nextFree;
+        return (char *) block + BLOCK_HEADER;
+    }
+    blockSize = (size_t) 1 << (c + MIN_CLASS_SHIFT);
+    if (arena->size - arena->used < blockSize) {
+        arena->fallbacks++;     //arena is full
+        return malloc(size);
+    }
+    block = (blockHeader *) (arena->base + arena->used);
+    arena->used += blockSize;
+    block->sizeClass = (unsigned int) c;
+    return (char *) block + BLOCK_HEADER;
+}
+
+void *arenaCalloc(memArena *arena, size_t count, size_t size) {
+    void *block;
+    if (size != 0 && count > (size_t) -1 / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if ((block = arenaAlloc(arena, count * size)) != NULL)
+        memset(block, 0, count * size);
+    return block;
+}
+
+void arenaFree(memArena *arena, void *block) {
+    blockHeader *header;
+    if (block == NULL)
+        return;
+    if (arena == NULL || (char *) block < arena->base || (char *) block >= arena->base + arena->size) {
+        free(block);
+        return;
+    }
+    header = (blockHeader *) ((char *) block - BLOCK_HEADER);
+    header->nextFree = arena->freeBlocks[header->sizeClass];
+    arena->freeBlocks[header->sizeClass] = header;
+}
+
+int arenaPages(const memArena *arena) {
+    return arena->pages;
+}
+
+int arenaNode(const memArena *arena) {
+    return arena->node;
+}
+
+size_t arenaUsed(const memArena *arena) {
+    return arena->used;
+}
+
+unsigned long long arenaFallbacks(const memArena *arena) {
+    return arena->fallbacks;
+}
+
+int arenaCpuNode(int cpu) {
+    char path[64];
+    struct dirent *entry;
+    DIR *dir;
+    int node = -1;
+
+    if (cpu < 0)
+        return -1;
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    if ((dir = opendir(path)) == NULL)
+        return -1;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, "node", 4) == 0 && sscanf(entry->d_name + 4, "%d", &node) == 1)
+            break;
+        node = -1;
+    }
+    closedir(dir);
+    return node;
+}
+
+void arenaDestroy(memArena *arena) {
+    if (arena == NULL)
+        return;
+    munmap(arena->base, arena->size);
+    free(arena);
+}
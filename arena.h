@@ -0,0 +1,76 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/**
+ * @brief Memory arena of one context (and so of the thread driving it). One anonymous mapping is reserved up front,
+ * backed by transparent or explicit huge pages, so the session tables and buffer pools take a few TLB entries
+ * instead of hundreds, and bound (preferred policy) to a NUMA node - the node of the CPU of the thread, so the memory
+ * is not accessed across the interconnect. Blocks are carved from the mapping in power-of-two size classes and
+ * released blocks are kept in a free list of their class for reuse. Requests the arena cannot satisfy (too large,
+ * or the arena is full) are served by malloc, arenaFree tells them apart by the address.
+ * The arena is not thread-safe, it belongs to one thread.
+ */
+
+#define ARENA_PAGES_NONE 0          //ordinary pages
+#define ARENA_PAGES_TRANSPARENT 1   //transparent huge pages (madvise)
+#define ARENA_PAGES_EXPLICIT 2      //explicit huge pages (MAP_HUGETLB) from the hugetlbfs pool
+
+typedef struct memArena memArena;
+
+/**
+ * Reserves the arena - the memory is committed as it is used
+ * @param size Size of the arena in bytes (rounded up to 2 MB)
+ * @param pages ARENA_PAGES_* - explicit huge pages fall back to transparent ones if the pool has not enough pages
+ * @param node NUMA node preferred for the memory, -1 for the default policy
+ * @return new arena or NULL on error (errno is set)
+ */
+memArena *arenaCreate(size_t size, int pages, int node);
+
+/**
+ * @return block of at least size bytes (aligned to 16 bytes), NULL if there is not enough memory
+ */
+void *arenaAlloc(memArena *arena, size_t size);
+
+/**
+ * @return zeroed block of count * size bytes, NULL if there is not enough memory
+ */
+void *arenaCalloc(memArena *arena, size_t count, size_t size);
+
+/**
+ * Releases the block of the arena (or the malloc block), NULL arena releases the block with free
+ */
+void arenaFree(memArena *arena, void *block);
+
+/**
+ * @return ARENA_PAGES_* the arena is backed by (transparent if requested, the kernel may still use ordinary pages)
+ */
+int arenaPages(const memArena *arena);
+
+/**
+ * @return NUMA node the arena is bound to, -1 if it is not bound
+ */
+int arenaNode(const memArena *arena);
+
+/**
+ * @return bytes of the arena used by the blocks (including the free ones)
+ */
+size_t arenaUsed(const memArena *arena);
+
+/**
+ * @return requests served by malloc because they were too large or the arena was full
+ */
+unsigned long long arenaFallbacks(const memArena *arena);
+
+/**
+ * @return NUMA node of the CPU, -1 if it is not known (no NUMA support, no such CPU)
+ */
+int arenaCpuNode(int cpu);
+
+/**
+ * Unmaps the arena - all its blocks are released (blocks allocated by malloc are not)
+ */
+void arenaDestroy(memArena *arena);
+
+#endif //ARENA_H
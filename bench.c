@@ -0,0 +1,345 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "communicator.h"
+#include "crc32.h"
+#include "siphash.h"
+#include "aead.h"
+#include "scan.h"
+#define MAX_EVENTS 16
+#define CRC_ROUNDS 20000    //batches hashed by the verification benchmark
+#define SCAN_ROUNDS 200     //sweeps of the deadline array by the scan benchmark
+
+/**
+ * @brief Latency benchmark of libcommunicator. The server runs in a forked process, the client sends the messages one
+ * by one and measures the time from commSubmit to the acknowledgement of the message by the server. Percentiles of
+ * the latency are printed by the client, the CPU time used by the server by the server, so the latency of the busy
+ * polling mode (-b) can be compared with its cost.
+ *
+ * Usage: commbench [-n messages] [-s size] [-b busyPollUs] [-c cpu] [-p port] [-v] [-d sessions]
+ * With -c the server is pinned to the cpu and the client to the next one. The client also prints its round trips
+ * measured by the kernel timestamps, split into the network time and the host processing time.
+ * With -v no messages are sent - the cost of the packet verification per fragment of size bytes is measured
+ * instead, for the CRC, the SipHash authentication tag and the AEAD encryption (sealed and opened again),
+ * single-stream and in the batch of a GRO datagram.
+ * With -d no messages are sent either - the timer sweep of commPoll (the nearest deadline and the due sessions) is
+ * timed over a synthetic deadline array of the given number of sessions.
+ */
+
+/**
+ * @return monotonic time in nanoseconds
+ */
+static long long nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int compareLatency(const void *a, const void *b) {
+    long long x = *(const long long *) a, y = *(const long long *) b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * @return upper bound (microseconds) of the histogram bucket with the median sample, 0 if there are no samples
+ */
+static long long histogramMedian(const unsigned long long *histogram) {
+    unsigned long long total = 0, count = 0;
+    int i;
+    for (i = 0; i < COMM_LATENCY_BUCKETS; i++)
+        total += histogram[i];
+    for (i = 0; i < COMM_LATENCY_BUCKETS && total > 0; i++) {
+        if ((count += histogram[i]) * 2 >= total)
+            return 1LL << i;
+    }
+    return 0;
+}
+
+/**
+ * Compares the single-stream and the batch verification (CRC, SipHash and AEAD) of CRC32_BATCH_MAX fragments
+ * @return exit status of the process
+ */
+static int verifyBenchmark(size_t size) {
+    static const unsigned char key[SIPHASH_KEY_SIZE] = "commbench-key-01";
+    static const unsigned char aeadKey[AEAD_KEY_SIZE] = "commbench-aead-key-0123456789ab";
+    unsigned char nonces[CRC32_BATCH_MAX][AEAD_NONCE_SIZE], aeadTags[CRC32_BATCH_MAX][AEAD_TAG_SIZE];
+    aeadPacket sealed[CRC32_BATCH_MAX];
+    const unsigned char *messages[CRC32_BATCH_MAX];
+    size_t lengths[CRC32_BATCH_MAX];
+    unsigned int expected[CRC32_BATCH_MAX];
+    unsigned long long valid = 0, tags[CRC32_BATCH_MAX], expectedTags[CRC32_BATCH_MAX];
+    unsigned char *data = malloc(CRC32_BATCH_MAX * size);
+    long long start, single, batch;
+    int i, r;
+
+    if (data == NULL)
+        return 1;
+    for (i = 0; i < CRC32_BATCH_MAX * (int) size; i++)
+        data[i] = (unsigned char) (i * 31 + 7);
+    for (i = 0; i < CRC32_BATCH_MAX; i++) {
+        messages[i] = data + i * size;
+        lengths[i] = size;
+        expected[i] = crc32b(messages[i], size);
+        expectedTags[i] = sipHash(key, messages[i], size);
+        memset(nonces[i], 0, AEAD_NONCE_SIZE);
+        memcpy(nonces[i], &i, sizeof(i));
+        sealed[i].nonce = nonces[i];
+        sealed[i].aad = data + i * size;    //header of the fragment
+        sealed[i].aadLength = size < 9 ? size : 9;
+        sealed[i].data = data + i * size + sealed[i].aadLength;
+        sealed[i].length = size - sealed[i].aadLength;
+        sealed[i].tag = aeadTags[i];
+    }
+    start = nowNs();
+    for (r = 0; r < CRC_ROUNDS; r++) {
+        for (i = 0; i < CRC32_BATCH_MAX; i++)
+            valid += crc32b(messages[i], lengths[i]) == expected[i];
+    }
+    single = nowNs() - start;
+    start = nowNs();
+    for (r = 0; r < CRC_ROUNDS; r++)
+        valid += (unsigned long long) __builtin_popcountll(crc32Batch(messages, lengths, expected, CRC32_BATCH_MAX));
+    batch = nowNs() - start;
+    printf("crc: fragments of %zu B, single stream %.1f ns, batch %.1f ns per fragment (%llu verified)\n", size,
+           (double) single / CRC_ROUNDS / CRC32_BATCH_MAX, (double) batch / CRC_ROUNDS / CRC32_BATCH_MAX, valid);
+
+    start = nowNs();
+    for (r = 0; r < CRC_ROUNDS; r++) {
+        for (i = 0; i < CRC32_BATCH_MAX; i++)
+            valid += sipHash(key, messages[i], lengths[i]) == expectedTags[i];
+    }
+    single = nowNs() - start;
+    start = nowNs();
+    for (r = 0; r < CRC_ROUNDS; r++) {
+        sipHashBatch(key, messages, lengths, tags, CRC32_BATCH_MAX);
+        for (i = 0; i < CRC32_BATCH_MAX; i++)
+            valid += tags[i] == expectedTags[i];
+    }
+    batch = nowNs() - start;
+    printf("siphash: fragments of %zu B, single stream %.1f ns, batch %.1f ns per fragment (%llu verified)\n", size,
+           (double) single / CRC_ROUNDS / CRC32_BATCH_MAX, (double) batch / CRC_ROUNDS / CRC32_BATCH_MAX, valid);
+
+    //every round seals the fragments and opens them again, so they stay the same
+    start = nowNs();
+    for (r = 0; r < CRC_ROUNDS; r++) {
+        for (i = 0; i < CRC32_BATCH_MAX; i++) {
+            aeadSealBatch(aeadKey, &sealed[i], 1);
+            valid += aeadOpenBatch(aeadKey, &sealed[i], 1);
+        }
+    }
+    single = nowNs() - start;
+    start = nowNs();
+    for (r = 0; r < CRC_ROUNDS; r++) {
+        aeadSealBatch(aeadKey, sealed, CRC32_BATCH_MAX);
+        valid += (unsigned long long) __builtin_popcountll(aeadOpenBatch(aeadKey, sealed, CRC32_BATCH_MAX));
+    }
+    batch = nowNs() - start;
+    printf("aead: fragments of %zu B, single stream %.1f ns, batch %.1f ns per fragment (%llu verified)\n", size,
+           (double) single / CRC_ROUNDS / CRC32_BATCH_MAX, (double) batch / CRC_ROUNDS / CRC32_BATCH_MAX, valid);
+    free(data);
+    return valid == 6ULL * CRC_ROUNDS * CRC32_BATCH_MAX ? 0 : 1;
+}
+
+/**
+ * Times the scans of the timer sweep - the nearest deadline (the wakeup of commPoll) and the collection of the due
+ * sessions - over random deadlines of count sessions, about 1 % of them due
+ * @return exit status of the process
+ */
+static int scanBenchmark(int count) {
+    long long *deadlines = malloc(count * sizeof(long long)), start, nearest = 0, elapsed;
+    int *due = malloc(count * sizeof(int)), collected = 0, i, r;
+
+    if (deadlines == NULL || due == NULL) {
+        free(deadlines);
+        free(due);
+        return 1;
+    }
+    srand(1);
+    for (i = 0; i < count; i++)
+        deadlines[i] = rand() % 100000;
+    start = nowNs();
+    for (r = 0; r < SCAN_ROUNDS; r++) {
+        nearest += scanMin(deadlines, count);
+        collected += scanDue(deadlines, count, 1000, due);
+    }
+    elapsed = nowNs() - start;
+    printf("scan: %d sessions, min + due sweep %.1f us (%.2f ns per session, %d due)\n", count,
+           (double) elapsed / SCAN_ROUNDS / 1e3, (double) elapsed / SCAN_ROUNDS / count, collected / SCAN_ROUNDS);
+    free(deadlines);
+    free(due);
+    return nearest >= 0 ? 0 : 1;
+}
+
+/**
+ * Completion callback of the sent message - stores the result to the variable passed as userData
+ */
+static void messageCompleted(commContext *ctx, const commEvent *event) {
+    (void) ctx;
+    *(int *) event->userData = event->type;
+}
+
+/**
+ * Server process - receives until the client closes the session, then prints the used CPU time
+ * @return exit status of the process
+ */
+static int server(const commConfig *config) {
+    commContext *ctx;
+    commEvent events[MAX_EVENTS];
+    commStats stats;
+    struct rusage usage;
+    long long start;
+    double wall, cpu;
+    int i, n, running = 1;
+
+    if ((ctx = commServerCreate(config)) == NULL) {
+        perror("Server create error");
+        return 1;
+    }
+    start = nowNs();
+    while (running && (n = commPoll(ctx, events, MAX_EVENTS, -1)) >= 0) {
+        for (i = 0; i < n; i++) {
+            if (events[i].type == COMM_EVENT_CLOSED)
+                running = 0;
+        }
+    }
+    wall = (double) (nowNs() - start) / 1e9;
+    getrusage(RUSAGE_SELF, &usage);
+    cpu = (double) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+          (double) (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+    commGetStats(ctx, &stats);
+    printf("server: cpu %.2f s of %.2f s (%.0f %% of a core), busy polls %llu hit, %llu missed\n",
+           cpu, wall, wall > 0 ? 100 * cpu / wall : 0, stats.busyPollHits, stats.busyPollMisses);
+    commDestroy(ctx);
+    return 0;
+}
+
+/**
+ * Client - sends the messages one by one and prints the latency percentiles
+ * @return exit status of the process
+ */
+static int client(const commConfig *config, int count, size_t size) {
+    commContext *ctx;
+    commEvent events[MAX_EVENTS];
+    commMessage msg;
+    commStats stats;
+    long long *latency, start;
+    char *message;
+    int i, n, result = 0, done = 0;
+
+    if ((ctx = commClientCreate(config)) == NULL) {
+        perror("Client create error");
+        return 1;
+    }
+    while (result == 0 && (n = commPoll(ctx, events, MAX_EVENTS, -1)) >= 0) {
+        for (i = 0; i < n; i++) {
+            if (events[i].type == COMM_EVENT_CONNECTED || events[i].type == COMM_EVENT_FAILED)
+                result = events[i].type;
+        }
+    }
+    if (result != COMM_EVENT_CONNECTED) {
+        printf("Server is not responding.\n");
+        commDestroy(ctx);
+        return 1;
+    }
+    latency = malloc(count * sizeof(long long));
+    message = calloc(1, size);
+    for (done = 0; done < count; done++) {
+        memset(&msg, 0, sizeof(msg));
+        msg.data = message;
+        msg.length = size;
+        msg.onComplete = messageCompleted;
+        msg.userData = &result;
+        result = 0;
+        start = nowNs();
+        if (commSubmit(ctx, &msg) < 0) {
+            perror("Message submit error");
+            break;
+        }
+        while (result == 0 && commPoll(ctx, events, MAX_EVENTS, -1) >= 0);
+        latency[done] = nowNs() - start;
+        if (result != COMM_EVENT_SENT) {
+            printf("Message %d not sent.\n", done);
+            break;
+        }
+    }
+    if (done > 0) {
+        qsort(latency, done, sizeof(long long), compareLatency);
+        printf("client: %d messages of %zu B, latency p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us\n",
+               done, size, latency[done / 2] / 1e3, latency[done * 99 / 100] / 1e3,
+               latency[done * 999 / 1000] / 1e3, latency[done - 1] / 1e3);
+    }
+    //round trips measured by the kernel timestamps - network time and host processing time are reported apart
+    commGetStats(ctx, &stats);
+    printf("client: %llu round trips (%llu with kernel TX timestamps), srtt %lld us, rto %d ms, median round trip "
+           "< %lld us, network < %lld us, host < %lld us\n", stats.rttSamples, stats.stampedSamples, stats.srttUs,
+           stats.rtoMs, histogramMedian(stats.rttHistogram), histogramMedian(stats.networkHistogram),
+           histogramMedian(stats.hostHistogram));
+    free(latency);
+    free(message);
+    commDestroy(ctx);   //closes the session, the server stops
+    return done == count ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+    commConfig config;
+    int option, count = 10000, status = 0, crc = 0, sessions = 0;
+    size_t size = 64;
+    pid_t pid;
+
+    commConfigInit(&config);
+    while ((option = getopt(argc, argv, "n:s:b:c:p:vd:")) != -1) {
+        switch (option) {
+            case 'n':
+                count = atoi(optarg);
+                break;
+            case 's':
+                size = (size_t) atol(optarg);
+                break;
+            case 'b':
+                config.busyPollUs = atoi(optarg);
+                break;
+            case 'c':
+                config.cpu = atoi(optarg);
+                break;
+            case 'p':
+                config.port = (unsigned short) atoi(optarg);
+                break;
+            case 'v':
+                crc = 1;
+                break;
+            case 'd':
+                sessions = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n messages] [-s size] [-b busyPollUs] [-c cpu] [-p port] [-v] "
+                                "[-d sessions]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (count <= 0 || size == 0 || size > COMM_MAX_MESSAGE) {
+        fprintf(stderr, "Invalid message count or size\n");
+        return 1;
+    }
+    if (crc)
+        return verifyBenchmark(size);
+    if (sessions > 0)
+        return scanBenchmark(sessions);
+
+    fflush(stdout);
+    if ((pid = fork()) < 0) {
+        perror("fork");
+        return 1;
+    }
+    if (pid == 0)
+        return server(&config);
+    if (config.cpu >= 0)
+        config.cpu++;
+    usleep(100000);     //server socket is bound
+    status = client(&config, count, size);
+    waitpid(pid, NULL, 0);
+    return status;
+}
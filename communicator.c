@@ -0,0 +1,3862 @@
+#define _GNU_SOURCE     //sched_setaffinity
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sched.h>
+#include <dirent.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/random.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <memory.h>
+#include <unistd.h>
+#include "communicator.h"
+#include "crc32.h"
+#include "dedup.h"
+#include "msglog.h"
+#include "arena.h"
+#include "siphash.h"
+#include "aead.h"
+#include "workpool.h"
+#include "congestion.h"
+#include "scan.h"
+
+#define MAX_SESSIONS 64         //maximum number of clients the server keeps the state for
+#define MAX_RECV_BATCH 64       //maximum number of datagrams processed by one commPoll call
+#define RX_READ_BATCH 256       //server: maximum number of datagrams read from the socket by one commPoll call
+#define RX_QUEUE 128            //server: received packets of one client waiting to be processed
+#define RX_QUANTUM ((int) sizeof(customPktHeader))  //bytes processed for every client in one round of the receive DRR
+#define SEND_BUDGET 1024        //server: maximum number of packets sent to the clients by one commPoll call
+#define SEND_QUANTUM 16         //packets sent to every client in one round of the send DRR
+#define OVERLOAD_BACKLOG 256    //server: queued received packets above which the server is overloaded
+#define OVERLOAD_HOLD_MS 100    //server: time without overload signs after which the overload level goes down
+#define BUSY_BACKOFF_MAX 16     //maximum back-off after busy replies in multiples of the retransmission timeout
+#define BUFFER_HEADROOM 2       //automatic socket buffers hold this many bandwidth-delay products of every session
+#define MAX_DROP_BOOST 16       //maximum multiplier of the automatic receive buffer after the kernel drops
+#define GSO_MAX_BYTES 65000     //maximum size of the packets coalesced into one UDP_SEGMENT send
+#define GSO_MAX_SEGMENTS 64     //maximum number of the packets coalesced into one send (kernel UDP_MAX_SEGMENTS)
+#define RX_BUFFER_SIZE 65536    //receive buffer - room for a datagram coalesced by UDP_GRO
+#define AEAD_TRAILER (sizeof(unsigned long long) + AEAD_TAG_SIZE)  //sequence number and tag after an AEAD payload
+#define CRYPTO_CHUNK 4          //AEAD packets sealed or opened by one task of the worker pool (one lane group)
+#define ZC_BUFFERS 16           //send buffers which can be pinned by MSG_ZEROCOPY sends at once
+#define ZEROCOPY_MIN_BYTES 16384    //smaller sends are copied - page pinning and the completion cost more than the copy
+#define BUSY_IDLE_SPINS 64      //busy polls without a packet after which commPoll sleeps until the next packet
+#define TX_STAMP_RING 1024      //sends whose kernel TX timestamps are kept for the round-trip samples
+#define RTO_MIN_MS 10           //lower bound of the measured retransmission timeout
+#define RTO_MAX_MS 60000        //upper bound of the measured retransmission timeout
+#define RTO_GRANULARITY_US 1000     //clock granularity term of the RTO (timers have millisecond resolution)
+#define TLP_MIN_MS 2            //lower bound of the tail-loss probe timeout (a fraction of RTO_MIN_MS)
+#define CLOSE_NUMBER SHRT_MAX   //packet number of the close frame and its ACK (above the END of the longest message)
+#define CLOSE_LINGER 2          //longest retransmission timeouts a closed session is kept to acknowledge the frames
+                                //the peer sends again (its last ACKs were lost)
+#define TIMESTAMPING_FLAGS (SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE | \
+                            SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY)
+#define MAX_OPEN_MESSAGES 256   //maximum number of messages of one session which can be received at the same time
+#define MAX_FRAGMENTS ((COMM_MAX_MESSAGE + COMM_FRAG_MIN - 1) / COMM_FRAG_MIN)     //fragments of the longest message
+#define FRAG_EVAL_PACKETS 128   //first transmissions of the fragments after which the fragment size is re-evaluated
+#define FRAG_LOSS_HIGH 50       //smoothed loss (per mille of the fragments retransmitted) above which they are halved
+#define FRAG_LOSS_LOW 10        //smoothed loss up to which the fragments are doubled
+#define FRAG_BITMAP_WORDS ((MAX_FRAGMENTS + 63) / 64)
+#define HISTORY_QUEUE 128       //maximum number of history messages of one session queued for sending at once
+#define RELAY_QUEUE 128         //maximum number of relayed messages of one class and session waiting to be started
+#define MAX_MAILBOXES LOG_MAX_NAMES     //maximum number of named clients the server keeps the queues for
+#define RESTORE_CHUNK 4096      //number of log records read at once when the queues are restored
+#define DEDUP_WINDOW 1024       //number of delivered message ids of one session remembered in its bitmap
+#define DEDUP_BUCKETS 16384     //buckets of one generation of the message id filter (4 ids per bucket)
+#define SCHED_STRIDE 1048576ULL //stride scheduler pass advanced by SCHED_STRIDE / weight for every started message
+
+/**
+ * Packet types used in the type field of the customPktHeader
+ */
+#define PKT_ACK 0           //acknowledgement, messageId and packetNumber identify the acknowledged packet
+#define PKT_RESEND 1        //packet-resend flag (packet could not be verified, it should be sent again)
+#define PKT_KEEPALIVE 2     //keepalive packet (not used)
+#define PKT_ERROR 3         //packet integrity error (message cannot be received - terminal error for the message)
+#define PKT_INIT 4          //server-client connection init, messageId is the id of the first message of the client
+#define PKT_BUSY 5          //server is overloaded - the packet (or connection init) was dropped, the sender should back off
+#define PKT_CLOSE 6         //sender closes its side of the session (sends no new messages), the receiver replies with
+                            //ACK; messageId is the id after the last message of the sender, packetNumber is CLOSE_NUMBER
+#define PKT_DATA 10         //message fragment
+#define PKT_END 16          //last-packet flag (sent after all fragments are acknowledged, the receiver replies with
+                            //ACK once the message is delivered and the transmission of the message is ended)
+#define PKT_TYPE_MASK 0x3F          //DATA and END packets carry the priority class of the message in the upper bits
+#define PKT_PRIORITY_SHIFT 6        //of the type, so an overloaded receiver can shed them before they are processed
+
+/**
+ * Custom header with data to verify the integrity of the UDP packets
+ * CRC covers the rest of the header and the payload, messageId and packetNumber identify the message and the index
+ * of the fragment in it (END packet has number packetCount + 1), type is one of the PKT_* values
+ */
+typedef struct customPktHeader{
+    int crcChecksum;
+    unsigned int messageId;
+    short packetNumber;
+    short packetCount;
+    unsigned char type;
+    char message[1451]; //maximum size of the message in the packets needs to be 1451 bytes, because of the Ethernet II packet limit (1500B of payload)
+}customPktHeader;
+
+#define HEADER_SIZE offsetof(customPktHeader, message)  //size of the header part of the customPktHeader (in bytes)
+
+/**
+ * Flags of the message in its END packet
+ */
+#define MSG_HISTORY_REQUEST 1   //message is a historyRequest, answered by the server instead of being delivered
+#define MSG_HISTORY 2           //message is a record of the server message log returned for a history request
+#define MSG_HISTORY_END 4       //empty message which ends the reply to a history request
+#define MSG_RELAYED 8           //message of another client relayed by the server
+
+/**
+ * Payload of the END packet
+ * firstPending is the lowest messageId the sender has not completed yet - messages below it which are not complete
+ * at the receiver were abandoned by the sender and are skipped, so they do not block the in-order delivery
+ * The rest is the metadata of the message - sequence, timestamp and sender are filled only in the history messages
+ */
+typedef struct messageTrailer {
+    unsigned int firstPending;
+    unsigned int length;
+    unsigned int channel;
+    unsigned short flags;           //MSG_* flags
+    unsigned short senderPort;
+    unsigned long long sequence;
+    long long timestamp;
+    unsigned int senderAddress;
+    unsigned int requestId;         //id of the history request
+    char name[COMM_NAME_MAX];       //recipient of the message sent to the server, sender of the message sent by it
+    unsigned long long id;          //64-bit id of the message, 0 if it is not deduplicated
+    unsigned int ttlMs;             //rest of the TTL when the END packet was sent, 0 for no limit
+    unsigned int priority;          //commPriority of the message
+} messageTrailer;
+
+/**
+ * Payload of the history request message (commHistoryQuery in the wire format)
+ */
+typedef struct historyRequest {
+    unsigned long long fromSequence;
+    long long fromTimestamp;
+    unsigned int channel;
+    unsigned int senderAddress;
+    unsigned short senderPort;      //0 for all senders
+    unsigned short newest;
+    unsigned int limit;
+} historyRequest;
+
+/**
+ * Message submitted for sending - it waits in the queue of its priority class until the scheduler starts it, started
+ * entries of a session are kept in the order of their messageId (assigned when the message starts)
+ */
+typedef struct sendEntry {
+    commMessage message;
+    messageTrailer trailer;     //metadata sent in the END packet
+    char *owned;                //library buffer with the data, released with the entry
+    unsigned char internal;     //message generated by the library - its successful completion is not reported
+    struct storedMessage *stored;   //relayed message, NULL for the other messages
+    long long deadline;         //time (monotonic) when the TTL of the message expires, 0 for no limit
+    unsigned char started;
+    unsigned int messageId;
+    size_t fragSize;            //size of the data fragments (but the last one), chosen when the message is started
+    short packetCount;          //number of data fragments
+    short nextPacket;           //next data fragment which has not been sent yet
+    short ackedCount;           //number of acknowledged data fragments
+    unsigned char endReady;     //all fragments acknowledged, END packet waits for a free window slot
+    unsigned char endSent;
+    unsigned long long acked[FRAG_BITMAP_WORDS];
+    struct sendEntry *prev, *next;
+} sendEntry;
+
+/**
+ * Slot of the send window - packet waiting for acknowledgement
+ */
+typedef struct inFlightPacket {
+    sendEntry *entry;           //NULL if the slot is free
+    short packetNumber;
+    long long sentAt;
+    int attempts;
+    long long sentNs;           //time of the first transmission (real time), 0 after a retransmission - no RTT sample
+    unsigned long long txId;    //send which carried the first transmission (matches its kernel TX timestamp)
+    congestionSample sample;    //state of the congestion control at the last transmission
+} inFlightPacket;
+
+/**
+ * Message being received
+ */
+typedef struct reassembly {
+    unsigned int messageId;
+    short packetCount;
+    short receivedCount;
+    unsigned char ended;        //END received and all fragments are present
+    size_t length;
+    unsigned long long sequence;    //sequence number in the message log, 0 if the message is not logged
+    long long timestamp;            //time of the completion in milliseconds since the epoch
+    messageTrailer trailer;
+    struct mailbox *recipient;      //server: mailbox the message is relayed to, NULL if it is not relayed
+    unsigned char duplicate;        //message with this id was already delivered - it is acknowledged, not delivered
+    unsigned long long received[FRAG_BITMAP_WORDS];
+    size_t fragSize;                //size of the fragments but the last one, known from the first one received
+    char *buffer;                   //allocated once the fragment size is known
+} reassembly;
+
+/**
+ * History request being answered by the server - found records are sent one by one as the send queue drains
+ */
+typedef struct historyJob {
+    unsigned int requestId;
+    logRecordRef *results;
+    size_t count;
+    size_t next;                //next record to be sent
+    struct historyJob *nextJob;
+} historyJob;
+
+/**
+ * Message kept by the server for its recipient until the recipient acknowledges it
+ */
+typedef struct storedMessage {
+    unsigned long long order;           //position in the queue of the recipient
+    unsigned long long sequence;        //sequence number in the message log, 0 if the message is not logged
+    unsigned long long id;
+    long long timestamp;
+    long long deadline;                 //time (since the epoch) when the TTL of the message expires, 0 for no limit
+    unsigned int channel;
+    commPriority priority;
+    struct sockaddr_in origin;          //address of the sender
+    struct mailbox *sender;             //NULL if the sender has no name
+    const char *data;                   //record in the log mapping or the owned copy
+    size_t length;
+    char *owned;                        //copy of the message if it is not logged
+    unsigned char backlog;              //stored while the recipient was offline - sent at most at relayDrainRate
+    unsigned char acked;
+    struct sendEntry *entry;            //entry of the message being sent, NULL if it is not being sent
+    struct storedMessage *next;
+    struct storedMessage *classNext;    //next message of the same priority class
+} storedMessage;
+
+/**
+ * Named client and the queue of the messages relayed to it
+ */
+typedef struct mailbox {
+    char name[COMM_NAME_MAX];
+    unsigned int logId;                 //name id in the message log, 0 if the log is disabled
+    struct commSession *session;        //session of the connected client, NULL if it is offline
+    storedMessage *head, *tail;
+    storedMessage *classHead[COMM_PRIORITY_CLASSES], *classTail[COMM_PRIORITY_CLASSES];     //messages of each class
+    storedMessage *sendCursor[COMM_PRIORITY_CLASSES];  //next message of the class to be sent (messages being sent
+                                                        //or acknowledged are skipped)
+    unsigned long long nextOrder;
+    size_t bytes;                       //size of the owned copies
+    double tokens;                      //token bucket of the queue draining
+    long long refilledAt;
+} mailbox;
+
+/**
+ * State of the communication with one peer (client keeps one session for the server)
+ */
+typedef struct commSession {
+    int used;
+    int initialized;                            //server: init packet of the client was received
+    struct sockaddr_in addr;
+
+    //receiving side
+    unsigned int initId;                        //messageId announced in the init packet
+    unsigned int nextDeliver;                   //messageId of the next message to be delivered
+    unsigned long long delivered[DEDUP_WINDOW / 64];    //ids before nextDeliver which were delivered, not skipped
+    reassembly *partial[MAX_OPEN_MESSAGES];     //messages being received, indexed by messageId % MAX_OPEN_MESSAGES
+
+    //sending side
+    sendEntry *queueHead, *queueTail;           //started messages not completed yet
+    sendEntry *waitHead[COMM_PRIORITY_CLASSES], *waitTail[COMM_PRIORITY_CLASSES];  //messages waiting to be started
+    int waiting[COMM_PRIORITY_CLASSES];         //number of the messages waiting in each class
+    unsigned long long pass[COMM_PRIORITY_CLASSES];     //stride scheduler position of each class
+    unsigned long long virtualTime;             //pass of the class which started the last message
+    long long nextExpiry;                       //earliest deadline of the queued messages, 0 if none has a TTL
+    sendEntry *current;                         //message whose fragments are being sent
+    unsigned int nextMessageId;
+    unsigned int submitted;                     //client: number of the submitted messages (lower half of their ids)
+    unsigned int nextRequestId;                 //client: id of the last history request
+    int endsReady;                              //number of messages waiting for their END packet to be sent
+    inFlightPacket *window;
+    int inFlight;
+    congestionState cc;                         //congestion control, started with the window
+    historyJob *history, *historyTail;          //server: history requests being answered
+    mailbox *mailbox;                           //server: mailbox of the named client, NULL if it has no name
+
+    //server: fair queuing and rate limits of the client
+    int sendDeficit;                            //packets the session can still send in the current DRR round
+    long long busyUntil;                        //peer is overloaded - no new packets are sent before this time
+    int busyBackoff;                            //current back-off after busy replies (ms), 0 if the peer is not busy
+    double packetTokens;                        //token bucket of the packets received from the client
+    double byteTokens[COMM_PRIORITY_CLASSES];   //token buckets of the message bytes accepted from the client
+    long long refilledAt;                       //time of the last refill of the buckets, 0 if they are not filled yet
+
+    //round-trip estimation (RFC 6298) from the kernel timestamps of the packets and their ACKs
+    long long srttUs;                           //smoothed round-trip time, 0 before the first sample
+    long long rttvarUs;                         //round-trip time variation
+    int rto;                                    //retransmission timeout (ms), 0 before the first sample
+    unsigned int marked;                        //CE marked data packets received from the peer
+    unsigned int markedReported;                //CE marks of the sent packets the peer reported
+
+    //time-based loss detection (RACK, RFC 8985) and tail-loss probes
+    long long rackSentUs;                       //latest send time of the acknowledged packets, 0 before the first ACK
+    long long rackRttUs;                        //round trip of that packet (monotonic clock of the application)
+    int probing;                                //tail-loss probe sent, no ACK arrived since
+
+    //orderly close - every side closes its direction with a close frame acknowledged by the peer
+    int closing;                                //this side sends no new messages, the close frame follows the last one
+    int closeAttempts;                          //close frames sent
+    long long closeSentAt;                      //time of the last close frame
+    unsigned int closeId;                       //id of the close frame (the id after the last message)
+    int closeAcked;                             //peer has acknowledged the close frame
+    int peerClosed;                             //peer has closed its direction
+    long long lingerUntil;                      //both directions are closed - the state is released at this time
+    long long peerCloseBy;                      //close frame acknowledged - the peer is expected to close its
+                                                //direction by this time (0 if it is not awaited)
+
+    //adaptive fragment size
+    size_t fragSize;                            //fragment size of the messages started next, 0 before the first one
+    int fragSent;                               //fragments sent for the first time since the last evaluation
+    int fragLost;                               //fragments retransmitted since the last evaluation
+    int fragLoss;                               //smoothed loss of the evaluations (per mille)
+
+    //authentication
+    int keyed;                                  //key of the session is derived
+    unsigned char key[AEAD_KEY_SIZE];           //key of the packets of the session (SipHash uses its first half)
+    unsigned long long nonce;                   //server: nonce sent in the init ACK (the key is derived from it)
+    unsigned long long txSeq;                   //AEAD: sequence number of the last sealed packet
+} commSession;
+
+/**
+ * Acknowledgement of the END packet which waits for the group commit of the message log
+ */
+typedef struct deferredAck {
+    struct sockaddr_in addr;
+    unsigned int messageId;
+    short packetNumber;
+    long long receivedNs;       //kernel timestamp of the END packet
+    unsigned int marked;        //CE marks received from the peer up to the END packet
+} deferredAck;
+
+/**
+ * Event waiting to be returned by commPoll or passed to a completion callback, owned is the library buffer which has
+ * to be released after the event is handed out to the application
+ */
+typedef struct pendingEvent {
+    commEvent event;
+    commCallback callback;
+    char *owned;
+} pendingEvent;
+
+/**
+ * Send buffer of the MSG_ZEROCOPY sends - its pages stay pinned by the kernel until the completion of the send is
+ * read from the error queue of the socket
+ */
+typedef struct zcBuffer {
+    char *data;                 //GSO_MAX_BYTES, allocated when zero-copy sending is enabled
+    unsigned int id;            //number of the zero-copy send (the kernel numbers the sends of the socket from 0)
+    int busy;
+} zcBuffer;
+
+/**
+ * Send of the socket numbered by SOF_TIMESTAMPING_OPT_ID and its kernel TX timestamp
+ */
+typedef struct txStamp {
+    unsigned long long id;      //number of the send restart in the upper half, number of the send in the lower one
+    long long kernelNs;         //TX timestamp (real time), 0 until it is read from the error queue
+} txStamp;
+
+/**
+ * Received packet waiting to be processed
+ */
+typedef struct rxPacket {
+    customPktHeader packet;
+    ssize_t n;
+    struct sockaddr_in addr;
+    long long receivedAt;
+    long long receivedNs;       //kernel RX timestamp
+    int verified;               //checksum or tag was verified in the batch of its datagram
+    int marked;                 //datagram arrived with the CE mark
+} rxPacket;
+
+/**
+ * Received packets of one session slot (ring buffer), served by deficit round robin
+ */
+typedef struct rxQueue {
+    rxPacket *packets;          //allocated when the slot receives its first packet
+    int head, count;
+    int deficit;                //bytes the queue can still process in the current round
+} rxQueue;
+
+struct commContext {
+    memArena *arena;                //memory of the context and its buffers, NULL if it is allocated on the heap
+    int sockfd;
+    int isServer;
+    commConfig config;
+    struct sockaddr_in peer;        //client: server address
+    int connected;                  //client: 1 connected, 0 waiting for init reply, -1 server is not responding
+    long long initSentAt;
+    int initAttempts;
+
+    commSession sessions[MAX_SESSIONS];     //client uses only the first one
+    //hot state of the sessions in dense arrays by the index of the session - the lookup and timer scans read a few
+    //cache lines instead of every session and run as branchless loops the compiler vectorizes
+    long long sessionKeys[MAX_SESSIONS];        //server: address and port of the peer, 0 for a free slot
+    long long sessionSeen[MAX_SESSIONS];        //server: last time a packet came from the peer
+    long long sessionDeadlines[MAX_SESSIONS];   //earliest time the session has timer work, LLONG_MAX if none
+    unsigned long long staleDeadlines[(MAX_SESSIONS + 63) / 64];    //sessions whose deadline must be recomputed
+    long long sessionBdps[MAX_SESSIONS];        //bandwidth-delay product of the session (bytes), 0 for a free slot
+    int sessionQueued[MAX_SESSIONS];            //messages of the session not completed yet
+    long long rxOldest[MAX_SESSIONS];           //server: arrival of the first packet of the receive queue of the
+                                                //session, LLONG_MAX if the queue is empty
+    msgLog *log;                            //server: message log, NULL if logging is disabled
+    deferredAck *deferred;
+    int deferredCount, deferredCapacity;
+    rxQueue rxQueues[MAX_SESSIONS];         //server: received packets of the sessions, by the index of the session
+    int rxQueued;                           //number of the packets in all the receive queues
+    int nextRx, nextSend;                   //session which starts the next receive and send DRR round
+    int sendBacklog;                        //send budget of the last commPoll was used up, more packets may be ready
+    int overload;                           //server: 0 normal, 1 new clients and bulk messages are refused,
+                                            //2 also normal priority messages are refused
+    long long overloadedAt;                 //server: last time the overload signs were seen
+    unsigned int kernelDrops;               //server: last value of the SO_RXQ_OVFL counter
+    unsigned int kernelDropped;             //server: datagrams dropped by the kernel since the last commPoll
+    commStats stats;
+    int recvRequested, sendRequested;       //socket buffer sizes requested by the automatic tuning
+    int dropBoost;                          //multiplier of the automatic receive buffer, doubled after kernel drops
+
+    //packets sent during commPoll are coalesced - consecutive packets of the same size to the same peer are handed
+    //to the kernel in one UDP_SEGMENT (GSO) send
+    int batching;                           //packets are collected instead of being sent right away
+    int gso;                                //kernel supports UDP_SEGMENT (cleared if a GSO send fails)
+    char txBuffer[GSO_MAX_BYTES];
+    size_t txLength, txSegment;             //collected bytes, size of the first (full) packet
+    int txCount;
+    struct sockaddr_in txAddr;
+    char *txData;                           //buffer of the collected packets - txBuffer or a free zero-copy buffer
+    zcBuffer zcBuffers[ZC_BUFFERS];         //zero-copy send buffers, no data if zero-copy sending is disabled
+    int zeroCopy;                           //MSG_ZEROCOPY is enabled (cleared if the kernel copies the data anyway)
+    unsigned int zcNextId;                  //number of the next zero-copy send
+    int zcBusy;                             //number of the zero-copy sends not completed yet
+    int idleSpins;                          //busy polls without a packet in a row
+
+    //kernel timestamps - the sends are numbered like the kernel numbers them, so their TX timestamps read from the
+    //error queue can be matched with the packets; the RX timestamp comes with every received datagram
+    int timestamping;                       //SO_TIMESTAMPING is enabled
+    unsigned int txKey;                     //number of the next send
+    unsigned int txEpoch;                   //restarts of the numbering (after a failed send)
+    unsigned long long lastTxId;            //send which carries the packet passed to sendPacket last
+    txStamp txStamps[TX_STAMP_RING];        //sends by txKey % TX_STAMP_RING
+    long long rxStampNs;                    //RX timestamp of the packet being handled (time of the read without
+                                            //the kernel timestamps)
+    int rxVerified;                         //checksum or tag of the packet being handled was verified in the batch
+    int rxMarked;                           //packet being handled arrived with the CE mark
+    char rxBuffer[RX_BUFFER_SIZE];          //received datagram, several packets of one peer with UDP_GRO
+    int initBackoff;                        //client: delay of the next init after a busy reply, 0 if none
+    mailbox **mailboxes;                    //server: named clients, in the order of their log name ids
+    dedupFilter *dedup;                     //ids of the delivered messages, NULL if the deduplication is disabled
+    unsigned int idNonce;                   //client: upper half of the ids assigned to the submitted messages
+    size_t tagSize;                         //authentication trailer after the payload of every packet, 0 for CRC
+    unsigned char pskKey[AEAD_KEY_SIZE];    //key hashed from the pre-shared key - packets outside a keyed session
+    size_t txClear[GSO_MAX_SEGMENTS];       //AEAD: payload bytes of the collected packets sent in the clear,
+                                            //the packets are sealed together when the batch is sent
+    workPool *pool;                         //workers sealing and opening the AEAD batches, NULL if there are none
+    unsigned long long initNonce;           //client: nonce sent in the connection init
+    int mailboxCount, mailboxCapacity;
+
+    //events waiting to be reported and buffers of the events already reported
+    pendingEvent *pending;
+    int pendingCount, pendingCapacity;
+    char **retired;
+    int retiredCount, retiredCapacity;
+};
+
+/**
+ * @return CRC of the packet (header fields after the crcChecksum and the payload)
+ */
+static int packetChecksum(const customPktHeader *packet, size_t size) {
+    return (int) crc32b((const unsigned char *) packet + sizeof(packet->crcChecksum), size - sizeof(packet->crcChecksum));
+}
+
+/**
+ * @return authentication tag of the packet (header fields after the crcChecksum and the payload)
+ */
+static unsigned long long packetTag(const unsigned char *key, const customPktHeader *packet, size_t size) {
+    return sipHash(key, (const unsigned char *) packet + sizeof(packet->crcChecksum), size - sizeof(packet->crcChecksum));
+}
+
+/**
+ * @return key of the peer address in sessionKeys, never 0
+ */
+static long long sessionKey(const struct sockaddr_in *addr) {
+    return (1LL << 48) | ((long long) ntohl(addr->sin_addr.s_addr) << 16) | ntohs(addr->sin_port);
+}
+
+/**
+ * @return random 64-bit nonce
+ */
+static unsigned long long randomNonce(void) {
+    unsigned long long nonce;
+    struct timespec ts;
+    if (getrandom(&nonce, sizeof(nonce), 0) == (ssize_t) sizeof(nonce))
+        return nonce;
+    clock_gettime(CLOCK_REALTIME, &ts);     //no entropy source - the nonce is still unique, only predictable
+    return (unsigned long long) ts.tv_nsec * 6364136223846793005ULL ^ (unsigned long long) ts.tv_sec ^
+           (unsigned long long) getpid() << 40;
+}
+
+/**
+ * Derives the key of the session from the pre-shared key and the nonces of the client and the server
+ * @param size Size of the key (multiple of 8 bytes)
+ */
+static void deriveKey(const commContext *ctx, unsigned long long clientNonce, unsigned long long serverNonce,
+                      unsigned char *key, size_t size) {
+    unsigned char input[1 + 2 * sizeof(unsigned long long)];
+    unsigned long long part;
+    size_t i;
+    memcpy(input + 1, &clientNonce, sizeof(clientNonce));
+    memcpy(input + 1 + sizeof(clientNonce), &serverNonce, sizeof(serverNonce));
+    for (i = 0; i < size; i += sizeof(part)) {
+        input[0] = (unsigned char) (i / sizeof(part));
+        part = sipHash(ctx->pskKey, input, sizeof(input));
+        memcpy(key + i, &part, sizeof(part));
+    }
+}
+
+/**
+ * @return session whose key protects the packets exchanged with the peer, NULL if the packet is protected by the
+ * pre-shared key (connection init, or the key of the session is not known yet)
+ */
+static commSession *peerSession(commContext *ctx, const struct sockaddr_in *addr, unsigned char type) {
+    int i = ctx->isServer ? scanFind(ctx->sessionKeys, MAX_SESSIONS, sessionKey(addr)) : 0;
+    if (type == PKT_INIT || i < 0 || !ctx->sessions[i].keyed)
+        return NULL;
+    return &ctx->sessions[i];
+}
+
+/**
+ * @return key of the packets exchanged with the peer
+ */
+static const unsigned char *peerKey(commContext *ctx, const struct sockaddr_in *addr, unsigned char type) {
+    commSession *session = peerSession(ctx, addr, type);
+    return session != NULL ? session->key : ctx->pskKey;
+}
+
+/**
+ * Describes the AEAD packet for sealing or opening - the header and the clear part of the payload are the additional
+ * data, the rest of the payload is encrypted, the nonce is made of the direction and the sequence number
+ * @param bytes Packet followed by its trailer (sequence number and tag)
+ * @param size Size of the packet including the trailer
+ * @param clear Bytes of the payload sent in the clear
+ * @param fromServer Direction of the packet
+ */
+static void describeSealed(unsigned char *bytes, size_t size, size_t clear, int fromServer, aeadPacket *sealed,
+                           unsigned char *nonce) {
+    unsigned int direction = (unsigned int) fromServer;
+    memcpy(nonce, &direction, sizeof(direction));
+    memcpy(nonce + sizeof(direction), bytes + size - AEAD_TRAILER, sizeof(unsigned long long));
+    sealed->nonce = nonce;
+    sealed->aad = bytes + sizeof(int);    //after the crcChecksum
+    sealed->aadLength = HEADER_SIZE - sizeof(int) + clear;
+    sealed->data = bytes + HEADER_SIZE + clear;
+    sealed->length = size - AEAD_TRAILER - HEADER_SIZE - clear;
+    sealed->tag = bytes + size - AEAD_TAG_SIZE;
+}
+
+/**
+ * Describes the AEAD end of the connection sent by the client - nothing but the trailer, neither additional data nor
+ * encrypted data
+ */
+static void describeClose(unsigned char *trailer, aeadPacket *sealed, unsigned char *nonce) {
+    unsigned int direction = 0;
+    memcpy(nonce, &direction, sizeof(direction));
+    memcpy(nonce + sizeof(direction), trailer, sizeof(unsigned long long));
+    sealed->nonce = nonce;
+    sealed->aad = trailer;
+    sealed->aadLength = 0;
+    sealed->data = trailer;
+    sealed->length = 0;
+    sealed->tag = trailer + sizeof(unsigned long long);
+}
+
+/**
+ * Assigns the sequence number of the packet sent to the peer and describes the packet for sealing - sequence
+ * numbers of a session count up, packets under the pre-shared key (shared by all the clients) take random ones
+ * @return key the packet is sealed with
+ */
+static const unsigned char *prepareSeal(commContext *ctx, const struct sockaddr_in *addr, unsigned char *bytes,
+                                        size_t size, size_t clear, aeadPacket *sealed, unsigned char *nonce) {
+    commSession *session = peerSession(ctx, addr, bytes[offsetof(customPktHeader, type)] & PKT_TYPE_MASK);
+    unsigned long long seq = session != NULL ? ++session->txSeq : randomNonce();
+    memcpy(bytes + size - AEAD_TRAILER, &seq, sizeof(seq));
+    describeSealed(bytes, size, clear, ctx->isServer, sealed, nonce);
+    return session != NULL ? session->key : ctx->pskKey;
+}
+
+/**
+ * AEAD packets of a batch sealed or opened in chunks of CRYPTO_CHUNK packets, the chunks are independent tasks
+ */
+typedef struct cryptoJob {
+    const unsigned char **keys;     //key of every packet
+    aeadPacket *packets;
+    int count;
+    int open;                       //opened if set, sealed otherwise
+    unsigned long long valid;       //opened packets whose tag is valid
+} cryptoJob;
+
+/**
+ * Seals or opens the chunk of the job - runs of the packets under one key in one batch
+ */
+static void cryptoChunk(void *arg, int chunk) {
+    cryptoJob *job = arg;
+    int first = chunk * CRYPTO_CHUNK, last = first + CRYPTO_CHUNK < job->count ? first + CRYPTO_CHUNK : job->count;
+    int next;
+
+    for (; first < last; first = next) {
+        for (next = first + 1; next < last && job->keys[next] == job->keys[first]; next++)
+            ;
+        if (job->open)
+            __atomic_fetch_or(&job->valid, aeadOpenBatch(job->keys[first], job->packets + first, next - first) << first,
+                              __ATOMIC_RELAXED);
+        else
+            aeadSealBatch(job->keys[first], job->packets + first, next - first);
+    }
+}
+
+/**
+ * Seals or opens the packets of the job - the chunks are spread over the worker pool, the packets are in place when
+ * it returns
+ * @return bitmask of the opened packets whose tag is valid
+ */
+static unsigned long long runCrypto(commContext *ctx, cryptoJob *job) {
+    int chunks = (job->count + CRYPTO_CHUNK - 1) / CRYPTO_CHUNK, i;
+    job->valid = 0;
+    if (ctx->pool != NULL && chunks > 1)
+        workPoolRun(ctx->pool, cryptoChunk, job, chunks);
+    else
+        for (i = 0; i < chunks; i++)
+            cryptoChunk(job, i);
+    return job->valid;
+}
+
+/**
+ * Seals the collected packets (one peer) - the sequence numbers are assigned in the order of the packets, the
+ * encryption runs in chunks on the worker pool
+ */
+static void sealBatch(commContext *ctx) {
+    aeadPacket sealed[GSO_MAX_SEGMENTS];
+    unsigned char nonces[GSO_MAX_SEGMENTS][AEAD_NONCE_SIZE];
+    const unsigned char *keys[GSO_MAX_SEGMENTS];
+    cryptoJob job = { keys, sealed, ctx->txCount, 0, 0 };
+    size_t offset, size;
+    int i;
+
+    for (i = 0, offset = 0; i < ctx->txCount; i++, offset += size) {
+        size = ctx->txLength - offset < ctx->txSegment ? ctx->txLength - offset : ctx->txSegment;
+        keys[i] = prepareSeal(ctx, &ctx->txAddr, (unsigned char *) ctx->txData + offset, size, ctx->txClear[i],
+                              &sealed[i], nonces[i]);
+    }
+    runCrypto(ctx, &job);
+}
+
+/**
+ * @return monotonic time in milliseconds
+ */
+static long long nowMs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @return monotonic time in microseconds
+ */
+static long long nowUs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * @return real time in nanoseconds since the epoch (the clock of the kernel software timestamps)
+ */
+static long long wallClockNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @return real time in milliseconds since the epoch
+ */
+static long long wallClockMs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @return non-zero if message id a precedes message id b (ids wrap around)
+ */
+static int idBefore(unsigned int a, unsigned int b) {
+    return (int) (a - b) < 0;
+}
+
+static int bitTest(const unsigned long long *bitmap, int bit) {
+    return (int) ((bitmap[bit / 64] >> (bit % 64)) & 1);
+}
+
+static void bitSet(unsigned long long *bitmap, int bit) {
+    bitmap[bit / 64] |= 1ULL << (bit % 64);
+}
+
+static void bitClear(unsigned long long *bitmap, int bit) {
+    bitmap[bit / 64] &= ~(1ULL << (bit % 64));
+}
+
+void commConfigInit(commConfig *config) {
+    memset(config, 0, sizeof(*config));
+    config->host = NULL;
+    config->port = COMM_DEFAULT_PORT;
+    config->retransmitTimeoutMs = 200;
+    config->maxRetransmits = 10;
+    config->sendWindow = 64;
+    config->maxInFlight = 4096;
+    config->logDirectory = NULL;
+    config->logSegmentSize = 64 * 1024 * 1024;
+    config->logDurability = COMM_DURABILITY_BATCH;
+    config->name = NULL;
+    config->relayQueueBytes = 16 * 1024 * 1024;
+    config->relayMaxAgeMs = 24 * 60 * 60 * 1000;
+    config->relayDrainRate = 5000;
+    config->dedupWindowMs = 10 * 60 * 1000;
+    config->priorityWeights[COMM_PRIORITY_NORMAL] = 4;
+    config->priorityWeights[COMM_PRIORITY_INTERACTIVE] = 16;
+    config->priorityWeights[COMM_PRIORITY_BULK] = 1;
+    config->clientPacketRate = 0;
+    config->overloadLatencyMs = 50;
+    config->recvBufferSize = 0;
+    config->sendBufferSize = 0;
+    config->maxSocketBuffer = 16 * 1024 * 1024;
+    config->udpOffload = 1;
+    config->zeroCopy = 0;
+    config->busyPollUs = 0;
+    config->cpu = -1;
+    config->timestamping = 1;
+    config->ecn = 1;
+    config->arenaSize = 64 * 1024 * 1024;
+    config->hugePages = COMM_PAGES_TRANSPARENT;
+    config->numaNode = -1;
+    config->workers = 0;
+    config->adaptiveFragments = 1;
+}
+
+/**
+ * Queues an event to be reported by commPoll
+ * @param callback Completion callback to be called instead of reporting the event, may be NULL
+ * @param owned Library buffer referenced by the event (released after the event is reported), may be NULL
+ * @return 0 on success, -1 if there is not enough memory
+ */
+static int queueEvent(commContext *ctx, const commEvent *event, commCallback callback, char *owned) {
+    if (ctx->pendingCount == ctx->pendingCapacity) {
+        int capacity = ctx->pendingCapacity ? ctx->pendingCapacity * 2 : 16;
+        pendingEvent *resized = realloc(ctx->pending, capacity * sizeof(pendingEvent));
+        if (resized == NULL) {
+            arenaFree(ctx->arena, owned);
+            return -1;
+        }
+        ctx->pending = resized;
+        ctx->pendingCapacity = capacity;
+    }
+    ctx->pending[ctx->pendingCount].event = *event;
+    ctx->pending[ctx->pendingCount].callback = callback;
+    ctx->pending[ctx->pendingCount].owned = owned;
+    ctx->pendingCount++;
+    return 0;
+}
+
+/**
+ * Remembers the buffer of a reported event, it is released at the beginning of the next commPoll call
+ */
+static void retireBuffer(commContext *ctx, char *buffer) {
+    if (ctx->retiredCount == ctx->retiredCapacity) {
+        int capacity = ctx->retiredCapacity ? ctx->retiredCapacity * 2 : 16;
+        char **resized = realloc(ctx->retired, capacity * sizeof(char *));
+        if (resized == NULL) {
+            arenaFree(ctx->arena, buffer);  //event data are lost, but the application already has the event
+            return;
+        }
+        ctx->retired = resized;
+        ctx->retiredCapacity = capacity;
+    }
+    ctx->retired[ctx->retiredCount++] = buffer;
+}
+
+/**
+ * Numbers the send like the kernel does for its TX timestamp - after a failed send the kernel numbering is restarted,
+ * because it is not known whether the failed send was counted (packets sent before get no kernel timestamp)
+ * @param sent The send succeeded
+ */
+static void countSend(commContext *ctx, int sent) {
+    int flags = TIMESTAMPING_FLAGS;
+    txStamp *stamp;
+
+    if (!ctx->timestamping)
+        return;
+    if (!sent) {
+        flags &= ~SOF_TIMESTAMPING_OPT_ID;      //counter is reset when OPT_ID is enabled again
+        setsockopt(ctx->sockfd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags));
+        flags = TIMESTAMPING_FLAGS;
+        setsockopt(ctx->sockfd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags));
+        ctx->txKey = 0;
+        ctx->txEpoch++;
+        return;
+    }
+    stamp = &ctx->txStamps[ctx->txKey % TX_STAMP_RING];
+    stamp->id = (unsigned long long) ctx->txEpoch << 32 | ctx->txKey;
+    stamp->kernelNs = 0;
+    ctx->txKey++;
+}
+
+/**
+ * Sends the collected packets - in one GSO send if there are more of them (the kernel splits the buffer into
+ * txSegment sized datagrams, the last one may be shorter), one by one if the kernel cannot segment them
+ */
+static void flushPackets(commContext *ctx) {
+    char control[CMSG_SPACE(sizeof(unsigned short))];
+    struct iovec iov;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    size_t offset, size;
+    zcBuffer *zc = NULL;
+    int i;
+
+    if (ctx->txCount == 0)
+        return;
+    if (ctx->config.integrity == COMM_INTEGRITY_AEAD)
+        sealBatch(ctx);
+    //large batch collected in a zero-copy buffer is sent without copying the data into the socket buffer
+    for (i = 0; ctx->zeroCopy && ctx->txLength >= ZEROCOPY_MIN_BYTES && i < ZC_BUFFERS; i++)
+        if (ctx->zcBuffers[i].data == ctx->txData)
+            zc = &ctx->zcBuffers[i];
+    if (ctx->txCount > 1 && ctx->gso) {
+        iov.iov_base = ctx->txData;
+        iov.iov_len = ctx->txLength;
+        memset(&msg, 0, sizeof(msg));
+        memset(control, 0, sizeof(control));
+        msg.msg_name = &ctx->txAddr;
+        msg.msg_namelen = sizeof(ctx->txAddr);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_UDP;
+        cmsg->cmsg_type = UDP_SEGMENT;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(unsigned short));
+        *(unsigned short *) CMSG_DATA(cmsg) = (unsigned short) ctx->txSegment;
+        if (zc != NULL && sendmsg(ctx->sockfd, &msg, MSG_ZEROCOPY) >= 0) {
+            countSend(ctx, 1);
+            zc->busy = 1;
+            zc->id = ctx->zcNextId++;
+            ctx->zcBusy++;
+            ctx->stats.gsoSends++;
+            ctx->stats.zeroCopySends++;
+            ctx->txCount = 0;
+            ctx->txLength = 0;
+            ctx->txData = NULL;
+            return;
+        }
+        //zero-copy send failed (ENOBUFS - too many pinned pages) or is not used - the data are copied
+        if (zc != NULL)
+            countSend(ctx, 0);
+        if (sendmsg(ctx->sockfd, &msg, 0) >= 0) {
+            countSend(ctx, 1);
+            ctx->stats.gsoSends++;
+            ctx->txCount = 0;
+            ctx->txLength = 0;
+            ctx->txData = NULL;
+            return;
+        }
+        countSend(ctx, 0);
+        if (errno != EIO && errno != EINVAL && errno != ENOPROTOOPT && errno != EOPNOTSUPP) {
+            ctx->txCount = 0;   //buffer full or ICMP error - packets are lost like single datagrams, they are resent
+            ctx->txLength = 0;
+            ctx->txData = NULL;
+            return;
+        }
+        ctx->gso = 0;   //kernel or device without UDP segmentation offload
+    }
+    for (offset = 0; offset < ctx->txLength; offset += size) {
+        size = ctx->txLength - offset < ctx->txSegment ? ctx->txLength - offset : ctx->txSegment;
+        countSend(ctx, sendto(ctx->sockfd, ctx->txData + offset, size, 0, (const struct sockaddr *) &ctx->txAddr,
+                              sizeof(ctx->txAddr)) >= 0);
+    }
+    ctx->txCount = 0;
+    ctx->txLength = 0;
+    ctx->txData = NULL;
+}
+
+/**
+ * Reads the error queue of the socket - kernel TX timestamps of the sends are stored for the round-trip samples,
+ * completions of the zero-copy sends return their buffers to the pool; if the kernel had to copy the data anyway
+ * (loopback, device without scatter-gather), zero-copy sending is switched off, because the copy mode is faster then
+ */
+static void readErrorQueue(commContext *ctx) {
+    char control[CMSG_SPACE(sizeof(struct scm_timestamping)) +
+                 CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in))];
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    long long stampNs;
+    int i;
+
+    for (;;) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(ctx->sockfd, &msg, MSG_ERRQUEUE) < 0)
+            return;
+        stampNs = 0;
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            struct sock_extended_err err;
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+                struct scm_timestamping stamps;     //software timestamp first, the error follows
+                memcpy(&stamps, CMSG_DATA(cmsg), sizeof(stamps));
+                stampNs = (long long) stamps.ts[0].tv_sec * 1000000000 + stamps.ts[0].tv_nsec;
+                continue;
+            }
+            if (cmsg->cmsg_level != SOL_IP || cmsg->cmsg_type != IP_RECVERR)
+                continue;
+            memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+            if (err.ee_origin == SO_EE_ORIGIN_TIMESTAMPING && err.ee_info == SCM_TSTAMP_SND && stampNs != 0) {
+                txStamp *stamp = &ctx->txStamps[err.ee_data % TX_STAMP_RING];
+                if (stamp->id == ((unsigned long long) ctx->txEpoch << 32 | err.ee_data))
+                    stamp->kernelNs = stampNs;
+                continue;
+            }
+            if (err.ee_errno != 0 || err.ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+            if (err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                ctx->stats.zeroCopyCopied++;
+                ctx->zeroCopy = 0;
+            }
+            //sends ee_info..ee_data are completed (the numbers wrap around)
+            for (i = 0; i < ZC_BUFFERS; i++) {
+                zcBuffer *zc = &ctx->zcBuffers[i];
+                if (zc->busy && zc->id - err.ee_info <= err.ee_data - err.ee_info) {
+                    zc->busy = 0;
+                    ctx->zcBusy--;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Busy polling - the socket is checked without sleeping for up to busyPollUs microseconds (the wait at most), so
+ * a packet arriving meanwhile is processed without the wakeup latency of a sleeping poll; after BUSY_IDLE_SPINS spins
+ * in a row without a packet the core is released and commPoll sleeps until the next packet comes
+ * @param wait Maximum wait in milliseconds, -1 for no limit
+ * @return 1 if a packet arrived, 0 if the caller should sleep in poll
+ */
+static int spinPoll(commContext *ctx, struct pollfd *pfd, int wait) {
+    long long start, limit = ctx->config.busyPollUs;
+
+    if (ctx->idleSpins >= BUSY_IDLE_SPINS)
+        return 0;
+    if (wait >= 0 && limit > wait * 1000LL)
+        limit = wait * 1000LL;
+    start = nowUs();
+    do {
+        if (poll(pfd, 1, 0) > 0) {
+            ctx->stats.busyPollHits++;
+            return 1;
+        }
+    } while (nowUs() - start < limit);
+    ctx->stats.busyPollMisses++;
+    ctx->idleSpins++;
+    return 0;
+}
+
+/**
+ * @return buffer for the next batch of packets - a free zero-copy buffer if there is one, txBuffer otherwise
+ */
+static char *batchBuffer(commContext *ctx) {
+    int i;
+    for (i = 0; ctx->zeroCopy && i < ZC_BUFFERS; i++)
+        if (ctx->zcBuffers[i].data != NULL && !ctx->zcBuffers[i].busy)
+            return ctx->zcBuffers[i].data;
+    return ctx->txBuffer;
+}
+
+/**
+ * Computes the checksum (or the authentication tag) and sends the packet - right away, or collected with the other
+ * packets sent by commPoll (AEAD packets are then sealed together when the batch is sent)
+ * @param size Size of the packet including the header
+ * @param clear Bytes at the start of the payload which AEAD authenticates, but does not encrypt
+ */
+static void sendPacketClear(commContext *ctx, const struct sockaddr_in *addr, customPktHeader *packet, size_t size,
+                            size_t clear) {
+    if (ctx->config.integrity == COMM_INTEGRITY_AEAD) {
+        packet->crcChecksum = 0;
+        size += ctx->tagSize;
+        if (!ctx->batching) {
+            aeadPacket sealed;
+            unsigned char nonce[AEAD_NONCE_SIZE];
+            aeadSealBatch(prepareSeal(ctx, addr, (unsigned char *) packet, size, clear, &sealed, nonce), &sealed, 1);
+        }
+    } else if (ctx->tagSize > 0) {
+        unsigned long long tag = packetTag(peerKey(ctx, addr, packet->type & PKT_TYPE_MASK), packet, size);
+        packet->crcChecksum = 0;
+        memcpy((char *) packet + size, &tag, sizeof(tag));  //tag follows the payload
+        size += ctx->tagSize;
+    } else {
+        packet->crcChecksum = packetChecksum(packet, size);
+    }
+    if (!ctx->batching) {
+        ctx->lastTxId = (unsigned long long) ctx->txEpoch << 32 | ctx->txKey;
+        countSend(ctx, sendto(ctx->sockfd, (char *) packet, size, 0, (const struct sockaddr *) addr,
+                              sizeof(*addr)) >= 0);
+        return;
+    }
+    //GSO sends the packets of one size to one peer, only the last packet of the batch may be shorter
+    if (ctx->txCount > 0 &&
+        (ctx->txAddr.sin_addr.s_addr != addr->sin_addr.s_addr || ctx->txAddr.sin_port != addr->sin_port ||
+         size > ctx->txSegment || ctx->txLength % ctx->txSegment != 0 || ctx->txLength + size > GSO_MAX_BYTES ||
+         ctx->txCount == GSO_MAX_SEGMENTS))
+        flushPackets(ctx);
+    if (ctx->txCount == 0) {
+        ctx->txAddr = *addr;
+        ctx->txSegment = size;
+        ctx->txData = batchBuffer(ctx);
+    }
+    //batch goes out in one send with GSO, one send per packet without it
+    ctx->lastTxId = (unsigned long long) ctx->txEpoch << 32 | (ctx->txKey + (ctx->gso ? 0 : ctx->txCount));
+    memcpy(ctx->txData + ctx->txLength, packet, size);
+    ctx->txClear[ctx->txCount] = clear;
+    ctx->txLength += size;
+    ctx->txCount++;
+}
+
+/**
+ * Sends the packet - see sendPacketClear
+ */
+static void sendPacket(commContext *ctx, const struct sockaddr_in *addr, customPktHeader *packet, size_t size) {
+    sendPacketClear(ctx, addr, packet, size, 0);
+}
+
+/**
+ * Sends a packet with only the header part (ACK, resend flag, init...)
+ */
+static void sendControl(commContext *ctx, const struct sockaddr_in *addr, unsigned char type, unsigned int messageId,
+                        short packetNumber) {
+    customPktHeader reply;
+    reply.type = type;
+    reply.messageId = messageId;
+    reply.packetNumber = packetNumber;
+    reply.packetCount = 0;
+    sendPacket(ctx, addr, &reply, HEADER_SIZE);
+}
+
+/**
+ * Fills the ACK of the packet with the time the packet spent in this host since the kernel received it (ACK delay),
+ * so the sender can tell the network part of the round trip from the processing
+ * @param receivedNs RX timestamp of the acknowledged packet
+ * @return size of the ACK
+ */
+static size_t fillAck(customPktHeader *reply, unsigned int messageId, short packetNumber, long long receivedNs) {
+    long long delay = (wallClockNs() - receivedNs) / 1000;
+    unsigned int delayUs = delay < 0 ? 0 : delay > 0xFFFFFFFFLL ? 0xFFFFFFFFu : (unsigned int) delay;
+    reply->type = PKT_ACK;
+    reply->messageId = messageId;
+    reply->packetNumber = packetNumber;
+    reply->packetCount = 0;
+    memcpy(reply->message, &delayUs, sizeof(delayUs));
+    return HEADER_SIZE + sizeof(delayUs);
+}
+
+/**
+ * Sends ACK of the packet, the ACK delay is followed by the number of the CE marked packets received from the peer
+ * (a running count, so a lost ACK does not lose the marks)
+ * @param receivedNs RX timestamp of the acknowledged packet
+ * @param marked CE marks received from the peer
+ */
+static void sendAck(commContext *ctx, const struct sockaddr_in *addr, unsigned int messageId, short packetNumber,
+                    long long receivedNs, unsigned int marked) {
+    customPktHeader reply;
+    size_t size = fillAck(&reply, messageId, packetNumber, receivedNs);
+    memcpy(reply.message + size - HEADER_SIZE, &marked, sizeof(marked));
+    sendPacket(ctx, addr, &reply, size + sizeof(marked));
+}
+
+/**
+ * Sends ACK of the connection init - with authentication it carries the nonce of the server, the client derives
+ * the key of the session from it
+ */
+static void sendInitAck(commContext *ctx, const commSession *session, const customPktHeader *packet) {
+    customPktHeader reply;
+    size_t size = fillAck(&reply, packet->messageId, packet->packetNumber, ctx->rxStampNs);
+    if (session->keyed) {
+        memcpy(reply.message + size - HEADER_SIZE, &session->nonce, sizeof(session->nonce));
+        size += sizeof(session->nonce);
+    }
+    sendPacketClear(ctx, &session->addr, &reply, size, size - HEADER_SIZE);    //client reads the nonce before the key
+}
+
+/**
+ * Creates non-blocking UDP socket
+ * @return socket file descriptor, -1 on error
+ */
+static int createSocket(void) {
+    int sockfd, flags;
+    if ((sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+        return -1;
+    flags = fcntl(sockfd, F_GETFL, 0);
+    if (flags < 0 || fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+/**
+ * Fills the socket address from the configuration
+ * @return 0 on success, -1 if the host is not a valid IP address
+ */
+static int configAddress(const commConfig *config, struct sockaddr_in *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(config->port);
+    addr->sin_addr.s_addr = INADDR_ANY;
+    if (config->host != NULL && inet_pton(AF_INET, config->host, &addr->sin_addr) != 1) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Finds the mailbox of the named client, creates a new one (registers the name in the message log) if create is set
+ * @return mailbox, NULL if there is no such mailbox or it cannot be created
+ */
+static mailbox *findMailbox(commContext *ctx, const char *name, int create) {
+    mailbox *box;
+    int i;
+    for (i = 0; i < ctx->mailboxCount; i++) {
+        if (strncmp(ctx->mailboxes[i]->name, name, COMM_NAME_MAX) == 0)
+            return ctx->mailboxes[i];
+    }
+    if (!create || ctx->mailboxCount == MAX_MAILBOXES)
+        return NULL;
+    if (ctx->mailboxCount == ctx->mailboxCapacity) {
+        int capacity = ctx->mailboxCapacity ? ctx->mailboxCapacity * 2 : 16;
+        mailbox **resized = realloc(ctx->mailboxes, capacity * sizeof(mailbox *));
+        if (resized == NULL)
+            return NULL;
+        ctx->mailboxes = resized;
+        ctx->mailboxCapacity = capacity;
+    }
+    if ((box = calloc(1, sizeof(mailbox))) == NULL)
+        return NULL;
+    strncpy(box->name, name, COMM_NAME_MAX - 1);
+    if (ctx->log != NULL)
+        box->logId = msgLogNameId(ctx->log, box->name);
+    ctx->mailboxes[ctx->mailboxCount++] = box;
+    return box;
+}
+
+/**
+ * Appends a new message to the queue of the mailbox and to the chain of its priority class
+ * @return stored message to be filled, NULL if there is not enough memory
+ */
+static storedMessage *appendStored(mailbox *box, commPriority priority) {
+    storedMessage *stored = calloc(1, sizeof(storedMessage));
+    if (stored == NULL)
+        return NULL;
+    stored->order = box->nextOrder++;
+    stored->priority = priority;
+    stored->backlog = box->session == NULL;
+    if (box->tail != NULL)
+        box->tail->next = stored;
+    else
+        box->head = stored;
+    box->tail = stored;
+    if (box->classTail[priority] != NULL)
+        box->classTail[priority]->classNext = stored;
+    else
+        box->classHead[priority] = stored;
+    box->classTail[priority] = stored;
+    if (box->sendCursor[priority] == NULL)
+        box->sendCursor[priority] = stored;
+    return stored;
+}
+
+/**
+ * @return non-zero if the mailbox has a message which can be sent
+ */
+static int mailboxPending(const mailbox *box) {
+    int c;
+    for (c = 0; c < COMM_PRIORITY_CLASSES; c++)
+        if (box->sendCursor[c] != NULL)
+            return 1;
+    return 0;
+}
+
+/**
+ * Moves the send cursor of the class to its first message which is not acknowledged
+ */
+static void rewindMailbox(mailbox *box, int c) {
+    for (box->sendCursor[c] = box->classHead[c]; box->sendCursor[c] != NULL && box->sendCursor[c]->acked;)
+        box->sendCursor[c] = box->sendCursor[c]->classNext;
+}
+
+/**
+ * Removes the acknowledged messages from the head of the queue and moves the drain cursor after them, drops the
+ * messages older than relayMaxAgeMs or past their TTL and the oldest copies above relayQueueBytes (only if they are
+ * not being sent)
+ */
+static void trimMailbox(commContext *ctx, mailbox *box) {
+    long long now = wallClockMs();
+    long long oldest = ctx->config.relayMaxAgeMs > 0 ? now - ctx->config.relayMaxAgeMs : 0;
+    while (box->head != NULL && box->head->entry == NULL &&
+           (box->head->acked || box->head->timestamp < oldest || (box->head->deadline != 0 && box->head->deadline <= now) ||
+            box->bytes > ctx->config.relayQueueBytes)) {
+        storedMessage *stored = box->head;
+        int c = stored->priority;
+        if (stored->sequence != 0 && box->logId != 0)
+            msgLogSetCursor(ctx->log, box->logId, stored->sequence);
+        //the oldest message of the queue is also the oldest one of its class
+        if (box->sendCursor[c] == stored)
+            box->sendCursor[c] = stored->classNext;
+        box->classHead[c] = stored->classNext;
+        if (box->classHead[c] == NULL)
+            box->classTail[c] = NULL;
+        box->head = stored->next;
+        if (box->head == NULL)
+            box->tail = NULL;
+        if (stored->owned != NULL)
+            box->bytes -= stored->length;
+        free(stored->owned);
+        free(stored);
+    }
+}
+
+/**
+ * Disconnects the mailbox from the session - the client is offline, its messages being sent will be sent again
+ */
+static void detachMailbox(commSession *session) {
+    mailbox *box = session->mailbox;
+    sendEntry *entry;
+    int c;
+    if (box == NULL)
+        return;
+    //started messages first (c == -1), then the waiting ones of every class
+    for (c = -1; c < COMM_PRIORITY_CLASSES; c++) {
+        for (entry = c < 0 ? session->queueHead : session->waitHead[c]; entry != NULL; entry = entry->next) {
+            if (entry->stored != NULL) {
+                entry->stored->entry = NULL;
+                entry->stored = NULL;
+            }
+        }
+    }
+    for (c = 0; c < COMM_PRIORITY_CLASSES; c++)
+        rewindMailbox(box, c);
+    box->session = NULL;
+    session->mailbox = NULL;
+}
+
+/**
+ * Connects the session of the named client to its mailbox, the queued messages are then drained to it
+ */
+static void attachMailbox(commContext *ctx, commSession *session, const char *name) {
+    mailbox *box = findMailbox(ctx, name, 1);
+    if (box == NULL)
+        return;
+    if (box->session != NULL)
+        detachMailbox(box->session);    //client has connected again from another address
+    box->session = session;
+    box->tokens = ctx->config.sendWindow;
+    box->refilledAt = nowMs();
+    session->mailbox = box;
+}
+
+/**
+ * Handles the completion of a relayed message - acknowledged (or expired) message moves the drain cursor, message
+ * which was not delivered will be sent again, a recipient which does not respond is considered offline until it
+ * connects again
+ */
+static void relayCompleted(commContext *ctx, commSession *session, sendEntry *entry, commEventType type) {
+    storedMessage *stored = entry->stored;
+    mailbox *box = session->mailbox;
+    int c = stored->priority;
+
+    stored->entry = NULL;
+    if (type == COMM_EVENT_SENT || type == COMM_EVENT_EXPIRED) {
+        stored->acked = 1;
+        trimMailbox(ctx, box);
+        return;
+    }
+    if (box->sendCursor[c] == NULL || stored->order < box->sendCursor[c]->order)
+        box->sendCursor[c] = stored;
+    if (type == COMM_EVENT_TIMEOUT)
+        detachMailbox(session);
+}
+
+/**
+ * Restores the queues of the named clients from the message log - every logged message after the drain cursor of
+ * its recipient is queued again
+ */
+static void restoreMailboxes(commContext *ctx) {
+    unsigned int count = msgLogNameCount(ctx->log), id;
+    logRecordRef *records;
+    logQuery query;
+    size_t n, i;
+
+    memset(&query, 0, sizeof(query));
+    for (id = 1; id <= count; id++) {
+        mailbox *box = findMailbox(ctx, msgLogName(ctx->log, id), 1);
+        if (box == NULL || box->logId != id)
+            return;
+        if (id == 1 || msgLogCursor(ctx->log, id) + 1 < query.fromSequence)
+            query.fromSequence = msgLogCursor(ctx->log, id) + 1;
+    }
+    if (count == 0 || (records = malloc(RESTORE_CHUNK * sizeof(logRecordRef))) == NULL)
+        return;
+    query.fromTimestamp = ctx->config.relayMaxAgeMs > 0 ? wallClockMs() - ctx->config.relayMaxAgeMs : 0;
+    query.limit = RESTORE_CHUNK;
+    while ((n = msgLogQuery(ctx->log, &query, records)) > 0) {
+        for (i = 0; i < n; i++) {
+            const logRecordHeader *header = records[i].header;
+            storedMessage *stored;
+            if (header->recipientId == 0 || header->recipientId > count ||
+                header->sequence <= msgLogCursor(ctx->log, header->recipientId) ||
+                header->priority >= COMM_PRIORITY_CLASSES ||
+                (stored = appendStored(ctx->mailboxes[header->recipientId - 1], (commPriority) header->priority)) == NULL)
+                continue;
+            stored->sequence = header->sequence;
+            stored->id = header->id;
+            stored->timestamp = header->timestamp;
+            stored->deadline = header->deadline;
+            stored->channel = header->channel;
+            stored->origin.sin_family = AF_INET;
+            stored->origin.sin_addr.s_addr = header->senderAddress;
+            stored->origin.sin_port = header->senderPort;
+            if (header->senderId != 0 && header->senderId <= count)
+                stored->sender = ctx->mailboxes[header->senderId - 1];
+            stored->data = records[i].data;
+            stored->length = header->length;
+        }
+        query.fromSequence = records[n - 1].header->sequence + 1;
+        if (n < RESTORE_CHUNK)
+            break;
+    }
+    free(records);
+}
+
+/**
+ * Fills the message id filter with the ids of the messages logged within the last dedupWindowMs, so the messages
+ * delivered before a restart are not delivered again
+ */
+static void restoreDedup(commContext *ctx) {
+    logRecordRef *records;
+    logQuery query;
+    long long now = nowMs();
+    size_t n, i;
+
+    if (ctx->dedup == NULL || (records = malloc(RESTORE_CHUNK * sizeof(logRecordRef))) == NULL)
+        return;
+    memset(&query, 0, sizeof(query));
+    query.fromTimestamp = wallClockMs() - ctx->config.dedupWindowMs;
+    query.limit = RESTORE_CHUNK;
+    while ((n = msgLogQuery(ctx->log, &query, records)) > 0) {
+        for (i = 0; i < n; i++) {
+            if (records[i].header->id != 0)
+                dedupInsert(ctx->dedup, records[i].header->id, now);
+        }
+        query.fromSequence = records[n - 1].header->sequence + 1;
+        if (n < RESTORE_CHUNK)
+            break;
+    }
+    free(records);
+}
+
+/**
+ * Sets the size of the socket buffer - SO_RCVBUFFORCE/SO_SNDBUFFORCE first (they exceed the rmem_max/wmem_max limits,
+ * but need CAP_NET_ADMIN), the ordinary option if the process is not privileged
+ * @param force SO_RCVBUFFORCE or SO_SNDBUFFORCE
+ * @param option SO_RCVBUF or SO_SNDBUF
+ * @return effective size reported by the kernel (twice the requested one on Linux, it includes the overhead)
+ */
+static int setSocketBuffer(int sockfd, int force, int option, int size) {
+    int effective = 0;
+    socklen_t length = sizeof(effective);
+    if (setsockopt(sockfd, SOL_SOCKET, force, &size, sizeof(size)) < 0)
+        setsockopt(sockfd, SOL_SOCKET, option, &size, sizeof(size));
+    getsockopt(sockfd, SOL_SOCKET, option, &effective, &length);
+    return effective;
+}
+
+/**
+ * @return bandwidth-delay product of the session in bytes - the bottleneck bandwidth times the minimum round trip
+ *  measured by its controller, the bytes of the full send window until there is such an estimate (it needs BBR and
+ *  the first round trips)
+ */
+static long long sessionBdp(commContext *ctx, const commSession *session) {
+    if (session->cc.bandwidth > 0 && session->cc.minRttUs > 0)
+        return (long long) (session->cc.bandwidth * (double) session->cc.minRttUs / 1e6);
+    return (long long) ctx->config.sendWindow * sizeof(customPktHeader);
+}
+
+/**
+ * Sizes the socket buffers - the configured sizes, or automatic ones: the receive buffer holds BUFFER_HEADROOM times
+ * the sum of the bandwidth-delay products of the active sessions (multiplied by dropBoost after the kernel dropped
+ * datagrams), the send buffer the packets sent by one commPoll call; automatic buffers only grow, up to
+ * maxSocketBuffer
+ */
+static void tuneBuffers(commContext *ctx) {
+    long long recv, send, bdp = scanSum(ctx->sessionBdps, MAX_SESSIONS);
+
+    if (bdp == 0)
+        bdp = (long long) ctx->config.sendWindow * sizeof(customPktHeader);     //no session yet
+    if (ctx->kernelDropped > 0 && ctx->dropBoost < MAX_DROP_BOOST)
+        ctx->dropBoost *= 2;
+    recv = ctx->config.recvBufferSize > 0 ? ctx->config.recvBufferSize :
+           BUFFER_HEADROOM * bdp * ctx->dropBoost;
+    send = ctx->config.sendBufferSize > 0 ? ctx->config.sendBufferSize :
+           BUFFER_HEADROOM * (long long) (ctx->isServer ? SEND_BUDGET : ctx->config.sendWindow) *
+           (long long) sizeof(customPktHeader);
+    if (ctx->config.recvBufferSize <= 0 && recv > ctx->config.maxSocketBuffer)
+        recv = ctx->config.maxSocketBuffer;
+    if (ctx->config.sendBufferSize <= 0 && send > ctx->config.maxSocketBuffer)
+        send = ctx->config.maxSocketBuffer;
+    if (recv > ctx->recvRequested) {
+        ctx->recvRequested = (int) recv;
+        ctx->stats.recvBuffer = setSocketBuffer(ctx->sockfd, SO_RCVBUFFORCE, SO_RCVBUF, ctx->recvRequested);
+    }
+    if (send > ctx->sendRequested) {
+        ctx->sendRequested = (int) send;
+        ctx->stats.sendBuffer = setSocketBuffer(ctx->sockfd, SO_SNDBUFFORCE, SO_SNDBUF, ctx->sendRequested);
+    }
+}
+
+/**
+ * Releases the memory of the context - its arena with all the blocks, or the context alone if it is on the heap
+ */
+static void releaseContext(commContext *ctx) {
+    workPoolDestroy(ctx->pool);
+    if (ctx->arena != NULL)
+        arenaDestroy(ctx->arena);
+    else
+        free(ctx);
+}
+
+static commContext *createContext(const commConfig *config, int isServer) {
+    commConfig settings;
+    struct sockaddr_in peer;
+    memArena *arena = NULL;
+    workPool *pool = NULL;
+    commContext *ctx;
+    int i, node, workers;
+
+    if (config != NULL)
+        settings = *config;
+    else
+        commConfigInit(&settings);
+    //whole configuration is checked before the thread is pinned and the workers are started, so a rejected one
+    //leaves the calling thread as it was
+    if (settings.workers < -1 || settings.cpu >= CPU_SETSIZE || settings.sendWindow < 1 || settings.maxInFlight < 1 ||
+        settings.priorityWeights[COMM_PRIORITY_NORMAL] < 1 ||
+        settings.priorityWeights[COMM_PRIORITY_INTERACTIVE] < 1 ||
+        settings.priorityWeights[COMM_PRIORITY_BULK] < 1 ||
+        (settings.integrity != COMM_INTEGRITY_CRC &&
+         ((settings.integrity != COMM_INTEGRITY_SIPHASH && settings.integrity != COMM_INTEGRITY_AEAD) ||
+          settings.psk == NULL || settings.pskLength == 0))) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (configAddress(&settings, &peer) < 0)
+        return NULL;
+    //workers are started before the thread is pinned, so they are not bound to its CPU
+    workers = settings.workers < 0 ? (int) sysconf(_SC_NPROCESSORS_ONLN) - 1 : settings.workers;
+    if (workers > 0 && (pool = workPoolCreate(workers)) == NULL)
+        return NULL;
+    //thread is pinned first, so the arena is bound to the node of its CPU and its pages are touched from there
+    if (settings.cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(settings.cpu, &set);
+        sched_setaffinity(0, sizeof(set), &set);    //calling thread stays on the core with the warm caches
+    }
+    if (settings.arenaSize > 0) {
+        node = settings.numaNode >= 0 ? settings.numaNode : arenaCpuNode(settings.cpu >= 0 ? settings.cpu : sched_getcpu());
+        arena = arenaCreate(settings.arenaSize, settings.hugePages, node);  //heap is used if it cannot be mapped
+    }
+    if ((ctx = arenaCalloc(arena, 1, sizeof(commContext))) == NULL) {
+        workPoolDestroy(pool);
+        arenaDestroy(arena);
+        return NULL;
+    }
+    ctx->arena = arena;
+    ctx->pool = pool;
+    ctx->config = settings;
+    ctx->peer = peer;
+    ctx->isServer = isServer;
+    if (ctx->config.integrity != COMM_INTEGRITY_CRC) {
+        //pre-shared key of any length is hashed into the key, every quarter under another fixed key
+        static const unsigned char quarters[4][SIPHASH_KEY_SIZE] = { { 0 }, { 1 }, { 2 }, { 3 } };
+        unsigned long long part;
+        for (i = 0; i < 4; i++) {
+            part = sipHash(quarters[i], ctx->config.psk, ctx->config.pskLength);
+            memcpy(ctx->pskKey + i * sizeof(part), &part, sizeof(part));
+        }
+        ctx->tagSize = ctx->config.integrity == COMM_INTEGRITY_AEAD ? AEAD_TRAILER : sizeof(unsigned long long);
+    }
+    for (i = 0; i < MAX_SESSIONS; i++) {
+        ctx->sessionDeadlines[i] = LLONG_MAX;
+        ctx->rxOldest[i] = LLONG_MAX;
+    }
+    if (ctx->config.dedupWindowMs > 0 &&
+        (ctx->dedup = dedupCreate(DEDUP_BUCKETS, ctx->config.dedupWindowMs)) == NULL) {
+        releaseContext(ctx);
+        return NULL;
+    }
+    if ((ctx->sockfd = createSocket()) < 0) {
+        int err = errno;
+        dedupDestroy(ctx->dedup);
+        releaseContext(ctx);
+        errno = err;
+        return NULL;
+    }
+    ctx->dropBoost = 1;
+    ctx->stats.fragSize = COMM_FRAG_SIZE;
+    tuneBuffers(ctx);
+    if (ctx->config.udpOffload) {
+        ctx->gso = 1;
+        setsockopt(ctx->sockfd, SOL_UDP, UDP_GRO, &(int){ 1 }, sizeof(int));  //coalesced datagrams are split on receive
+    }
+    if (ctx->config.timestamping &&
+        setsockopt(ctx->sockfd, SOL_SOCKET, SO_TIMESTAMPING, &(int){ TIMESTAMPING_FLAGS }, sizeof(int)) == 0)
+        ctx->timestamping = 1;
+    if (ctx->config.ecn) {
+        //UDP sockets keep the ECN bits of IP_TOS in the sent packets
+        setsockopt(ctx->sockfd, IPPROTO_IP, IP_TOS, &(int){ IPTOS_ECN_ECT0 }, sizeof(int));
+        setsockopt(ctx->sockfd, IPPROTO_IP, IP_RECVTOS, &(int){ 1 }, sizeof(int));
+    }
+    if (ctx->config.busyPollUs > 0) {
+        //kernel polls the device queue in the receive calls instead of waiting for the interrupt (needs CAP_NET_ADMIN
+        //above net.core.busy_read, the user space spinning in commPoll works without it)
+        setsockopt(ctx->sockfd, SOL_SOCKET, SO_BUSY_POLL, &ctx->config.busyPollUs, sizeof(int));
+        setsockopt(ctx->sockfd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &(int){ 1 }, sizeof(int));
+    }
+    if (ctx->gso && ctx->config.zeroCopy &&
+        setsockopt(ctx->sockfd, SOL_SOCKET, SO_ZEROCOPY, &(int){ 1 }, sizeof(int)) == 0) {
+        ctx->zeroCopy = 1;
+        for (i = 0; i < ZC_BUFFERS; i++) {
+            if ((ctx->zcBuffers[i].data = arenaAlloc(ctx->arena, GSO_MAX_BYTES)) == NULL)
+                break;  //fewer buffers - more batches are copied
+        }
+    }
+    return ctx;
+}
+
+commContext *commServerCreate(const commConfig *config) {
+    commContext *ctx = createContext(config, 1);
+    if (ctx == NULL)
+        return NULL;
+
+    if (setsockopt(ctx->sockfd, SOL_SOCKET, SO_REUSEADDR, &(int){ 1 }, sizeof(int)) < 0 ||
+        setsockopt(ctx->sockfd, SOL_SOCKET, SO_RXQ_OVFL, &(int){ 1 }, sizeof(int)) < 0 ||
+        bind(ctx->sockfd, (const struct sockaddr *) &ctx->peer, sizeof(ctx->peer)) < 0 ||
+        (ctx->config.logDirectory != NULL &&
+         (ctx->log = msgLogOpen(ctx->config.logDirectory, ctx->config.logSegmentSize)) == NULL)) {
+        int err = errno;
+        close(ctx->sockfd);
+        dedupDestroy(ctx->dedup);
+        releaseContext(ctx);
+        errno = err;
+        return NULL;
+    }
+    if (ctx->log != NULL) {
+        restoreMailboxes(ctx);
+        restoreDedup(ctx);
+    }
+    return ctx;
+}
+
+/**
+ * Sends (or resends) the connection init packet to the server
+ */
+static void sendInit(commContext *ctx) {
+    customPktHeader packet;
+    size_t length = ctx->config.name != NULL ? strlen(ctx->config.name) : 0, offset = 0;
+    ctx->initSentAt = nowMs();
+    packet.type = PKT_INIT;
+    packet.messageId = ctx->sessions[0].initId;
+    packet.packetNumber = 1;
+    packet.packetCount = 0;
+    if (ctx->tagSize > 0) {     //nonce of the client for the session key goes first
+        memcpy(packet.message, &ctx->initNonce, sizeof(ctx->initNonce));
+        offset = sizeof(ctx->initNonce);
+    }
+    if (length > 0)
+        memcpy(packet.message + offset, ctx->config.name, length);     //name of the client is the payload
+    sendPacket(ctx, &ctx->peer, &packet, HEADER_SIZE + offset + length);
+}
+
+commContext *commClientCreate(const commConfig *config) {
+    struct timespec ts;
+    commContext *ctx;
+    if (config != NULL && config->name != NULL && strlen(config->name) >= COMM_NAME_MAX) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if ((ctx = createContext(config, 0)) == NULL)
+        return NULL;
+    //first message id is random, so the server does not mix the messages with a previous session from the same port
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ctx->sessions[0].used = 1;
+    ctx->sessions[0].addr = ctx->peer;
+    ctx->sessionBdps[0] = sessionBdp(ctx, &ctx->sessions[0]);
+    ctx->sessions[0].nextMessageId = (unsigned int) (ts.tv_nsec ^ (ts.tv_sec << 20) ^ ((long) getpid() << 8));
+    ctx->sessions[0].initId = ctx->sessions[0].nextMessageId;
+    ctx->sessions[0].nextDeliver = ctx->sessions[0].initId;     //server numbers its messages from the same id
+    ctx->idNonce = (unsigned int) ((ts.tv_nsec * 2654435761u) ^ ts.tv_sec ^ ((unsigned int) getpid() << 16));
+    ctx->initNonce = randomNonce();
+    //socket is connected, so only the packets of the server are received
+    if (connect(ctx->sockfd, (const struct sockaddr *) &ctx->peer, sizeof(ctx->peer)) < 0) {
+        int err = errno;
+        close(ctx->sockfd);
+        dedupDestroy(ctx->dedup);
+        releaseContext(ctx);
+        errno = err;
+        return NULL;
+    }
+    //testing the connection between server and client - connected event is reported after the server replies
+    sendInit(ctx);
+    return ctx;
+}
+
+/**
+ * Removes the entry from the list
+ */
+static void unlinkEntry(sendEntry **head, sendEntry **tail, sendEntry *entry) {
+    if (entry->prev != NULL)
+        entry->prev->next = entry->next;
+    else
+        *head = entry->next;
+    if (entry->next != NULL)
+        entry->next->prev = entry->prev;
+    else
+        *tail = entry->prev;
+    entry->prev = NULL;
+    entry->next = NULL;
+}
+
+/**
+ * Appends the entry to the end of the list
+ */
+static void appendEntry(sendEntry **head, sendEntry **tail, sendEntry *entry) {
+    entry->prev = *tail;
+    if (*tail != NULL)
+        (*tail)->next = entry;
+    else
+        *head = entry;
+    *tail = entry;
+}
+
+/**
+ * @return oldest message of the session which is not completed (started or waiting), NULL if there is none
+ */
+static sendEntry *firstQueued(commSession *session) {
+    int c;
+    if (session->queueHead != NULL)
+        return session->queueHead;
+    for (c = 0; c < COMM_PRIORITY_CLASSES; c++)
+        if (session->waitHead[c] != NULL)
+            return session->waitHead[c];
+    return NULL;
+}
+
+/**
+ * Finishes the message - removes it from the session and queues its completion
+ * @param type COMM_EVENT_SENT, COMM_EVENT_FAILED, COMM_EVENT_TIMEOUT or COMM_EVENT_EXPIRED
+ */
+static void completeMessage(commContext *ctx, commSession *session, sendEntry *entry, commEventType type) {
+    commEvent event;
+    int i;
+
+    if (entry->started) {
+        //release the window slots of the message
+        for (i = 0; session->window != NULL && i < ctx->config.sendWindow && session->inFlight > 0; i++)
+            if (session->window[i].entry == entry) {
+                session->window[i].entry = NULL;
+                session->inFlight--;
+            }
+        if (entry->endReady && !entry->endSent)
+            session->endsReady--;
+        if (session->current == entry)
+            session->current = NULL;
+        unlinkEntry(&session->queueHead, &session->queueTail, entry);
+    } else {
+        unlinkEntry(&session->waitHead[entry->message.priority], &session->waitTail[entry->message.priority], entry);
+        session->waiting[entry->message.priority]--;
+    }
+    ctx->sessionQueued[session - ctx->sessions]--;
+    if (entry->stored != NULL)
+        relayCompleted(ctx, session, entry, type);
+
+    //only a failed history request of the client is reported from the internal messages
+    if (!entry->internal || (type != COMM_EVENT_SENT && !ctx->isServer)) {
+        memset(&event, 0, sizeof(event));
+        event.type = type;
+        event.peer = session->addr;
+        event.messageId = entry->messageId;
+        event.id = entry->trailer.id;
+        event.channel = entry->trailer.channel;
+        event.priority = entry->message.priority;
+        if (entry->internal) {
+            event.requestId = entry->trailer.requestId;
+        } else {
+            event.data = entry->message.data;
+            event.length = entry->message.length;
+            event.userData = entry->message.userData;
+        }
+        queueEvent(ctx, &event, entry->message.onComplete, NULL);
+    }
+    free(entry->owned);
+    free(entry);
+}
+
+/**
+ * Releases all the state of the session, messages which are not completed are reported as failed
+ */
+static void resetSession(commContext *ctx, commSession *session) {
+    sendEntry *entry;
+    int i;
+    while (session->history != NULL) {
+        historyJob *job = session->history;
+        session->history = job->nextJob;
+        free(job->results);
+        free(job);
+    }
+    while ((entry = firstQueued(session)) != NULL)
+        completeMessage(ctx, session, entry, COMM_EVENT_FAILED);
+    detachMailbox(session);
+    for (i = 0; i < MAX_OPEN_MESSAGES; i++) {
+        if (session->partial[i] != NULL) {
+            arenaFree(ctx->arena, session->partial[i]->buffer);
+            arenaFree(ctx->arena, session->partial[i]);
+        }
+    }
+    arenaFree(ctx->arena, session->window);
+    memset(session, 0, sizeof(*session));
+    i = (int) (session - ctx->sessions);
+    ctx->sessionKeys[i] = 0;
+    ctx->sessionSeen[i] = 0;
+    ctx->sessionBdps[i] = 0;
+    ctx->sessionDeadlines[i] = LLONG_MAX;
+    ctx->staleDeadlines[i / 64] &= ~(1ULL << (i % 64));
+}
+
+/**
+ * Takes the free session for the peer
+ */
+static void claimSession(commContext *ctx, commSession *session, const struct sockaddr_in *addr) {
+    int i = (int) (session - ctx->sessions);
+    session->used = 1;
+    session->addr = *addr;
+    ctx->sessionKeys[i] = sessionKey(addr);
+    ctx->sessionSeen[i] = nowMs();
+    ctx->sessionBdps[i] = sessionBdp(ctx, session);
+}
+
+/**
+ * Marks the deadline of the session for recomputation - its timers or send state changed
+ */
+static void staleDeadline(commContext *ctx, const commSession *session) {
+    int i = (int) (session - ctx->sessions);
+    ctx->staleDeadlines[i / 64] |= 1ULL << (i % 64);
+}
+
+void commDestroy(commContext *ctx) {
+    int i, open;
+    if (ctx == NULL)
+        return;
+    //client ends the session which was not closed in order (commShutdown) right away
+    open = !ctx->isServer && !(ctx->sessions[0].closeAcked && ctx->sessions[0].peerClosed);
+    if (open && ctx->config.integrity == COMM_INTEGRITY_AEAD && ctx->sessions[0].keyed) {
+        //authenticated end of the connection - only the trailer of an empty packet
+        unsigned char trailer[AEAD_TRAILER], nonce[AEAD_NONCE_SIZE];
+        unsigned long long seq = ++ctx->sessions[0].txSeq;
+        aeadPacket sealed;
+        memcpy(trailer, &seq, sizeof(seq));
+        describeClose(trailer, &sealed, nonce);
+        aeadSealBatch(ctx->sessions[0].key, &sealed, 1);
+        sendto(ctx->sockfd, trailer, sizeof(trailer), 0, (struct sockaddr *) &ctx->peer, sizeof(ctx->peer));
+    } else if (open && ctx->tagSize > 0 && ctx->sessions[0].keyed) {
+        //authenticated end of the connection - only the tag of an empty packet
+        unsigned long long tag = sipHash(ctx->sessions[0].key, (const unsigned char *) "", 0);
+        sendto(ctx->sockfd, &tag, sizeof(tag), 0, (struct sockaddr *) &ctx->peer, sizeof(ctx->peer));
+    } else if (open) {
+        sendto(ctx->sockfd, 0, 0, 0, (struct sockaddr *) &ctx->peer, sizeof(ctx->peer)); //sends NULL packet to server, terminates the connection
+    }
+    close(ctx->sockfd);
+
+    for (i = 0; i < MAX_SESSIONS; i++)
+        resetSession(ctx, &ctx->sessions[i]);
+    for (i = 0; i < ctx->mailboxCount; i++) {
+        while (ctx->mailboxes[i]->head != NULL) {
+            storedMessage *stored = ctx->mailboxes[i]->head;
+            ctx->mailboxes[i]->head = stored->next;
+            free(stored->owned);
+            free(stored);
+        }
+        free(ctx->mailboxes[i]);
+    }
+    free(ctx->mailboxes);
+    dedupDestroy(ctx->dedup);
+    msgLogClose(ctx->log);
+    free(ctx->deferred);
+    for (i = 0; i < MAX_SESSIONS; i++)
+        arenaFree(ctx->arena, ctx->rxQueues[i].packets);
+    for (i = 0; i < ZC_BUFFERS; i++)    //pages of the sends not completed yet are held by the kernel until they are sent
+        arenaFree(ctx->arena, ctx->zcBuffers[i].data);
+    for (i = 0; i < ctx->pendingCount; i++)
+        arenaFree(ctx->arena, ctx->pending[i].owned);
+    for (i = 0; i < ctx->retiredCount; i++)
+        arenaFree(ctx->arena, ctx->retired[i]);
+    free(ctx->pending);
+    free(ctx->retired);
+    releaseContext(ctx);
+}
+
+int commGetFd(commContext *ctx) {
+    return ctx->sockfd;
+}
+
+int commGetLocalAddress(commContext *ctx, struct sockaddr_in *address) {
+    socklen_t addrlen = sizeof(*address);
+    return getsockname(ctx->sockfd, (struct sockaddr *) address, &addrlen);
+}
+
+void commGetStats(commContext *ctx, commStats *stats) {
+    *stats = ctx->stats;
+    if (ctx->pool != NULL)
+        workPoolCounters(ctx->pool, &stats->workerTasks, &stats->stolenTasks);
+    if (ctx->arena != NULL)
+        stats->arenaFallbacks = arenaFallbacks(ctx->arena);
+}
+
+/**
+ * Reads the first line of the sysfs or procfs file
+ * @return 0 on success, -1 if the file cannot be read
+ */
+static int readLine(const char *path, char *line, size_t size) {
+    FILE *file = fopen(path, "r");
+    int result = -1;
+    if (file == NULL)
+        return -1;
+    if (fgets(line, (int) size, file) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+        result = 0;
+    }
+    fclose(file);
+    return result;
+}
+
+/**
+ * Prints the interrupts of the interface (MSI vectors of its device) with their CPU affinity
+ * @param cpu CPU of the context thread, -1 if it is not known
+ */
+static void reportInterrupts(FILE *out, const char *interface, int cpu) {
+    char path[300], affinity[256];
+    struct dirent *entry;
+    DIR *dir;
+    int count = 0, shared = 0;
+
+    snprintf(path, sizeof(path), "/sys/class/net/%s/device/msi_irqs", interface);
+    if ((dir = opendir(path)) == NULL) {
+        fprintf(out, "  interrupts: no MSI vectors (virtual interface or legacy interrupt)\n");
+        return;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), "/proc/irq/%s/smp_affinity_list", entry->d_name);
+        if (readLine(path, affinity, sizeof(affinity)) < 0)
+            continue;
+        fprintf(out, "%s%s -> CPUs %s", count++ % 8 == 0 ? (count > 1 ? "\n  " : "  interrupts: ") : ", ",
+                entry->d_name, affinity);
+        if (cpu >= 0 && strchr(affinity, '-') == NULL && strchr(affinity, ',') == NULL && atoi(affinity) == cpu)
+            shared++;
+    }
+    closedir(dir);
+    fprintf(out, count > 0 ? "\n" : "  interrupts: none found\n");
+    if (shared > 0)
+        fprintf(out, "  hint: %d interrupt vector(s) are handled by CPU %d, which runs the context - move them to\n"
+                     "        other CPUs of the same node (/proc/irq/N/smp_affinity_list) unless busy polling is used\n",
+                shared, cpu);
+}
+
+void commReportTopology(commContext *ctx, FILE *out) {
+    struct ifaddrs *interfaces, *ifa;
+    struct sockaddr_in local;
+    char path[300], line[64];
+    int cpu = sched_getcpu(), cpuNode = arenaCpuNode(cpu), memoryNode, nicNode, nodes = 0;
+    DIR *dir;
+    struct dirent *entry;
+
+    if ((dir = opendir("/sys/devices/system/node")) != NULL) {
+        while ((entry = readdir(dir)) != NULL)
+            nodes += strncmp(entry->d_name, "node", 4) == 0 && entry->d_name[4] >= '0' && entry->d_name[4] <= '9';
+        closedir(dir);
+    }
+    fprintf(out, "Topology: %d NUMA node(s), thread on CPU %d (node %d)%s\n", nodes > 0 ? nodes : 1, cpu, cpuNode,
+            ctx->config.cpu >= 0 ? ", pinned" : ", not pinned");
+    if (ctx->arena != NULL) {
+        static const char *pages[] = { "ordinary", "transparent huge", "explicit huge" };
+        memoryNode = arenaNode(ctx->arena);
+        fprintf(out, "  memory: %zu MB arena on node %d, %s pages, %zu kB used, %llu heap fallbacks\n",
+                ctx->config.arenaSize >> 20, memoryNode, pages[arenaPages(ctx->arena)], arenaUsed(ctx->arena) >> 10,
+                arenaFallbacks(ctx->arena));
+    } else {
+        memoryNode = -1;
+        fprintf(out, "  memory: heap (no arena)\n");
+    }
+    if (getifaddrs(&interfaces) < 0)
+        return;
+    commGetLocalAddress(ctx, &local);
+    for (ifa = interfaces; ifa != NULL; ifa = ifa->ifa_next) {
+        const struct sockaddr_in *address = (const struct sockaddr_in *) ifa->ifa_addr;
+        if (address == NULL || address->sin_family != AF_INET || (ifa->ifa_flags & IFF_LOOPBACK) ||
+            !(ifa->ifa_flags & IFF_UP))
+            continue;
+        //socket bound to one address uses only its interface
+        if (local.sin_addr.s_addr != htonl(INADDR_ANY) && local.sin_addr.s_addr != address->sin_addr.s_addr)
+            continue;
+        snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", ifa->ifa_name);
+        nicNode = readLine(path, line, sizeof(line)) == 0 ? atoi(line) : -1;
+        fprintf(out, "Interface %s (%s): node %d\n", ifa->ifa_name, inet_ntoa(address->sin_addr), nicNode);
+        reportInterrupts(out, ifa->ifa_name, cpu);
+        if (nicNode >= 0 && cpuNode >= 0 && nicNode != cpuNode)
+            fprintf(out, "  hint: %s is attached to node %d, the context runs on node %d - set cpu to a CPU of "
+                         "node %d\n", ifa->ifa_name, nicNode, cpuNode, nicNode);
+        else if (nicNode >= 0 && memoryNode >= 0 && nicNode != memoryNode)
+            fprintf(out, "  hint: %s is attached to node %d, the arena is on node %d - set numaNode to %d\n",
+                    ifa->ifa_name, nicNode, memoryNode, nicNode);
+    }
+    freeifaddrs(interfaces);
+}
+
+int commInFlight(commContext *ctx) {
+    int i, count = 0;
+    for (i = 0; i < MAX_SESSIONS; i++)
+        count += ctx->sessionQueued[i];
+    return count;
+}
+
+/**
+ * Checks whether the client can submit another message
+ * @return 0 if it can, -1 if it cannot (errno is set)
+ */
+static int canSubmit(commContext *ctx) {
+    if (ctx->isServer) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (ctx->connected < 0) {
+        errno = ENOTCONN;
+        return -1;
+    }
+    if (ctx->sessions[0].closing) {
+        errno = EPIPE;      //commShutdown was called
+        return -1;
+    }
+    if (ctx->sessionQueued[0] >= ctx->config.maxInFlight) {
+        errno = EAGAIN;     //backpressure - application has to wait for some completions
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Appends the message to the queue of its priority class, the messageId is assigned when the message is started
+ * @return queued entry, NULL if there is not enough memory
+ */
+static sendEntry *queueMessage(commContext *ctx, commSession *session, const commMessage *message) {
+    sendEntry *entry;
+    int c = message->priority;
+    if ((entry = calloc(1, sizeof(sendEntry))) == NULL)
+        return NULL;
+    entry->message = *message;
+    entry->trailer.channel = message->channel;
+    entry->trailer.priority = (unsigned int) message->priority;
+    if (message->recipient != NULL)
+        strncpy(entry->trailer.name, message->recipient, COMM_NAME_MAX - 1);
+    entry->nextPacket = 1;
+    if (message->ttlMs > 0) {
+        entry->deadline = nowMs() + message->ttlMs;
+        if (session->nextExpiry == 0 || entry->deadline < session->nextExpiry)
+            session->nextExpiry = entry->deadline;
+    }
+
+    //class which has been idle does not get the share it did not use
+    if (session->waiting[c] == 0 && session->pass[c] < session->virtualTime)
+        session->pass[c] = session->virtualTime;
+    appendEntry(&session->waitHead[c], &session->waitTail[c], entry);
+    session->waiting[c]++;
+    ctx->sessionQueued[session - ctx->sessions]++;
+    return entry;
+}
+
+int commSubmit(commContext *ctx, const commMessage *message) {
+    commSession *session = &ctx->sessions[0];
+    sendEntry *entry;
+    if (message->length > COMM_MAX_MESSAGE || (message->data == NULL && message->length > 0) ||
+        (message->recipient != NULL && (message->recipient[0] == '\0' || strlen(message->recipient) >= COMM_NAME_MAX)) ||
+        message->priority < COMM_PRIORITY_NORMAL || message->priority >= COMM_PRIORITY_CLASSES || message->ttlMs < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (canSubmit(ctx) < 0 || (entry = queueMessage(ctx, session, message)) == NULL)
+        return -1;
+    staleDeadline(ctx, session);    //TTL of the message
+    entry->trailer.id = message->id != 0 ? message->id : ((unsigned long long) ctx->idNonce << 32) | session->submitted;
+    session->submitted++;
+    return 0;
+}
+
+void commHistoryQueryInit(commHistoryQuery *query) {
+    memset(query, 0, sizeof(*query));
+    query->channel = COMM_ANY_CHANNEL;
+}
+
+int commRequestHistory(commContext *ctx, const commHistoryQuery *query, unsigned int *requestId) {
+    commMessage message;
+    historyRequest *request;
+    sendEntry *entry;
+
+    if (canSubmit(ctx) < 0 || (request = calloc(1, sizeof(historyRequest))) == NULL)
+        return -1;
+    request->fromSequence = query->fromSequence;
+    request->fromTimestamp = query->fromTimestamp;
+    request->channel = query->channel;
+    if (query->sender.sin_family == AF_INET) {
+        request->senderAddress = query->sender.sin_addr.s_addr;
+        request->senderPort = query->sender.sin_port;
+    }
+    request->newest = (unsigned short) (query->newest != 0);
+    request->limit = query->limit;
+
+    memset(&message, 0, sizeof(message));
+    message.data = request;
+    message.length = sizeof(*request);
+    if ((entry = queueMessage(ctx, &ctx->sessions[0], &message)) == NULL) {
+        free(request);
+        return -1;
+    }
+    entry->owned = (char *) request;
+    entry->internal = 1;
+    entry->trailer.flags = MSG_HISTORY_REQUEST;
+    entry->trailer.requestId = ++ctx->sessions[0].nextRequestId;
+    if (requestId != NULL)
+        *requestId = entry->trailer.requestId;
+    return 0;
+}
+
+/**
+ * Sends the packet of the message (data fragment or message-end flag)
+ */
+static void transmitPacket(commContext *ctx, commSession *session, sendEntry *entry, short packetNumber) {
+    customPktHeader header;
+    size_t size = HEADER_SIZE;
+
+    header.messageId = entry->messageId;
+    header.packetNumber = packetNumber;
+    header.packetCount = entry->packetCount;
+    if (packetNumber <= entry->packetCount) {
+        size_t offset = (size_t) (packetNumber - 1) * entry->fragSize;
+        size_t length = entry->message.length - offset;
+        if (length > entry->fragSize)
+            length = entry->fragSize;
+        header.type = PKT_DATA | (entry->message.priority << PKT_PRIORITY_SHIFT); //message sending indicator
+        memcpy(header.message, (const char *) entry->message.data + offset, length);
+        size += length;
+    } else {
+        messageTrailer trailer = entry->trailer;
+        long long now = nowMs();
+        trailer.firstPending = session->queueHead->messageId;
+        trailer.length = (unsigned int) entry->message.length;
+        if (entry->deadline != 0)   //message is sent only before its deadline, so the rest is positive
+            trailer.ttlMs = entry->deadline > now ? (unsigned int) (entry->deadline - now) : 1;
+        header.type = PKT_END | (entry->message.priority << PKT_PRIORITY_SHIFT); //end of stream - message-end flag
+        memcpy(header.message, &trailer, sizeof(trailer));
+        size += sizeof(trailer);
+    }
+    sendPacket(ctx, &session->addr, &header, size);
+}
+
+/**
+ * @return retransmission timeout of the session - measured, or retransmitTimeoutMs before the first sample
+ */
+static int sessionRto(commContext *ctx, const commSession *session) {
+    return session->rto > 0 ? session->rto : ctx->config.retransmitTimeoutMs;
+}
+
+/**
+ * @return time after which a packet is sent again - the retransmission timeout doubles with every attempt, up to
+ * retransmitTimeoutMs (or the measured timeout if it is longer)
+ */
+static int backoffTimeout(commContext *ctx, const commSession *session, int attempts) {
+    int rto = sessionRto(ctx, session), limit = rto > ctx->config.retransmitTimeoutMs ? rto : ctx->config.retransmitTimeoutMs;
+    return attempts >= 16 || (long long) rto << attempts > limit ? limit : rto << attempts;
+}
+
+/**
+ * @return time after which the packet in the slot is sent again
+ */
+static int slotTimeout(commContext *ctx, const commSession *session, const inFlightPacket *slot) {
+    return backoffTimeout(ctx, session, slot->attempts);
+}
+
+/**
+ * Records the acknowledged packet as the latest delivered one if it was sent after the others (RACK)
+ */
+static void rackAcked(commSession *session, const inFlightPacket *slot, long long now) {
+    long long rtt = now - slot->sample.sentUs;
+    //ACK of a retransmitted packet faster than the minimum round trip belongs to the original transmission
+    if (slot->sentNs == 0 && rtt < session->cc.minRttUs)
+        return;
+    if (slot->sample.sentUs >= session->rackSentUs) {
+        session->rackSentUs = slot->sample.sentUs;
+        session->rackRttUs = rtt;
+    }
+}
+
+/**
+ * @return time (monotonic microseconds) at which RACK declares the packet lost - it was sent before the latest
+ * acknowledged packet and is still missing a reordering window (a quarter of the minimum round trip) after the
+ * round trip of that packet; 0 if it was not sent before it
+ */
+static long long rackDeadline(const commSession *session, const inFlightPacket *slot) {
+    if (slot->sample.sentUs >= session->rackSentUs)
+        return 0;
+    return slot->sample.sentUs + session->rackRttUs + session->cc.minRttUs / 4;
+}
+
+/**
+ * @return packet in flight which was sent last - the tail-loss probe sends it again, NULL if there is no probe to be
+ * sent (no packet in flight, no round-trip sample yet or a probe is already waiting for an ACK)
+ */
+static inFlightPacket *tailPacket(commContext *ctx, const commSession *session) {
+    inFlightPacket *tail = NULL;
+    int i;
+    if (session->probing || session->srttUs == 0 || session->inFlight == 0)
+        return NULL;
+    for (i = 0; i < ctx->config.sendWindow; i++) {
+        if (session->window[i].entry != NULL && (tail == NULL || session->window[i].sample.sentUs > tail->sample.sentUs))
+            tail = &session->window[i];
+    }
+    return tail;
+}
+
+/**
+ * @return time (ms) of the tail-loss probe - two smoothed round trips after the last packet was sent
+ */
+static long long probeTime(const commSession *session, const inFlightPacket *tail) {
+    long long timeout = (2 * session->srttUs + 999) / 1000;
+    return (tail->sample.sentUs + 999) / 1000 + (timeout > TLP_MIN_MS ? timeout : TLP_MIN_MS);
+}
+
+/**
+ * Adds the sample to the latency histogram - bucket i counts the samples below 2^i microseconds
+ */
+static void addLatency(unsigned long long *histogram, long long us) {
+    int bucket = 0;
+    while (bucket < COMM_LATENCY_BUCKETS - 1 && us >= 1LL << bucket)
+        bucket++;
+    histogram[bucket]++;
+}
+
+/**
+ * Updates the smoothed round-trip time and the retransmission timeout of the session (RFC 6298)
+ */
+static void updateRto(commContext *ctx, commSession *session, long long rttUs) {
+    long long rto;
+    if (session->srttUs == 0) {
+        session->srttUs = rttUs > 0 ? rttUs : 1;
+        session->rttvarUs = rttUs / 2;
+    } else {
+        long long error = session->srttUs > rttUs ? session->srttUs - rttUs : rttUs - session->srttUs;
+        session->rttvarUs = (3 * session->rttvarUs + error) / 4;
+        session->srttUs = (7 * session->srttUs + rttUs) / 8;
+        if (session->srttUs == 0)
+            session->srttUs = 1;
+    }
+    rto = (session->srttUs + (4 * session->rttvarUs > RTO_GRANULARITY_US ? 4 * session->rttvarUs : RTO_GRANULARITY_US)
+           + 999) / 1000;
+    session->rto = rto < RTO_MIN_MS ? RTO_MIN_MS : rto > RTO_MAX_MS ? RTO_MAX_MS : (int) rto;
+    ctx->stats.srttUs = session->srttUs;
+    ctx->stats.rtoMs = session->rto;
+}
+
+/**
+ * Takes the round-trip sample of the acknowledged packet - the time between the kernel timestamps of the packet and
+ * its ACK (user space times if they are missing) updates the retransmission timeout; the ACK delay reported by the
+ * peer splits the round trip into the network time and the time spent in the hosts for the histograms
+ * Retransmitted packets give no sample, their ACK may belong to any of the copies
+ */
+static void measureRtt(commContext *ctx, commSession *session, const inFlightPacket *slot,
+                       const customPktHeader *packet, size_t payload) {
+    const txStamp *stamp = &ctx->txStamps[slot->txId % TX_STAMP_RING];
+    long long sent = slot->sentNs, rtt, network, host, delay = 0;
+    unsigned int delayUs;
+
+    if (ctx->timestamping && stamp->id == slot->txId && stamp->kernelNs != 0) {
+        sent = stamp->kernelNs;
+        ctx->stats.stampedSamples++;
+    }
+    if ((rtt = (ctx->rxStampNs - sent) / 1000) < 0)
+        return;     //clock was stepped
+    if (payload >= sizeof(delayUs)) {
+        memcpy(&delayUs, packet->message, sizeof(delayUs));
+        delay = delayUs;
+    }
+    network = rtt > delay ? rtt - delay : 0;
+    host = (wallClockNs() - slot->sentNs) / 1000 - network;
+    updateRto(ctx, session, rtt);
+    congestionRtt(&session->cc, rtt, nowUs());
+    ctx->stats.rttSamples++;
+    addLatency(ctx->stats.rttHistogram, rtt);
+    addLatency(ctx->stats.networkHistogram, network);
+    addLatency(ctx->stats.hostHistogram, host > 0 ? host : 0);
+}
+
+/**
+ * Counts the first transmission or the retransmission of a data fragment and re-evaluates the fragment size of the
+ * session every FRAG_EVAL_PACKETS fragments - on a lossy link the fragments are halved, so a retransmission resends
+ * less, on a clean link they are doubled, so the per-packet costs are spread over more data
+ * @param lost The fragment is sent again
+ */
+static void countFragment(commContext *ctx, commSession *session, int lost) {
+    size_t size = session->fragSize;
+    if (lost)
+        session->fragLost++;
+    else
+        session->fragSent++;
+    if (!ctx->config.adaptiveFragments || session->fragSent < FRAG_EVAL_PACKETS)
+        return;
+    //loss of one evaluation is noisy, the smoothed one (weight 1/4) keeps the size stable under a steady loss
+    session->fragLoss = (3 * session->fragLoss + session->fragLost * 1000 / session->fragSent) / 4;
+    if (session->fragLoss > FRAG_LOSS_HIGH)
+        size = size / 2 > COMM_FRAG_MIN ? size / 2 : COMM_FRAG_MIN;
+    else if (session->fragLoss <= FRAG_LOSS_LOW)
+        size = size * 2 < COMM_FRAG_MAX ? size * 2 : COMM_FRAG_MAX;
+    if (size != session->fragSize) {
+        session->fragSize = size;
+        ctx->stats.fragResizes++;
+    }
+    ctx->stats.fragSize = (int) session->fragSize;
+    session->fragSent = 0;
+    session->fragLost = 0;
+}
+
+/**
+ * @return size of the packet of the message on the wire (header, payload and trailer)
+ */
+static size_t packetBytes(const commContext *ctx, const sendEntry *entry, short packetNumber) {
+    size_t payload = sizeof(messageTrailer);
+    if (packetNumber <= entry->packetCount) {
+        payload = entry->message.length - (size_t) (packetNumber - 1) * entry->fragSize;
+        if (payload > entry->fragSize)
+            payload = entry->fragSize;
+    }
+    return HEADER_SIZE + payload + ctx->tagSize;
+}
+
+/**
+ * @return size of a full fragment of the session on the wire - the unit of the congestion window
+ */
+static size_t sessionPacketBytes(const commContext *ctx, const commSession *session) {
+    return HEADER_SIZE + (session->fragSize > 0 ? session->fragSize : COMM_FRAG_SIZE) + ctx->tagSize;
+}
+
+/**
+ * Copies the congestion control state of the session to the statistics
+ */
+static void congestionStats(commContext *ctx, const commSession *session) {
+    ctx->stats.congestionWindow = congestionWindow(&session->cc, sessionPacketBytes(ctx, session));
+    ctx->stats.bandwidth = (long long) session->cc.bandwidth;
+    ctx->stats.pacingRate = (long long) congestionPacingRate(&session->cc);
+    ctx->stats.minRttUs = session->cc.minRttUs;
+    ctx->sessionBdps[session - ctx->sessions] = sessionBdp(ctx, session);
+}
+
+/**
+ * Occupies a free window slot with the packet and sends it
+ */
+static void sendWindowed(commContext *ctx, commSession *session, sendEntry *entry, short packetNumber) {
+    int i;
+    for (i = 0; i < ctx->config.sendWindow; i++) {
+        inFlightPacket *slot = &session->window[i];
+        if (slot->entry == NULL) {
+            slot->entry = entry;
+            slot->packetNumber = packetNumber;
+            slot->attempts = 0;
+            slot->sentAt = nowMs();
+            slot->sentNs = wallClockNs();
+            session->inFlight++;
+            congestionSent(&session->cc, &slot->sample, nowUs());
+            if (packetNumber <= entry->packetCount)
+                countFragment(ctx, session, 0);
+            transmitPacket(ctx, session, entry, packetNumber);
+            slot->txId = ctx->lastTxId;
+            return;
+        }
+    }
+}
+
+/**
+ * Chooses the waiting message to be started next - messages whose TTL expired are dropped, a class whose oldest
+ * message is close to its deadline goes first (earliest deadline first), otherwise the classes take turns by the
+ * stride scheduling, so every class gets a share of the started messages given by its weight
+ * @return message to be started, NULL if no message is waiting
+ */
+static sendEntry *scheduleNext(commContext *ctx, commSession *session, long long now) {
+    static const int preference[COMM_PRIORITY_CLASSES] = {
+            COMM_PRIORITY_INTERACTIVE, COMM_PRIORITY_NORMAL, COMM_PRIORITY_BULK };  //order of the classes with equal pass
+    sendEntry *head, *urgent = NULL;
+    int i, c, chosen = -1;
+
+    for (i = 0; i < COMM_PRIORITY_CLASSES; i++) {
+        c = preference[i];
+        while ((head = session->waitHead[c]) != NULL && head->deadline != 0 && head->deadline <= now)
+            completeMessage(ctx, session, head, COMM_EVENT_EXPIRED);
+        if (head == NULL)
+            continue;
+        //urgent message has about two round trips left
+        if (head->deadline != 0 && head->deadline - now <= 2 * sessionRto(ctx, session) &&
+            (urgent == NULL || head->deadline < urgent->deadline))
+            urgent = head;
+        if (chosen < 0 || session->pass[c] < session->pass[chosen])
+            chosen = c;
+    }
+    if (urgent != NULL)
+        chosen = urgent->message.priority;
+    if (chosen < 0)
+        return NULL;
+    session->virtualTime = session->pass[chosen];
+    session->pass[chosen] += SCHED_STRIDE / (unsigned int) ctx->config.priorityWeights[chosen];
+    return session->waitHead[chosen];
+}
+
+/**
+ * Starts sending the waiting message - assigns its messageId and moves it to the started messages
+ */
+static void startMessage(commSession *session, sendEntry *entry) {
+    int c = entry->message.priority;
+    unlinkEntry(&session->waitHead[c], &session->waitTail[c], entry);
+    session->waiting[c]--;
+    entry->started = 1;
+    entry->messageId = session->nextMessageId++;
+    if (session->fragSize == 0)
+        session->fragSize = COMM_FRAG_SIZE;
+    entry->fragSize = session->fragSize;   //fragments of a message keep their size, retransmissions included
+    entry->packetCount = (short) ((entry->message.length + entry->fragSize - 1) / entry->fragSize);
+    appendEntry(&session->queueHead, &session->queueTail, entry);
+    session->current = entry;
+    if (entry->packetCount == 0) {  //empty message consists only of the END packet
+        entry->endReady = 1;
+        session->endsReady++;
+    }
+}
+
+/**
+ * Fills the send window of the session - END packets of the finished messages first, then the fragments of the
+ * current message, then the next messages chosen by the scheduler
+ * @param budget Maximum number of packets to be sent
+ * @return number of sent packets
+ */
+static int sessionPump(commContext *ctx, commSession *session, int budget) {
+    sendEntry *entry;
+    size_t bytes = sessionPacketBytes(ctx, session);
+    int sent = 0, credited = 0;
+    if (ctx->sessionQueued[session - ctx->sessions] == 0 || session->busyUntil > nowMs())
+        return 0;
+    staleDeadline(ctx, session);    //packets sent now start their retransmission timers
+    if (session->window == NULL) {
+        if ((session->window = arenaCalloc(ctx->arena, ctx->config.sendWindow, sizeof(inFlightPacket))) == NULL)
+            return 0;
+        congestionInit(&session->cc, ctx->config.congestion, ctx->config.sendWindow);
+    }
+
+    while (session->inFlight < congestionWindow(&session->cc, bytes) && sent < budget) {
+        //packet waits for its pacing credit - the deadline of the session wakes the sending up again
+        if (!credited && !(credited = congestionPace(&session->cc, bytes, nowUs())))
+            break;
+        if (session->endsReady > 0) {
+            for (entry = session->queueHead; entry != NULL; entry = entry->next) {
+                if (entry->endReady && !entry->endSent)
+                    break;
+            }
+            entry->endSent = 1;
+            session->endsReady--;
+            sendWindowed(ctx, session, entry, (short) (entry->packetCount + 1));
+            sent++;
+            credited = 0;
+            continue;
+        }
+        if (session->current != NULL && session->current->nextPacket <= session->current->packetCount) {
+            sendWindowed(ctx, session, session->current, session->current->nextPacket++);
+            sent++;
+            credited = 0;
+            continue;
+        }
+        //start the next message, if the receiver can hold it
+        if (session->queueHead != NULL && session->nextMessageId - session->queueHead->messageId >= MAX_OPEN_MESSAGES)
+            break;
+        if ((entry = scheduleNext(ctx, session, nowMs())) == NULL)
+            break;
+        startMessage(session, entry);
+    }
+    if (credited)
+        session->cc.credit += (double) bytes;   //credit of the packet which was not sent is given back
+    return sent;
+}
+
+/**
+ * Backs off after a busy reply of the peer - no new packets are sent to it for the back-off time, which doubles with
+ * every busy reply (up to BUSY_BACKOFF_MAX retransmission timeouts) and is reset by the next acknowledgement
+ * The client reports the start of the back-off as COMM_EVENT_BUSY
+ */
+static void peerBusy(commContext *ctx, commSession *session) {
+    commEvent event;
+    long long now = nowMs();
+
+    if (session->busyUntil > now)
+        return;     //one back-off step for the whole window
+    if (session->busyBackoff == 0 && !ctx->isServer) {
+        memset(&event, 0, sizeof(event));
+        event.type = COMM_EVENT_BUSY;
+        event.peer = session->addr;
+        queueEvent(ctx, &event, NULL, NULL);
+    }
+    session->busyBackoff = session->busyBackoff == 0 ? ctx->config.retransmitTimeoutMs : session->busyBackoff * 2;
+    if (session->busyBackoff > BUSY_BACKOFF_MAX * ctx->config.retransmitTimeoutMs)
+        session->busyBackoff = BUSY_BACKOFF_MAX * ctx->config.retransmitTimeoutMs;
+    session->busyUntil = now + session->busyBackoff;
+}
+
+/**
+ * Sends the lost packet again, or fails its message after maxRetransmits attempts
+ */
+static void retransmitLost(commContext *ctx, commSession *session, inFlightPacket *slot, long long now) {
+    if (slot->attempts++ < ctx->config.maxRetransmits) {
+        slot->sentAt = now;
+        slot->sentNs = 0;
+        congestionLost(&session->cc, &slot->sample, nowUs());
+        congestionSent(&session->cc, &slot->sample, nowUs());
+        if (slot->packetNumber <= slot->entry->packetCount)
+            countFragment(ctx, session, 1);
+        transmitPacket(ctx, session, slot->entry, slot->packetNumber);
+    } else {
+        completeMessage(ctx, session, slot->entry, COMM_EVENT_TIMEOUT);
+    }
+}
+
+/**
+ * Sends again the packets RACK declares lost - those sent before the latest acknowledged packet whose reordering
+ * window has passed
+ */
+static void detectLosses(commContext *ctx, commSession *session, long long now) {
+    long long us = nowUs(), deadline;
+    int i;
+    for (i = 0; i < ctx->config.sendWindow && session->inFlight > 0; i++) {
+        inFlightPacket *slot = &session->window[i];
+        if (slot->entry == NULL || (deadline = rackDeadline(session, slot)) == 0 || deadline > us)
+            continue;
+        ctx->stats.rackRetransmits++;
+        retransmitLost(ctx, session, slot, now);
+    }
+}
+
+/**
+ * Handles ACK, resend flag, busy or error reply to a packet sent by this side
+ */
+static void handleReply(commContext *ctx, commSession *session, const customPktHeader *packet, size_t payload) {
+    inFlightPacket *slot = NULL;
+    sendEntry *entry;
+    int i;
+
+    if (session->window == NULL)
+        return;
+    for (i = 0; i < ctx->config.sendWindow; i++) {
+        if (session->window[i].entry != NULL && session->window[i].entry->messageId == packet->messageId &&
+            session->window[i].packetNumber == packet->packetNumber) {
+            slot = &session->window[i];
+            break;
+        }
+    }
+    if (slot == NULL)
+        return;     //unexpected or duplicate reply
+    entry = slot->entry;
+
+    if (packet->type == PKT_BUSY) {
+        //receiver is alive but overloaded - the packet is sent again after the back-off, the attempt is not counted
+        peerBusy(ctx, session);
+        slot->attempts = 0;
+        slot->sentAt = session->busyUntil - sessionRto(ctx, session);
+        slot->sentNs = 0;
+        return;
+    }
+    session->busyBackoff = 0;
+
+    if (packet->type == PKT_RESEND) {
+        slot->sentAt = nowMs();
+        slot->sentNs = 0;
+        congestionSent(&session->cc, &slot->sample, nowUs());
+        if (slot->packetNumber <= entry->packetCount)
+            countFragment(ctx, session, 1);
+        transmitPacket(ctx, session, entry, slot->packetNumber);   //if resend-flag is received, send the packet again
+        return;
+    }
+    if (packet->type == PKT_ERROR) {
+        completeMessage(ctx, session, entry, COMM_EVENT_FAILED);    //receiver detected an error - message not sent
+        return;
+    }
+
+    if (slot->sentNs != 0)
+        measureRtt(ctx, session, slot, packet, payload);
+    if (payload >= 2 * sizeof(unsigned int)) {
+        unsigned int marked, marks;
+        memcpy(&marked, packet->message + sizeof(unsigned int), sizeof(marked));
+        //the count runs on, older ACKs overtaken by newer ones carry a smaller count
+        if ((marks = marked - session->markedReported) > 0 && marks < 0x80000000u) {
+            session->markedReported = marked;
+            ctx->stats.ceReported += marks;
+            congestionMarked(&session->cc, &slot->sample, (int) marks, nowUs());
+        }
+    }
+    rackAcked(session, slot, nowUs());
+    session->probing = 0;
+    slot->entry = NULL;
+    session->inFlight--;
+    congestionAcked(&session->cc, &slot->sample, packetBytes(ctx, entry, slot->packetNumber), session->inFlight,
+                    sessionPacketBytes(ctx, session), nowUs());
+    congestionStats(ctx, session);
+    if (slot->packetNumber > entry->packetCount) {  //receiver has acknowledged the end of message stream
+        completeMessage(ctx, session, entry, COMM_EVENT_SENT);
+    } else if (!bitTest(entry->acked, slot->packetNumber - 1)) {
+        bitSet(entry->acked, slot->packetNumber - 1);
+        if (++entry->ackedCount == entry->packetCount) {
+            entry->endReady = 1;
+            session->endsReady++;
+        }
+    }
+    //losses are detected last - a message which runs out of retransmissions is completed and its entry released
+    detectLosses(ctx, session, nowMs());
+}
+
+/**
+ * Drops the messages whose TTL expired (started or waiting) and finds the next deadline
+ */
+static void expireMessages(commContext *ctx, commSession *session, long long now) {
+    sendEntry *entry, *next;
+    int c;
+    session->nextExpiry = 0;
+    for (c = -1; c < COMM_PRIORITY_CLASSES; c++) {
+        for (entry = c < 0 ? session->queueHead : session->waitHead[c]; entry != NULL; entry = next) {
+            next = entry->next;
+            if (entry->deadline == 0)
+                continue;
+            if (entry->deadline <= now)
+                completeMessage(ctx, session, entry, COMM_EVENT_EXPIRED);
+            else if (session->nextExpiry == 0 || entry->deadline < session->nextExpiry)
+                session->nextExpiry = entry->deadline;
+        }
+    }
+}
+
+/**
+ * @return 1 if the close frame of the session is due - it is closing and the messages before it are all acknowledged
+ */
+static int closePending(const commContext *ctx, const commSession *session) {
+    return session->closing && !session->closeAcked && ctx->sessionQueued[session - ctx->sessions] == 0 &&
+           session->inFlight == 0 &&
+           session->history == NULL;
+}
+
+/**
+ * Resends the packets after the retransmission timeout or the reordering window of RACK, sends the tail-loss probe,
+ * gives up on the message after maxRetransmits attempts
+ */
+static void sessionTimers(commContext *ctx, commSession *session, long long now) {
+    inFlightPacket *tail;
+    int i;
+    if (session->nextExpiry != 0 && session->nextExpiry <= now)
+        expireMessages(ctx, session, now);
+    if (session->window == NULL)
+        return;
+    for (i = 0; i < ctx->config.sendWindow && session->inFlight > 0; i++) {
+        inFlightPacket *slot = &session->window[i];
+        if (slot->entry == NULL || now - slot->sentAt < slotTimeout(ctx, session, slot))
+            continue;
+        ctx->stats.timeoutRetransmits++;
+        retransmitLost(ctx, session, slot, now);
+    }
+    detectLosses(ctx, session, now);
+    if ((tail = tailPacket(ctx, session)) != NULL && probeTime(session, tail) <= now) {
+        //the tail of the flight has no later packet whose ACK would reveal its loss - it is sent again once, and
+        //its ACK (or the ACK of the original) lets RACK find the other losses; the timeout stays as a last resort
+        session->probing = 1;
+        ctx->stats.tailProbes++;
+        tail->sentNs = 0;
+        congestionSent(&session->cc, &tail->sample, nowUs());
+        transmitPacket(ctx, session, tail->entry, tail->packetNumber);
+    }
+}
+
+/**
+ * Computes the earliest time the session has timer work - expiring message, end of the busy back-off, next token
+ * of the relay queue draining or retransmission timeout of a packet in flight
+ */
+static void updateDeadline(commContext *ctx, commSession *session, long long now) {
+    long long nearest = LLONG_MAX, expires, rack;
+    inFlightPacket *tail;
+    int queued = ctx->sessionQueued[session - ctx->sessions], i;
+
+    if (session->nextExpiry != 0)
+        nearest = session->nextExpiry;
+    if (queued > 0 && session->busyUntil > now && session->busyUntil < nearest)
+        nearest = session->busyUntil;   //sending resumes after the back-off
+    if (queued > 0 && session->window != NULL &&
+        session->inFlight < congestionWindow(&session->cc, sessionPacketBytes(ctx, session))) {
+        //paced packet waits for its credit
+        long long delayUs = congestionPaceDelay(&session->cc, sessionPacketBytes(ctx, session), nowUs());
+        if (delayUs > 0 && now + (delayUs + 999) / 1000 < nearest)
+            nearest = now + (delayUs + 999) / 1000;
+    }
+    if (session->mailbox != NULL && mailboxPending(session->mailbox) && ctx->config.relayDrainRate > 0 &&
+        session->mailbox->tokens < 1) {     //queue draining waits for the next token
+        expires = now + 1 + (long long) ((1 - session->mailbox->tokens) * 1000 / ctx->config.relayDrainRate);
+        if (expires < nearest)
+            nearest = expires;
+    }
+    for (i = 0; session->inFlight > 0 && i < ctx->config.sendWindow; i++) {
+        if (session->window[i].entry == NULL)
+            continue;
+        expires = session->window[i].sentAt + slotTimeout(ctx, session, &session->window[i]);
+        if ((rack = rackDeadline(session, &session->window[i])) != 0 && (rack + 999) / 1000 < expires)
+            expires = (rack + 999) / 1000;     //reordering window of the packet ends first
+        if (expires < nearest)
+            nearest = expires;
+    }
+    if (session->window != NULL && (tail = tailPacket(ctx, session)) != NULL && probeTime(session, tail) < nearest)
+        nearest = probeTime(session, tail);
+    if (session->lingerUntil != 0 && session->lingerUntil < nearest)
+        nearest = session->lingerUntil;
+    if (session->peerCloseBy != 0 && session->peerCloseBy < nearest)
+        nearest = session->peerCloseBy;
+    if (closePending(ctx, session)) {
+        expires = session->closeAttempts == 0 ? now :
+                  session->closeSentAt + backoffTimeout(ctx, session, session->closeAttempts - 1);
+        if (expires < nearest)
+            nearest = expires;
+    }
+    ctx->sessionDeadlines[session - ctx->sessions] = nearest;
+}
+
+/**
+ * Recomputes the deadlines of the sessions marked by staleDeadline
+ */
+static void updateStaleDeadlines(commContext *ctx, long long now) {
+    unsigned long long stale;
+    int w;
+    for (w = 0; w < (MAX_SESSIONS + 63) / 64; w++) {
+        for (stale = ctx->staleDeadlines[w]; stale != 0; stale &= stale - 1)
+            updateDeadline(ctx, &ctx->sessions[w * 64 + __builtin_ctzll(stale)], now);
+        ctx->staleDeadlines[w] = 0;
+    }
+}
+
+/**
+ * Resends the init packet after the retransmission timeout, all messages fail if the server does not respond
+ */
+static void clientTimers(commContext *ctx, long long now) {
+    commEvent event;
+    sendEntry *entry;
+    if (ctx->connected != 0 || now - ctx->initSentAt < ctx->config.retransmitTimeoutMs)
+        return;
+    if (ctx->initAttempts++ < ctx->config.maxRetransmits) {
+        sendInit(ctx);
+        return;
+    }
+    ctx->connected = -1;
+    memset(&event, 0, sizeof(event));
+    event.type = COMM_EVENT_FAILED;
+    event.peer = ctx->peer;
+    queueEvent(ctx, &event, NULL, NULL);
+    while ((entry = firstQueued(&ctx->sessions[0])) != NULL)
+        completeMessage(ctx, &ctx->sessions[0], entry, COMM_EVENT_TIMEOUT);
+}
+
+/**
+ * Finds the session of the peer, creates a new one (replacing the least recently active one if the table is full)
+ */
+static commSession *findSession(commContext *ctx, const struct sockaddr_in *addr, int create) {
+    int i;
+    if (!ctx->isServer)
+        return &ctx->sessions[0];
+    if ((i = scanFind(ctx->sessionKeys, MAX_SESSIONS, sessionKey(addr))) >= 0)
+        return &ctx->sessions[i];
+    if (!create)
+        return NULL;
+    if ((i = scanFind(ctx->sessionKeys, MAX_SESSIONS, 0)) < 0) {    //table is full - the oldest session is replaced
+        i = scanFind(ctx->sessionSeen, MAX_SESSIONS, scanMin(ctx->sessionSeen, MAX_SESSIONS));
+        resetSession(ctx, &ctx->sessions[i]);
+    }
+    claimSession(ctx, &ctx->sessions[i], addr);
+    return &ctx->sessions[i];
+}
+
+/**
+ * Starts answering the history request of the client - finds the matching records in the message log
+ * The records are sent by historyPump, a server without the log answers with the end of the history only
+ */
+static void startHistory(commContext *ctx, commSession *session, const reassembly *r) {
+    historyRequest request;
+    logQuery query;
+    historyJob *job;
+
+    if ((job = calloc(1, sizeof(historyJob))) == NULL)
+        return;     //client does not get the end of the history, the request fails on its side
+    job->requestId = r->trailer.requestId;
+    if (ctx->log != NULL && r->length == sizeof(request)) {
+        memcpy(&request, r->buffer, sizeof(request));
+        memset(&query, 0, sizeof(query));
+        query.fromSequence = request.fromSequence;
+        query.fromTimestamp = request.fromTimestamp;
+        query.filterChannel = request.channel != COMM_ANY_CHANNEL;
+        query.channel = request.channel;
+        query.filterSender = request.senderPort != 0;
+        query.sender = LOG_SENDER_KEY(request.senderAddress, request.senderPort);
+        query.limit = request.limit == 0 || request.limit > COMM_HISTORY_MAX ? COMM_HISTORY_MAX : request.limit;
+        query.newest = request.newest;
+        if ((job->results = malloc(query.limit * sizeof(logRecordRef))) != NULL)
+            job->count = msgLogQuery(ctx->log, &query, job->results);
+    }
+    if (session->historyTail != NULL)
+        session->historyTail->nextJob = job;
+    else
+        session->history = job;
+    session->historyTail = job;
+}
+
+/**
+ * Queues the records of the history requests for sending, while the send queue of the session is short
+ * Records are sent directly from the log mapping, the last message of every request is the end of the history
+ */
+static void historyPump(commContext *ctx, commSession *session) {
+    commMessage message;
+    sendEntry *entry;
+
+    while (session->history != NULL && ctx->sessionQueued[session - ctx->sessions] < HISTORY_QUEUE) {
+        historyJob *job = session->history;
+        memset(&message, 0, sizeof(message));
+        if (job->next < job->count) {
+            const logRecordRef *record = &job->results[job->next];
+            message.data = record->data;
+            message.length = record->header->length;
+            message.channel = record->header->channel;
+        }
+        if ((entry = queueMessage(ctx, session, &message)) == NULL)
+            return;
+        entry->internal = 1;
+        entry->trailer.requestId = job->requestId;
+        if (job->next == job->count) {
+            entry->trailer.flags = MSG_HISTORY_END;
+            session->history = job->nextJob;
+            if (session->history == NULL)
+                session->historyTail = NULL;
+            free(job->results);
+            free(job);
+            continue;
+        }
+        entry->trailer.flags = MSG_HISTORY;
+        entry->trailer.sequence = job->results[job->next].header->sequence;
+        entry->trailer.timestamp = job->results[job->next].header->timestamp;
+        entry->trailer.senderAddress = job->results[job->next].header->senderAddress;
+        entry->trailer.senderPort = job->results[job->next].header->senderPort;
+        if (msgLogName(ctx->log, job->results[job->next].header->senderId) != NULL)
+            strncpy(entry->trailer.name, msgLogName(ctx->log, job->results[job->next].header->senderId),
+                    COMM_NAME_MAX - 1);
+        job->next++;
+    }
+}
+
+/**
+ * Stores the received message in the queue of its recipient - the logged message is referenced in the log mapping,
+ * the other one is copied
+ */
+static void storeMessage(commContext *ctx, commSession *session, const reassembly *r) {
+    storedMessage *stored;
+    logRecordRef record;
+
+    if ((stored = appendStored(r->recipient, (commPriority) r->trailer.priority)) == NULL)
+        return;
+    stored->sequence = r->sequence;
+    stored->id = r->trailer.id;
+    stored->timestamp = r->timestamp;
+    stored->deadline = r->trailer.ttlMs != 0 ? r->timestamp + r->trailer.ttlMs : 0;
+    stored->channel = r->trailer.channel;
+    stored->origin = session->addr;
+    stored->sender = session->mailbox;
+    stored->length = r->length;
+    if (r->sequence != 0 && msgLogRecord(ctx->log, r->sequence, &record) == 0) {
+        stored->data = record.data;
+    } else if (r->length > 0 && (stored->owned = malloc(r->length)) != NULL) {
+        memcpy(stored->owned, r->buffer, r->length);
+        stored->data = stored->owned;
+        r->recipient->bytes += r->length;
+    } else {
+        stored->length = 0;     //not enough memory - the message is relayed empty rather than out of order
+    }
+    trimMailbox(ctx, r->recipient);
+}
+
+/**
+ * Queues the stored messages of the mailbox for sending to its connected client, while the queue of their priority
+ * class in the session is short, so the scheduler of the session serves the classes by their weights - messages
+ * stored while the client was offline are paced by the relayDrainRate token bucket, so a reconnected client with
+ * a long queue does not take all the capacity from the live traffic, messages past their TTL are dropped
+ */
+static void relayPump(commContext *ctx, commSession *session, long long now) {
+    mailbox *box = session->mailbox;
+    long long wallNow = wallClockMs();
+    commMessage message;
+    sendEntry *entry;
+    int c;
+
+    if (box == NULL || session->closing)
+        return;     //messages for a closing client stay in the mailbox for its next session
+    if (ctx->config.relayDrainRate > 0) {
+        box->tokens += (double) (now - box->refilledAt) * ctx->config.relayDrainRate / 1000;
+        if (box->tokens > ctx->config.sendWindow)
+            box->tokens = ctx->config.sendWindow;
+        box->refilledAt = now;
+    }
+    for (c = 0; c < COMM_PRIORITY_CLASSES; c++) {
+        while (box->sendCursor[c] != NULL && session->waiting[c] < RELAY_QUEUE) {
+            storedMessage *stored = box->sendCursor[c];
+            if (stored->acked || stored->entry != NULL) {
+                box->sendCursor[c] = stored->classNext;
+                continue;
+            }
+            if (stored->deadline != 0 && stored->deadline <= wallNow) {
+                stored->acked = 1;  //expired - dropped by trimMailbox once it reaches the head of the queue
+                box->sendCursor[c] = stored->classNext;
+                continue;
+            }
+            if (stored->backlog && ctx->config.relayDrainRate > 0) {
+                if (box->tokens < 1) {
+                    staleDeadline(ctx, session);    //draining resumes with the next token
+                    break;
+                }
+                box->tokens -= 1;
+            }
+            memset(&message, 0, sizeof(message));
+            message.data = stored->data;
+            message.length = stored->length;
+            message.channel = stored->channel;
+            message.priority = stored->priority;
+            message.ttlMs = stored->deadline != 0 ? (int) (stored->deadline - wallNow) : 0;
+            if ((entry = queueMessage(ctx, session, &message)) == NULL)
+                return;
+            staleDeadline(ctx, session);    //TTL of the relayed message
+            entry->internal = 1;
+            entry->stored = stored;
+            entry->trailer.flags = MSG_RELAYED;
+            entry->trailer.sequence = stored->sequence;
+            entry->trailer.id = stored->id;
+            entry->trailer.timestamp = stored->timestamp;
+            entry->trailer.senderAddress = stored->origin.sin_addr.s_addr;
+            entry->trailer.senderPort = stored->origin.sin_port;
+            if (stored->sender != NULL)
+                memcpy(entry->trailer.name, stored->sender->name, COMM_NAME_MAX);
+            stored->entry = entry;
+            box->sendCursor[c] = stored->classNext;
+        }
+    }
+}
+
+/**
+ * Hands over the complete message - reports it (and stores it for its recipient) or answers the history request,
+ * duplicate of an already delivered message is dropped
+ */
+static void deliverMessage(commContext *ctx, commSession *session, reassembly *r) {
+    commEvent event;
+
+    if (r->duplicate || ((r->trailer.flags & MSG_HISTORY_REQUEST) && ctx->isServer)) {
+        if (!r->duplicate)
+            startHistory(ctx, session, r);
+        arenaFree(ctx->arena, r->buffer);
+        arenaFree(ctx->arena, r);
+        return;
+    }
+    memset(&event, 0, sizeof(event));
+    event.type = COMM_EVENT_MESSAGE;
+    event.peer = session->addr;
+    event.origin = session->addr;
+    event.messageId = r->messageId;
+    event.id = r->trailer.id;
+    event.sequence = r->sequence;
+    event.timestamp = r->timestamp;
+    event.channel = r->trailer.channel;
+    event.priority = (commPriority) r->trailer.priority;
+    event.data = r->buffer;
+    event.length = r->length;
+    if (ctx->isServer) {
+        if (session->mailbox != NULL)
+            memcpy(event.sender, session->mailbox->name, COMM_NAME_MAX);
+        memcpy(event.recipient, r->trailer.name, COMM_NAME_MAX);
+        if (r->recipient != NULL)
+            storeMessage(ctx, session, r);
+    } else if (r->trailer.flags & (MSG_HISTORY | MSG_HISTORY_END | MSG_RELAYED)) {
+        memcpy(event.sender, r->trailer.name, COMM_NAME_MAX);
+        event.sequence = r->trailer.sequence;
+        event.timestamp = r->trailer.timestamp;
+        event.origin.sin_addr.s_addr = r->trailer.senderAddress;
+        event.origin.sin_port = r->trailer.senderPort;
+    }
+    if (r->trailer.flags & (MSG_HISTORY | MSG_HISTORY_END)) {
+        event.type = r->trailer.flags & MSG_HISTORY ? COMM_EVENT_HISTORY : COMM_EVENT_HISTORY_END;
+        event.requestId = r->trailer.requestId;
+    }
+    queueEvent(ctx, &event, NULL, r->buffer);   //buffer is handed over to the event
+    arenaFree(ctx->arena, r);
+}
+
+/**
+ * Delivers the complete messages in the order of their ids, skips the messages abandoned by the sender
+ * @param firstPending Lowest messageId not completed by the sender
+ */
+static void deliverMessages(commContext *ctx, commSession *session, unsigned int firstPending) {
+    for (;;) {
+        reassembly *r = session->partial[session->nextDeliver % MAX_OPEN_MESSAGES];
+        if (r != NULL && r->messageId == session->nextDeliver && r->ended) {
+            bitSet(session->delivered, (int) (session->nextDeliver % DEDUP_WINDOW));
+            deliverMessage(ctx, session, r);
+        } else if (idBefore(session->nextDeliver, firstPending)) {
+            bitClear(session->delivered, (int) (session->nextDeliver % DEDUP_WINDOW));
+            if (r != NULL) {
+                arenaFree(ctx->arena, r->buffer);
+                arenaFree(ctx->arena, r);
+            }
+        } else {
+            break;
+        }
+        session->partial[session->nextDeliver % MAX_OPEN_MESSAGES] = NULL;
+        session->nextDeliver++;
+    }
+}
+
+/**
+ * @return reassembly state of the message, newly created if create is set, NULL if it cannot be received now
+ */
+static reassembly *findReassembly(commContext *ctx, commSession *session, const customPktHeader *packet) {
+    reassembly **slot = &session->partial[packet->messageId % MAX_OPEN_MESSAGES];
+    if ((*slot) != NULL)
+        return (*slot)->messageId == packet->messageId ? *slot : NULL;
+    if (packet->packetCount < 0 || packet->packetCount > MAX_FRAGMENTS)
+        return NULL;
+    if ((*slot = arenaCalloc(ctx->arena, 1, sizeof(reassembly))) == NULL)
+        return NULL;
+    //buffer of a single-fragment message right away, the others wait for a fragment which is not the last one
+    if (packet->packetCount == 1 && ((*slot)->buffer = arenaAlloc(ctx->arena, COMM_FRAG_MAX)) == NULL) {
+        arenaFree(ctx->arena, *slot);
+        *slot = NULL;
+        return NULL;
+    }
+    (*slot)->fragSize = packet->packetCount == 1 ? COMM_FRAG_MAX : 0;
+    (*slot)->messageId = packet->messageId;
+    (*slot)->packetCount = packet->packetCount;
+    return *slot;
+}
+
+/**
+ * Acknowledges the END packet - right away, or after the next group commit of the message log
+ */
+static void acknowledgeEnd(commContext *ctx, commSession *session, const customPktHeader *packet) {
+    if (ctx->log == NULL || ctx->config.logDurability != COMM_DURABILITY_BATCH) {
+        sendAck(ctx, &session->addr, packet->messageId, packet->packetNumber, ctx->rxStampNs, session->marked);
+        return;
+    }
+    if (ctx->deferredCount == ctx->deferredCapacity) {
+        int capacity = ctx->deferredCapacity ? ctx->deferredCapacity * 2 : MAX_RECV_BATCH;
+        deferredAck *resized = realloc(ctx->deferred, capacity * sizeof(deferredAck));
+        if (resized == NULL)
+            return;     //no ACK - END will be sent again
+        ctx->deferred = resized;
+        ctx->deferredCapacity = capacity;
+    }
+    ctx->deferred[ctx->deferredCount].addr = session->addr;
+    ctx->deferred[ctx->deferredCount].messageId = packet->messageId;
+    ctx->deferred[ctx->deferredCount].packetNumber = packet->packetNumber;
+    ctx->deferred[ctx->deferredCount].receivedNs = ctx->rxStampNs;
+    ctx->deferred[ctx->deferredCount].marked = session->marked;
+    ctx->deferredCount++;
+}
+
+/**
+ * Syncs the messages appended to the log since the last commit and sends the ACKs which waited for it
+ */
+static void commitLog(commContext *ctx) {
+    int i;
+    if (ctx->log == NULL || ctx->config.logDurability != COMM_DURABILITY_BATCH)
+        return;
+    if (msgLogCommit(ctx->log) == 0) {
+        for (i = 0; i < ctx->deferredCount; i++)
+            sendAck(ctx, &ctx->deferred[i].addr, ctx->deferred[i].messageId, ctx->deferred[i].packetNumber,
+                    ctx->deferred[i].receivedNs, ctx->deferred[i].marked);  //ACK delay includes the sync
+    }
+    ctx->deferredCount = 0;     //if the commit failed, the senders will send the END packets again
+}
+
+/**
+ * Appends the complete message to the message log
+ * @return 0 on success or if logging is disabled, -1 on error
+ */
+static int logMessage(commContext *ctx, commSession *session, reassembly *r) {
+    logRecordHeader record;
+
+    if (ctx->log == NULL || r->length == 0 || (r->trailer.flags & MSG_HISTORY_REQUEST))
+        return 0;
+    memset(&record, 0, sizeof(record));
+    record.timestamp = r->timestamp;
+    record.senderAddress = session->addr.sin_addr.s_addr;
+    record.senderPort = session->addr.sin_port;
+    record.messageId = r->messageId;
+    record.id = r->trailer.id;
+    record.channel = r->trailer.channel;
+    record.priority = (unsigned short) r->trailer.priority;
+    record.deadline = r->trailer.ttlMs != 0 ? r->timestamp + r->trailer.ttlMs : 0;
+    record.senderId = session->mailbox != NULL ? session->mailbox->logId : 0;
+    record.recipientId = r->recipient != NULL ? r->recipient->logId : 0;
+    if (msgLogAppend(ctx->log, &record, r->buffer, r->length) < 0)
+        return -1;
+    r->sequence = record.sequence;
+    if (ctx->config.logDurability == COMM_DURABILITY_MESSAGE)
+        return msgLogCommit(ctx->log);
+    return 0;
+}
+
+/**
+ * Refills the rate limiting token buckets of the client - the packet bucket holds RX_QUEUE packets or 100 ms of the
+ * packets (the more of them), the byte buckets hold one second of the bytes
+ */
+static void refillBuckets(commContext *ctx, commSession *session, long long now) {
+    double elapsed = session->refilledAt != 0 ? (double) (now - session->refilledAt) / 1000 : 1;
+    double burst = ctx->config.clientPacketRate / 10.0 > RX_QUEUE ? ctx->config.clientPacketRate / 10.0 : RX_QUEUE;
+    int c;
+
+    session->packetTokens += elapsed * ctx->config.clientPacketRate;
+    if (session->refilledAt == 0 || session->packetTokens > burst)
+        session->packetTokens = burst;
+    for (c = 0; c < COMM_PRIORITY_CLASSES; c++) {
+        session->byteTokens[c] += elapsed * ctx->config.clientByteRate[c];
+        if (session->refilledAt == 0 || session->byteTokens[c] > ctx->config.clientByteRate[c])
+            session->byteTokens[c] = ctx->config.clientByteRate[c];
+    }
+    session->refilledAt = now;
+}
+
+/**
+ * Charges the complete message to the byte rate limit of its class - a message is accepted while the bucket is not
+ * empty (the bucket can go into debt, so a message longer than the bucket is accepted too)
+ * @return non-zero if the message is accepted
+ */
+static int acceptMessage(commContext *ctx, commSession *session, const messageTrailer *trailer) {
+    if (!ctx->isServer || ctx->config.clientByteRate[trailer->priority] <= 0)
+        return 1;
+    refillBuckets(ctx, session, nowMs());
+    if (session->byteTokens[trailer->priority] <= 0) {
+        ctx->stats.rateDrops++;
+        return 0;
+    }
+    session->byteTokens[trailer->priority] -= trailer->length;
+    return 1;
+}
+
+/**
+ * Handles a message fragment or message-end flag - verifies and stores it and replies accordingly
+ */
+static void handleData(commContext *ctx, commSession *session, const customPktHeader *packet, size_t payload) {
+    reassembly *r;
+    messageTrailer trailer;
+
+    if (idBefore(packet->messageId, session->nextDeliver)) {
+        //message already delivered - ACK was lost, message skipped in the bitmap window was never delivered
+        if (session->nextDeliver - packet->messageId <= DEDUP_WINDOW &&
+            !bitTest(session->delivered, (int) (packet->messageId % DEDUP_WINDOW)))
+            sendControl(ctx, &session->addr, PKT_ERROR, packet->messageId, packet->packetNumber);
+        else
+            sendAck(ctx, &session->addr, packet->messageId, packet->packetNumber, ctx->rxStampNs, session->marked);
+        return;
+    }
+    if (packet->messageId - session->nextDeliver >= MAX_OPEN_MESSAGES || (r = findReassembly(ctx, session, packet)) == NULL)
+        return;     //message cannot be placed now - no ACK, it will be sent again
+    if (packet->packetCount != r->packetCount || packet->packetNumber > r->packetCount + 1) {
+        sendControl(ctx, &session->addr, PKT_ERROR, packet->messageId, packet->packetNumber);
+        return;
+    }
+
+    if ((packet->type & PKT_TYPE_MASK) == PKT_DATA) {
+        int index = packet->packetNumber - 1;
+        if (index < r->packetCount - 1 && r->buffer == NULL && payload > 0 && payload <= COMM_FRAG_MAX) {
+            //fragments other than the last one have the size chosen by the sender for the whole message
+            if ((r->buffer = arenaAlloc(ctx->arena, (size_t) r->packetCount * payload)) == NULL)
+                return;     //no ACK, the fragment is sent again
+            r->fragSize = payload;
+        }
+        if (index >= r->packetCount || payload > COMM_FRAG_MAX || (r->buffer != NULL && payload > r->fragSize) ||
+            (index < r->packetCount - 1 && payload != r->fragSize)) {
+            sendControl(ctx, &session->addr, PKT_ERROR, packet->messageId, packet->packetNumber);
+            return;
+        }
+        if (r->buffer == NULL)
+            return;     //last fragment came first - its place is not known yet, it is sent again
+        if (!bitTest(r->received, index)) {
+            memcpy(r->buffer + (size_t) index * r->fragSize, packet->message, payload);
+            bitSet(r->received, index);
+            r->receivedCount++;
+            r->length += payload;
+        }
+        sendAck(ctx, &session->addr, packet->messageId, packet->packetNumber, ctx->rxStampNs,
+                session->marked);  //sends ACK
+        return;
+    }
+
+    if (payload < sizeof(trailer) || packet->packetNumber != r->packetCount + 1)
+        return;
+    if (r->ended) {     //message is waiting for the delivery of the previous ones - ACK was lost
+        acknowledgeEnd(ctx, session, packet);
+        return;
+    }
+    memcpy(&trailer, packet->message, sizeof(trailer));
+    trailer.name[COMM_NAME_MAX - 1] = '\0';
+    if (trailer.priority >= COMM_PRIORITY_CLASSES)
+        trailer.priority = COMM_PRIORITY_NORMAL;
+    if (!acceptMessage(ctx, session, &trailer))
+        return;     //client is over its rate limit - END is not acknowledged, the client sends it again later
+    r->trailer = trailer;
+    r->timestamp = wallClockMs();
+    if (ctx->isServer && trailer.name[0] != '\0' && !(trailer.flags & MSG_HISTORY_REQUEST))
+        r->recipient = findMailbox(ctx, trailer.name, 1);
+    //message with a known id was already delivered (before a reconnect, or relayed again) - it is only acknowledged
+    r->duplicate = trailer.id != 0 && ctx->dedup != NULL && dedupContains(ctx->dedup, trailer.id, nowMs());
+    if (r->receivedCount != r->packetCount || r->length != trailer.length ||
+        (!r->duplicate && logMessage(ctx, session, r) < 0)) {
+        sendControl(ctx, &session->addr, PKT_ERROR, packet->messageId, packet->packetNumber);
+        return;
+    }
+    if (!r->duplicate && trailer.id != 0 && ctx->dedup != NULL)
+        dedupInsert(ctx->dedup, trailer.id, nowMs());
+    //message is complete - END is acknowledged once it is logged, the message waits only for the delivery of the
+    //previous ones
+    r->ended = 1;
+    acknowledgeEnd(ctx, session, packet);
+    deliverMessages(ctx, session, trailer.firstPending);
+}
+
+/**
+ * Verifies the checksum of the packet, or its authentication tag (an AEAD packet is decrypted in place) - the client
+ * derives the key of the session from the ACK of its connection init first
+ * @param n Size of the packet including the trailer
+ * @return 1 if the packet is valid, 0 otherwise
+ */
+static int validPacket(commContext *ctx, customPktHeader *packet, size_t n, const struct sockaddr_in *addr) {
+    commSession *session = &ctx->sessions[0];
+    unsigned char key[AEAD_KEY_SIZE], nonce[AEAD_NONCE_SIZE], type = packet->type & PKT_TYPE_MASK;
+    const unsigned char *packetKey;
+    unsigned long long tag, serverNonce;
+    size_t size = n - ctx->tagSize, clear = 0;
+    aeadPacket sealed;
+    int valid;
+
+    if (ctx->tagSize == 0)
+        return packet->crcChecksum == packetChecksum(packet, n);
+    if (n < HEADER_SIZE + ctx->tagSize)
+        return 0;
+    packetKey = peerKey(ctx, addr, type);
+    if (!ctx->isServer && !session->keyed && type == PKT_ACK && packet->messageId == session->initId &&
+        size >= HEADER_SIZE + sizeof(unsigned int) + sizeof(serverNonce)) {
+        //nonce of the server follows the ACK delay in the clear
+        memcpy(&serverNonce, packet->message + sizeof(unsigned int), sizeof(serverNonce));
+        deriveKey(ctx, ctx->initNonce, serverNonce, key, sizeof(key));
+        packetKey = key;
+        clear = size - HEADER_SIZE;
+    }
+    if (ctx->config.integrity == COMM_INTEGRITY_AEAD) {
+        describeSealed((unsigned char *) packet, n, clear, !ctx->isServer, &sealed, nonce);
+        valid = (int) aeadOpenBatch(packetKey, &sealed, 1);
+    } else {
+        memcpy(&tag, (const char *) packet + size, sizeof(tag));
+        valid = packetTag(packetKey, packet, size) == tag;
+    }
+    if (!valid) {
+        ctx->stats.authFailures++;
+        return 0;
+    }
+    if (packetKey == key) {
+        memcpy(session->key, key, sizeof(key));
+        session->keyed = 1;
+    }
+    return 1;
+}
+
+/**
+ * Starts the linger of the session once both directions are closed
+ */
+static void closedBoth(commContext *ctx, commSession *session) {
+    if (!session->closeAcked || !session->peerClosed || session->lingerUntil != 0)
+        return;
+    session->peerCloseBy = 0;
+    session->lingerUntil = nowMs() + CLOSE_LINGER * backoffTimeout(ctx, session, 16);
+    staleDeadline(ctx, session);
+}
+
+/**
+ * @return time the peer gets to close its direction after it acknowledged our close frame, counted from its last
+ *  packet - as long as it would retransmit a packet before it gives up
+ */
+static long long peerCloseWait(commContext *ctx, const commSession *session) {
+    return (long long) (ctx->config.maxRetransmits + 1) * backoffTimeout(ctx, session, 16);
+}
+
+/**
+ * Releases the closed session after its linger - the server frees its state, the client stops accepting messages
+ */
+static void releaseClosed(commContext *ctx, commSession *session) {
+    commEvent event;
+    memset(&event, 0, sizeof(event));
+    event.type = COMM_EVENT_CLOSED;
+    event.peer = session->addr;
+    queueEvent(ctx, &event, NULL, NULL);
+    session->lingerUntil = 0;
+    session->peerCloseBy = 0;
+    if (ctx->isServer) {
+        deliverMessages(ctx, session, session->nextDeliver + MAX_OPEN_MESSAGES);
+        resetSession(ctx, session);
+    } else {
+        ctx->connected = -1;
+    }
+}
+
+/**
+ * Sends the close frame when the last message of the closing session is acknowledged, sends it again after the
+ * retransmission timeout and releases the session after its linger; a peer which does not acknowledge the close
+ * frame after maxRetransmits attempts, or which is silent for as long without closing its own direction after it
+ * acknowledged ours, is considered gone
+ */
+static void closeTimers(commContext *ctx, commSession *session, long long now) {
+    if (session->lingerUntil != 0) {
+        if (session->lingerUntil <= now)
+            releaseClosed(ctx, session);
+        return;
+    }
+    if (session->peerCloseBy != 0) {
+        if (session->peerCloseBy <= now)
+            releaseClosed(ctx, session);
+        return;
+    }
+    if (!closePending(ctx, session) ||
+        (session->closeAttempts > 0 &&
+         now - session->closeSentAt < backoffTimeout(ctx, session, session->closeAttempts - 1)))
+        return;
+    if (session->closeAttempts++ > ctx->config.maxRetransmits) {
+        releaseClosed(ctx, session);
+        return;
+    }
+    session->closeSentAt = now;
+    session->closeId = session->nextMessageId;
+    sendControl(ctx, &session->addr, PKT_CLOSE, session->closeId, CLOSE_NUMBER);
+}
+
+/**
+ * @return 1 if the datagram is the authenticated end of the session of the peer (trailer of an empty packet),
+ * 0 otherwise
+ */
+static int authenticClose(commContext *ctx, customPktHeader *packet, const struct sockaddr_in *addr) {
+    commSession *session = findSession(ctx, addr, 0);
+    unsigned char nonce[AEAD_NONCE_SIZE];
+    unsigned long long tag;
+    aeadPacket sealed;
+
+    if (session == NULL || !session->keyed)
+        return 0;
+    if (ctx->config.integrity == COMM_INTEGRITY_AEAD) {
+        describeClose((unsigned char *) packet, &sealed, nonce);
+        return (int) aeadOpenBatch(session->key, &sealed, 1);
+    }
+    memcpy(&tag, packet, sizeof(tag));
+    return sipHash(session->key, (const unsigned char *) "", 0) == tag;
+}
+
+/**
+ * Handles the received packet - verifies its checksum and passes it to the sending or receiving part of the session
+ */
+static void handlePacket(commContext *ctx, customPktHeader *packet, ssize_t n, const struct sockaddr_in *addr) {
+    commSession *session;
+    commEvent event;
+    unsigned char type;
+    size_t offset = 0;
+
+    if (n == (ssize_t) ctx->tagSize && (n == 0 || authenticClose(ctx, packet, addr))) {
+        //peer ended the communication - complete messages waiting for an abandoned one are delivered
+        if (ctx->isServer && (session = findSession(ctx, addr, 0)) != NULL) {
+            deliverMessages(ctx, session, session->nextDeliver + MAX_OPEN_MESSAGES);
+            resetSession(ctx, session);
+        }
+        memset(&event, 0, sizeof(event));
+        event.type = COMM_EVENT_CLOSED;
+        event.peer = *addr;
+        queueEvent(ctx, &event, NULL, NULL);
+        return;
+    }
+    if (n < (ssize_t) HEADER_SIZE || packet->packetNumber <= 0)
+        return;
+    type = packet->type & PKT_TYPE_MASK;
+    if (!ctx->rxVerified && !validPacket(ctx, packet, (size_t) n, addr)) {
+        if (type == PKT_DATA && (session = findSession(ctx, addr, 0)) != NULL)
+            sendControl(ctx, addr, PKT_RESEND, packet->messageId, packet->packetNumber);  //resend request
+        return;
+    }
+    n -= (ssize_t) ctx->tagSize;
+    if (type == PKT_INIT && ctx->tagSize > 0 && (size_t) n < HEADER_SIZE + sizeof(unsigned long long))
+        return;     //authenticated init has to carry the nonce of the client
+    if ((session = findSession(ctx, addr, type == PKT_INIT)) == NULL)
+        return;
+    ctx->sessionSeen[session - ctx->sessions] = nowMs();
+    staleDeadline(ctx, session);    //acknowledgements, busy replies and RTT samples change the timers
+    if (session->peerCloseBy != 0)
+        session->peerCloseBy = nowMs() + peerCloseWait(ctx, session);  //peer is still sending before its close
+
+    switch (type) {
+        case PKT_INIT:  //if server receives initialization packet, (re)starts the session and replies with ACK
+            if (ctx->isServer && (!session->initialized || session->initId != packet->messageId)) {
+                //new client on the address - the state of the previous one is released
+                deliverMessages(ctx, session, session->nextDeliver + MAX_OPEN_MESSAGES);
+                resetSession(ctx, session);
+                claimSession(ctx, session, addr);
+                session->initialized = 1;
+                session->initId = packet->messageId;
+                session->nextDeliver = packet->messageId;
+                session->nextMessageId = packet->messageId;    //messages to the client are numbered from the same id
+                if (ctx->tagSize > 0) {     //key of the session from the nonces of both sides
+                    unsigned long long clientNonce;
+                    memcpy(&clientNonce, packet->message, sizeof(clientNonce));
+                    session->nonce = randomNonce();
+                    deriveKey(ctx, clientNonce, session->nonce, session->key, sizeof(session->key));
+                    session->keyed = 1;
+                    offset = sizeof(clientNonce);
+                }
+                if ((size_t) n > HEADER_SIZE + offset && (size_t) n - HEADER_SIZE - offset < COMM_NAME_MAX) {
+                    char name[COMM_NAME_MAX] = { 0 };
+                    memcpy(name, packet->message + offset, (size_t) n - HEADER_SIZE - offset);
+                    if (name[0] != '\0')
+                        attachMailbox(ctx, session, name);
+                }
+            }
+            sendInitAck(ctx, session, packet);
+            break;
+        case PKT_CLOSE:
+            sendControl(ctx, addr, PKT_ACK, packet->messageId, packet->packetNumber);  //also a repeated one
+            if (session->peerClosed)
+                break;
+            session->peerClosed = 1;
+            if (ctx->isServer)
+                session->closing = 1;   //server closes its side once the messages queued for the client are sent
+            memset(&event, 0, sizeof(event));
+            event.type = COMM_EVENT_SHUTDOWN;
+            event.peer = *addr;
+            queueEvent(ctx, &event, NULL, NULL);
+            closedBoth(ctx, session);
+            break;
+        case PKT_ACK:
+            if (packet->packetNumber == CLOSE_NUMBER) {
+                if (session->closeAttempts > 0 && !session->closeAcked && packet->messageId == session->closeId) {
+                    session->closeAcked = 1;
+                    if (!session->peerClosed)
+                        session->peerCloseBy = nowMs() + peerCloseWait(ctx, session);
+                    closedBoth(ctx, session);
+                }
+                break;
+            }
+            if (!ctx->isServer && ctx->connected == 0 && packet->messageId == session->initId) {
+                //program has received response from the server, thus the connection is established
+                ctx->connected = 1;
+                memset(&event, 0, sizeof(event));
+                event.type = COMM_EVENT_CONNECTED;
+                event.peer = *addr;
+                queueEvent(ctx, &event, NULL, NULL);
+                break;
+            }
+            handleReply(ctx, session, packet, (size_t) n - HEADER_SIZE);
+            break;
+        case PKT_BUSY:
+            if (!ctx->isServer && ctx->connected == 0 && packet->messageId == session->initId) {
+                //server refuses new clients for now - init is sent again after the back-off, attempts are not counted
+                if (ctx->initBackoff == 0) {
+                    memset(&event, 0, sizeof(event));
+                    event.type = COMM_EVENT_BUSY;
+                    event.peer = *addr;
+                    queueEvent(ctx, &event, NULL, NULL);
+                }
+                ctx->initBackoff = ctx->initBackoff == 0 ? ctx->config.retransmitTimeoutMs : ctx->initBackoff * 2;
+                if (ctx->initBackoff > BUSY_BACKOFF_MAX * ctx->config.retransmitTimeoutMs)
+                    ctx->initBackoff = BUSY_BACKOFF_MAX * ctx->config.retransmitTimeoutMs;
+                ctx->initAttempts = 0;
+                ctx->initSentAt = nowMs() + ctx->initBackoff - ctx->config.retransmitTimeoutMs;
+                break;
+            }
+            handleReply(ctx, session, packet, (size_t) n - HEADER_SIZE);
+            break;
+        case PKT_RESEND:
+        case PKT_ERROR:
+            handleReply(ctx, session, packet, (size_t) n - HEADER_SIZE);
+            break;
+        case PKT_DATA:
+        case PKT_END:
+            if (ctx->rxMarked) {
+                session->marked++;
+                ctx->stats.ceReceived++;
+            }
+            handleData(ctx, session, packet, (size_t) n - HEADER_SIZE);
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * Queues the packet received by the server for processing in the receive queue of its client - packets above the
+ * packet rate limit of the client or above its queue capacity are dropped (the client sends them again), so a client
+ * flooding the server loses its own packets rather than the packets of the others
+ * Overloaded server answers the connection init of a new client and the messages of the shed priority classes with
+ * a busy reply instead. Packets of unknown peers (connection init) are handled right away
+ */
+static void queueReceived(commContext *ctx, customPktHeader *packet, ssize_t n, const struct sockaddr_in *addr,
+                          long long now) {
+    commSession *session = findSession(ctx, addr, 0);
+    unsigned char type = packet->type & PKT_TYPE_MASK;
+    int priority = packet->type >> PKT_PRIORITY_SHIFT;
+    rxQueue *queue;
+    rxPacket *slot;
+
+    if (ctx->overload > 0 && n >= (ssize_t) HEADER_SIZE &&
+        ((type == PKT_INIT && (session == NULL || !session->initialized || session->initId != packet->messageId)) ||
+         ((type == PKT_DATA || type == PKT_END) &&
+          (priority == COMM_PRIORITY_BULK || (priority == COMM_PRIORITY_NORMAL && ctx->overload > 1))))) {
+        sendControl(ctx, addr, PKT_BUSY, packet->messageId, packet->packetNumber);
+        ctx->stats.shedPackets++;
+        return;
+    }
+    if (session == NULL) {
+        handlePacket(ctx, packet, n, addr);
+        return;
+    }
+    if (n > 0 && ctx->config.clientPacketRate > 0) {
+        refillBuckets(ctx, session, now);
+        if (session->packetTokens < 1) {
+            ctx->stats.rateDrops++;
+            return;
+        }
+        session->packetTokens -= 1;
+    }
+    queue = &ctx->rxQueues[session - ctx->sessions];
+    if (queue->packets == NULL && (queue->packets = arenaAlloc(ctx->arena, RX_QUEUE * sizeof(rxPacket))) == NULL) {
+        handlePacket(ctx, packet, n, addr);
+        return;
+    }
+    if (queue->count == RX_QUEUE) {
+        ctx->stats.queueDrops++;
+        return;
+    }
+    slot = &queue->packets[(queue->head + queue->count) % RX_QUEUE];
+    memcpy(&slot->packet, packet, (size_t) n);
+    slot->n = n;
+    slot->addr = *addr;
+    slot->receivedAt = now;
+    slot->receivedNs = ctx->rxStampNs;
+    slot->verified = ctx->rxVerified;
+    slot->marked = ctx->rxMarked;
+    if (queue->count++ == 0)
+        ctx->rxOldest[session - ctx->sessions] = now;
+    ctx->rxQueued++;
+}
+
+/**
+ * Processes the queued packets by deficit round robin - every client with queued packets gets RX_QUANTUM bytes per
+ * round until MAX_RECV_BATCH packets are processed, the rest waits for the next commPoll call
+ * (a packet is handled by its address, the session of the queue may have been replaced in the meantime)
+ */
+static void processReceived(commContext *ctx) {
+    int budget = MAX_RECV_BATCH, k;
+
+    while (budget > 0 && ctx->rxQueued > 0) {
+        for (k = 0; k < MAX_SESSIONS && budget > 0; k++) {
+            int i = (ctx->nextRx + k) % MAX_SESSIONS;
+            rxQueue *queue = &ctx->rxQueues[i];
+            if (ctx->rxOldest[i] == LLONG_MAX)
+                continue;   //queue is empty
+            queue->deficit += RX_QUANTUM;
+            while (queue->count > 0 && budget > 0 && queue->packets[queue->head].n <= queue->deficit) {
+                rxPacket *slot = &queue->packets[queue->head];
+                queue->deficit -= (int) slot->n;
+                queue->head = (queue->head + 1) % RX_QUEUE;
+                queue->count--;
+                ctx->rxQueued--;
+                budget--;
+                ctx->rxStampNs = slot->receivedNs;
+                ctx->rxVerified = slot->verified;
+                ctx->rxMarked = slot->marked;
+                handlePacket(ctx, &slot->packet, slot->n, &slot->addr);   //slot is not reused before the next read
+            }
+            if (queue->count == 0) {
+                queue->deficit = 0;
+                ctx->rxOldest[i] = LLONG_MAX;
+            } else {
+                ctx->rxOldest[i] = queue->packets[queue->head].receivedAt;
+            }
+        }
+    }
+    ctx->nextRx = (ctx->nextRx + 1) % MAX_SESSIONS;
+}
+
+/**
+ * Updates the overload level of the server from the datagrams dropped by the kernel, the number of the queued
+ * packets and the time the oldest of them waits - the level goes up right away and down by one after every
+ * OVERLOAD_HOLD_MS without the signs of the higher level
+ */
+static void updateOverload(commContext *ctx, long long now) {
+    long long oldest, waiting;
+    int level = 0;
+
+    if (ctx->config.overloadLatencyMs <= 0)
+        return;
+    oldest = scanMin(ctx->rxOldest, MAX_SESSIONS);
+    waiting = oldest != LLONG_MAX ? now - oldest : 0;
+    if (ctx->kernelDropped || ctx->rxQueued >= 2 * OVERLOAD_BACKLOG || waiting >= 2 * ctx->config.overloadLatencyMs)
+        level = 2;
+    else if (ctx->rxQueued >= OVERLOAD_BACKLOG || waiting >= ctx->config.overloadLatencyMs)
+        level = 1;
+    if (level >= ctx->overload) {
+        ctx->overload = level;
+        ctx->overloadedAt = now;
+    } else if (now - ctx->overloadedAt >= OVERLOAD_HOLD_MS) {
+        ctx->overload--;
+        ctx->overloadedAt = now;
+    }
+}
+
+/**
+ * Verifies the checksums (or the authentication tags) of the packets of the datagram in rxBuffer in one batch - the
+ * packets of one datagram come from one peer, so they share the key
+ * @param segment Size of the packets coalesced by UDP_GRO, 0 if the datagram is one packet
+ * @return bitmask with bit i set if packet i is valid (packets after the first CRC32_BATCH_MAX are not verified)
+ */
+static unsigned long long verifyDatagram(commContext *ctx, size_t n, size_t segment, const struct sockaddr_in *addr) {
+    const unsigned char *messages[CRC32_BATCH_MAX];
+    size_t lengths[CRC32_BATCH_MAX], offset, size;
+    unsigned long long sized = 0, valid = 0, tags[CRC32_BATCH_MAX], expectedTags[CRC32_BATCH_MAX];
+    unsigned int expected[CRC32_BATCH_MAX];
+    int count, i;
+
+    for (count = 0, offset = 0; count < CRC32_BATCH_MAX && offset < n; count++, offset += segment > 0 ? segment : n) {
+        size = segment > 0 && n - offset > segment ? segment : n - offset;
+        messages[count] = (const unsigned char *) ctx->rxBuffer + offset + sizeof(unsigned int);
+        lengths[count] = 0;
+        expected[count] = 0;
+        expectedTags[count] = 0;
+        if (size < HEADER_SIZE + ctx->tagSize || size > sizeof(customPktHeader))
+            continue;   //cannot be a valid packet - left to handlePacket
+        sized |= 1ULL << count;
+        memcpy(&expected[count], ctx->rxBuffer + offset, sizeof(unsigned int));
+        lengths[count] = size - sizeof(unsigned int) - ctx->tagSize;
+        if (ctx->tagSize > 0)
+            memcpy(&expectedTags[count], ctx->rxBuffer + offset + size - ctx->tagSize, sizeof(expectedTags[count]));
+    }
+    if (ctx->tagSize == 0)
+        return crc32Batch(messages, lengths, expected, count) & sized;
+    if (ctx->config.integrity == COMM_INTEGRITY_AEAD) {
+        //only the packets of a valid size are opened (decrypted in place), their bits are spread back
+        aeadPacket sealed[CRC32_BATCH_MAX];
+        unsigned char nonces[CRC32_BATCH_MAX][AEAD_NONCE_SIZE];
+        const unsigned char *keys[CRC32_BATCH_MAX], *key = peerKey(ctx, addr, PKT_DATA);
+        cryptoJob job = { keys, sealed, 0, 1, 0 };
+        unsigned long long opened;
+        int index[CRC32_BATCH_MAX], opens = 0;
+        for (i = 0, offset = 0; i < count; i++, offset += segment) {
+            if (!(sized >> i & 1))
+                continue;
+            size = segment > 0 && n - offset > segment ? segment : n - offset;
+            describeSealed((unsigned char *) ctx->rxBuffer + offset, size, 0, !ctx->isServer, &sealed[opens],
+                           nonces[opens]);
+            keys[opens] = key;
+            index[opens++] = i;
+        }
+        job.count = opens;
+        opened = runCrypto(ctx, &job);
+        for (i = 0; i < opens; i++)
+            valid |= (opened >> i & 1) << index[i];
+        return valid;
+    }
+    //packets under another key (connection init, the first ACK of the client) fail here and are verified one by one
+    sipHashBatch(peerKey(ctx, addr, PKT_DATA), messages, lengths, tags, count);
+    for (i = 0; i < count; i++)
+        valid |= (unsigned long long) (tags[i] == expectedTags[i]) << i;
+    return valid & sized;
+}
+
+/**
+ * Receives one datagram into rxBuffer, the server also reads the counter of the datagrams dropped by the kernel
+ * @param segment Filled with the size of the packets coalesced by UDP_GRO, 0 if the datagram is one packet
+ * @return size of the datagram, -1 on error
+ */
+static ssize_t receiveDatagram(commContext *ctx, struct sockaddr_in *addr, size_t *segment) {
+    char control[CMSG_SPACE(sizeof(unsigned int)) + CMSG_SPACE(sizeof(int)) +
+                 CMSG_SPACE(sizeof(struct scm_timestamping)) + CMSG_SPACE(sizeof(int))];
+    struct iovec iov;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    ssize_t n;
+
+    *segment = 0;
+    iov.iov_base = ctx->rxBuffer;
+    iov.iov_len = sizeof(ctx->rxBuffer);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = addr;
+    msg.msg_namelen = sizeof(*addr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if ((n = recvmsg(ctx->sockfd, &msg, 0)) < 0)
+        return -1;
+    ctx->rxStampNs = wallClockNs();     //replaced by the kernel timestamp if there is one
+    ctx->rxMarked = 0;
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+            unsigned int drops;
+            memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+            ctx->kernelDropped += drops - ctx->kernelDrops;     //counter wraps around
+            ctx->stats.kernelDrops += drops - ctx->kernelDrops;
+            ctx->kernelDrops = drops;
+        } else if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+            int size;
+            memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+            *segment = (size_t) size;
+            ctx->stats.groReceives++;
+        } else if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+            struct scm_timestamping stamps;
+            memcpy(&stamps, CMSG_DATA(cmsg), sizeof(stamps));
+            if (stamps.ts[0].tv_sec != 0)
+                ctx->rxStampNs = (long long) stamps.ts[0].tv_sec * 1000000000 + stamps.ts[0].tv_nsec;
+        } else if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_TOS) {
+            //GRO coalesces only the datagrams with the same TOS, the mark applies to all of its packets
+            ctx->rxMarked = (*CMSG_DATA(cmsg) & IPTOS_ECN_MASK) == IPTOS_ECN_CE;
+        }
+    }
+    return n;
+}
+
+/**
+ * Queues the history and relay work of the clients and fills their send windows by deficit round robin - every
+ * session with packets to send gets SEND_QUANTUM packets per round until SEND_BUDGET packets are sent, so a client
+ * with a long relay or history queue does not delay the others; the rounds start at another session every call
+ */
+static void pumpSessions(commContext *ctx, long long now) {
+    int used[MAX_SESSIONS], budget = SEND_BUDGET, active = 1, count, start = 0, k;
+
+    //only the sessions in use are visited, in the order of the round starting at nextSend
+    count = scanAbove(ctx->sessionKeys, MAX_SESSIONS, 0, used);
+    while (start < count && used[start] < ctx->nextSend)
+        start++;
+    for (k = 0; k < count; k++) {
+        commSession *session = &ctx->sessions[used[(start + k) % count]];
+        historyPump(ctx, session);
+        relayPump(ctx, session, now);
+    }
+    while (budget > 0 && active) {
+        active = 0;
+        for (k = 0; k < count && budget > 0; k++) {
+            int i = used[(start + k) % count], allowance, sent;
+            commSession *session = &ctx->sessions[i];
+            if (ctx->sessionQueued[i] == 0) {
+                session->sendDeficit = 0;
+                continue;
+            }
+            session->sendDeficit += SEND_QUANTUM;
+            allowance = session->sendDeficit < budget ? session->sendDeficit : budget;
+            sent = sessionPump(ctx, session, allowance);
+            budget -= sent;
+            if (sent < allowance) {     //window is full or nothing more to send - the deficit is not kept
+                session->sendDeficit = 0;
+            } else {
+                session->sendDeficit -= sent;
+                active = 1;
+            }
+        }
+    }
+    ctx->sendBacklog = budget == 0;
+    ctx->nextSend = (ctx->nextSend + 1) % MAX_SESSIONS;
+}
+
+/**
+ * @return time in milliseconds until the nearest timer expires, -1 if no timer is running
+ */
+static int nextTimerMs(commContext *ctx, long long now) {
+    long long nearest, remaining;
+
+    updateStaleDeadlines(ctx, now);
+    nearest = scanMin(ctx->sessionDeadlines, MAX_SESSIONS);
+    if (!ctx->isServer && ctx->connected == 0 && ctx->initSentAt + ctx->config.retransmitTimeoutMs < nearest)
+        nearest = ctx->initSentAt + ctx->config.retransmitTimeoutMs;
+    if (ctx->overload > 0 && ctx->overloadedAt + OVERLOAD_HOLD_MS < nearest)
+        nearest = ctx->overloadedAt + OVERLOAD_HOLD_MS;     //overload level goes down
+    if (nearest == LLONG_MAX)
+        return -1;
+    remaining = nearest - now;
+    if (remaining > INT_MAX)
+        remaining = INT_MAX;
+    return remaining > 0 ? (int) remaining : 0;
+}
+
+int commShutdown(commContext *ctx, const struct sockaddr_in *peer) {
+    commSession *session = ctx->isServer ? (peer != NULL ? findSession(ctx, peer, 0) : NULL) : &ctx->sessions[0];
+    if (session == NULL || (!ctx->isServer && ctx->connected <= 0)) {
+        errno = ENOTCONN;
+        return -1;
+    }
+    session->closing = 1;
+    staleDeadline(ctx, session);    //close frame follows the last message
+    return 0;
+}
+
+int commPoll(commContext *ctx, commEvent *events, int maxEvents, int timeoutMs) {
+    customPktHeader packet;
+    struct sockaddr_in addr;
+    struct pollfd pfd;
+    ssize_t n;
+    size_t segment, offset, size;
+    int i, k, count, kept, wait, timer, ready, due[MAX_SESSIONS];
+    unsigned long long valid;
+    long long now;
+
+    for (i = 0; i < ctx->retiredCount; i++)
+        arenaFree(ctx->arena, ctx->retired[i]);
+    ctx->retiredCount = 0;
+
+    ctx->batching = 1;
+    if (ctx->connected > 0)
+        sessionPump(ctx, &ctx->sessions[0], ctx->config.sendWindow);
+    flushPackets(ctx);
+
+    //wait for a packet, but not longer than until the nearest retransmission (not at all if some work is left)
+    wait = ctx->pendingCount > 0 || ctx->rxQueued > 0 || ctx->sendBacklog ? 0 : timeoutMs;
+    timer = nextTimerMs(ctx, nowMs());
+    if (timer >= 0 && (wait < 0 || timer < wait))
+        wait = timer;
+    pfd.fd = ctx->sockfd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    ready = wait != 0 && ctx->config.busyPollUs > 0 ? spinPoll(ctx, &pfd, wait) : 0;
+    if (!ready && poll(&pfd, 1, wait) < 0 && errno != EINTR) {
+        ctx->batching = 0;
+        return -1;
+    }
+    if (pfd.revents & POLLERR)
+        readErrorQueue(ctx);    //TX timestamps and zero-copy completions, read before the ACKs they are matched with
+
+    //server reads ahead into the receive queues of the clients and processes them fairly
+    now = nowMs();
+    for (i = 0; i < (ctx->isServer ? RX_READ_BATCH : MAX_RECV_BATCH); i++) {
+        n = receiveDatagram(ctx, &addr, &segment);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || errno == ECONNREFUSED)
+                break;
+            flushPackets(ctx);
+            ctx->batching = 0;
+            return -1;
+        }
+        //datagram coalesced by GRO is split into its packets (an empty datagram is handled once)
+        ctx->idleSpins = 0;     //traffic again - busy polling resumes
+        valid = n > 0 ? verifyDatagram(ctx, (size_t) n, segment, &addr) : 0;
+        offset = 0;
+        k = 0;
+        do {
+            size = segment > 0 && (size_t) n - offset > segment ? segment : (size_t) n - offset;
+            memcpy(&packet, ctx->rxBuffer + offset, size < sizeof(packet) ? size : sizeof(packet));
+            if (size > sizeof(packet))
+                size = sizeof(packet);  //too long to be a packet - truncated, the checksum fails
+            ctx->rxVerified = k < CRC32_BATCH_MAX && (valid >> k & 1);     //invalid ones are checked again
+            k++;
+            if (ctx->isServer)
+                queueReceived(ctx, &packet, (ssize_t) size, &addr, now);
+            else
+                handlePacket(ctx, &packet, (ssize_t) size, &addr);
+            offset += segment > 0 ? segment : (size_t) n;
+        } while (offset < (size_t) n);
+    }
+    processReceived(ctx);
+    if (ctx->isServer) {
+        updateOverload(ctx, now);
+        tuneBuffers(ctx);   //more clients or kernel drops - bigger receive buffer
+        ctx->kernelDropped = 0;
+    }
+    commitLog(ctx);     //group commit of the messages received in this batch
+
+    now = nowMs();
+    clientTimers(ctx, now);
+    //only the sessions whose deadline passed are visited
+    updateStaleDeadlines(ctx, now);
+    count = scanDue(ctx->sessionDeadlines, MAX_SESSIONS, now, due);
+    for (i = 0; i < count; i++) {
+        sessionTimers(ctx, &ctx->sessions[due[i]], now);
+        closeTimers(ctx, &ctx->sessions[due[i]], now);
+        updateDeadline(ctx, &ctx->sessions[due[i]], now);
+    }
+    if (ctx->isServer)
+        pumpSessions(ctx, now);
+    else if (ctx->connected > 0)
+        sessionPump(ctx, &ctx->sessions[0], ctx->config.sendWindow);
+    flushPackets(ctx);
+    ctx->batching = 0;
+
+    //completion callbacks are called in one batch, the other events are handed out to the application,
+    //library buffers are released at the next commPoll call
+    count = 0;
+    kept = 0;
+    for (i = 0; i < ctx->pendingCount; i++) {
+        pendingEvent *p = &ctx->pending[i];
+        if (p->callback != NULL) {
+            p->callback(ctx, &p->event);
+        } else if (count < maxEvents) {
+            events[count++] = p->event;
+            if (p->owned != NULL)
+                retireBuffer(ctx, p->owned);
+        } else {
+            ctx->pending[kept++] = *p;  //no room - event stays pending
+        }
+    }
+    ctx->pendingCount = kept;
+    return count;
+}
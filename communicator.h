@@ -0,0 +1,451 @@
+#ifndef COMMUNICATOR_H
+#define COMMUNICATOR_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <netinet/in.h>
+
+#define COMM_DEFAULT_PORT 8080      //port on which the server is initialized by default
+#define COMM_MAX_MESSAGE 100000     //maximum message length - 100.000 bytes
+#define COMM_FRAG_SIZE 512          //initial message fragment size of a session - safe UDP payload is <=512 bytes
+#define COMM_FRAG_MIN 256           //smallest fragment size chosen by the adaptive fragment sizing
+#define COMM_FRAG_MAX 1400          //largest fragment size - fits a 1500 B Ethernet frame with the headers and trailer
+#define COMM_ANY_CHANNEL 0xFFFFFFFFu    //history query: messages of all channels
+#define COMM_HISTORY_MAX 10000      //maximum number of messages returned for one history request
+#define COMM_NAME_MAX 32            //maximum length of a client name including the terminating zero
+#define COMM_PRIORITY_CLASSES 3     //number of the message priority classes
+#define COMM_LATENCY_BUCKETS 24     //buckets of the latency histograms (powers of two microseconds)
+
+/**
+ * @brief libcommunicator - protocol engine of the network communicator. It implements the reliable message transfer
+ * over UDP sockets (fragmentation, CRC verification, acknowledgements and retransmissions) behind a non-blocking API,
+ * so it can be embedded in any process. The interactive menu program is one consumer of this library.
+ *
+ * Typical usage:
+ *  1. fill commConfig (commConfigInit sets the defaults) and create a client or server context
+ *  2. submit messages with commSubmit - buffers are not copied, they must stay valid until the message completes
+ *  3. call commPoll repeatedly - it drives all the I/O and timers, invokes completion callbacks and returns events
+ * None of the functions blocks, except commPoll for at most the given timeout. The socket descriptor returned by
+ * commGetFd can be added to an external poll/epoll loop, commPoll is then called with zero timeout when it is readable.
+ *
+ * Sending is asynchronous - commSubmit only queues the message and returns. The engine pipelines the fragments of many
+ * messages (up to sendWindow packets are waiting for acknowledgement at once) and the server delivers the messages of
+ * one client in the order of their submission. Completions (sent/failed/timeout) are collected while commPoll processes
+ * the replies and the callbacks are called in one batch at its end. At most maxInFlight messages can be submitted and
+ * not completed - commSubmit then fails with EAGAIN and the application has to poll for completions first.
+ *
+ * A server with the message log can answer history requests (commRequestHistory) - the matching messages are found
+ * with the log indexes and sent back to the client as ordinary messages over the same windowed transport, each one
+ * reported as a COMM_EVENT_HISTORY event, followed by COMM_EVENT_HISTORY_END.
+ *
+ * A client with a name (commConfig.name) can receive messages from the other clients - a message with a recipient is
+ * delivered to the server and relayed by it to the client of that name. If the recipient is offline, the server keeps
+ * the message in the queue of the recipient (in the message log if it is enabled, so the queue survives a restart)
+ * and sends it once the recipient connects again. Relayed messages are reported as COMM_EVENT_MESSAGE on the client.
+ *
+ * Every message has a 64-bit id (assigned by the library unless the application sets it) and is delivered at most
+ * once - the receiver remembers the ids of the delivered messages for dedupWindowMs, a message with a known id is
+ * acknowledged to its sender but not delivered again. So a message resubmitted with the same id after a reconnect,
+ * or relayed again after a lost acknowledgement, is not reported twice.
+ *
+ * Messages have priority classes and an optional TTL. The sender starts the waiting messages by a weighted scheduler
+ * (every class gets a share of the messages given by its weight, messages close to their deadline go first) and drops
+ * the messages whose TTL expired before they were delivered. The receiver delivers the messages in the order they
+ * were started, so the messages of one class keep the order of their submission. The server relays the messages with
+ * the same priority and the rest of their TTL.
+ *
+ * The server shares its capacity fairly among the clients - received packets wait in one queue per client and are
+ * processed by deficit round robin, the sending to the clients (including the relayed and history messages) is
+ * scheduled the same way. Optional per-client rate limits (packets per second and message bytes per second of every
+ * priority class) drop the excess packets of a client, which sends them again later.
+ *
+ * An overloaded server (the kernel drops datagrams, or the received packets wait too long in its queues) refuses new
+ * clients and sheds the bulk messages, under heavy overload also the normal priority ones - it answers them with a
+ * busy reply, so the client backs off (reported once as COMM_EVENT_BUSY) instead of running into timeouts.
+ *
+ * Socket buffers are sized automatically to the bandwidth-delay product of the send window (for every connected
+ * client on the server) and the server grows its receive buffer when the kernel drops datagrams; the effective sizes
+ * and the drop counters are returned by commGetStats.
+ *
+ * Packets sent by one commPoll call are coalesced - a run of equally sized packets to one peer (the fragments of
+ * a message, or the acknowledgements) is passed to the kernel in one UDP_SEGMENT send, and datagrams coalesced by
+ * UDP_GRO are split on receive, so bulk transfers take a fraction of the system calls. With zeroCopy the large
+ * batches are sent with MSG_ZEROCOPY from a pool of send buffers, which return to the pool once the kernel reports
+ * the completion of the send; small batches are always copied.
+ *
+ * For the lowest latency busyPollUs makes commPoll spin on the socket before it sleeps and sets SO_BUSY_POLL, so the
+ * packets are picked up without the wakeup of a sleeping thread at the cost of a busy core; the spinning stops while
+ * the socket is idle. cpu pins the thread to one core.
+ *
+ * The retransmission timeout of every session follows its measured round-trip time (RFC 6298, retransmitTimeoutMs
+ * is the initial value and the limit of the exponential back-off). The round trips are measured between the kernel
+ * software timestamps of the packet and its acknowledgement (SO_TIMESTAMPING), so the scheduling of the application
+ * does not add noise, and every ACK carries the time the packet spent in the receiving host; commGetStats returns
+ * histograms of the round trips split into the network time and the host processing time. Losses are detected by the
+ * send times (RACK): a packet still unacknowledged a reordering window after a later sent packet was acknowledged is
+ * sent again without waiting for its timeout. The last packets of a flight (the last fragments, the end of message)
+ * have no later packet, so two smoothed round trips after them a tail-loss probe sends the last one again.
+ *
+ * With ecn the packets are sent with the ECN capable transport codepoint, so routers with active queue management
+ * mark them instead of dropping them. The receiver counts the data packets which arrive with the congestion
+ * experienced mark and every ACK carries the count, so the congestion control of the sender reduces the window
+ * before the queue overflows and no packet has to be retransmitted.
+ *
+ * Memory of a context (session tables, send windows, receive queues, reassembly and zero-copy buffers) comes from
+ * its own arena - one mapping backed by huge pages and bound to the NUMA node of the CPU of the thread which creates
+ * the context (pinned first if cpu is set). commReportTopology prints where the context and the network interfaces
+ * are placed, so the interrupt affinity can be aligned with it.
+ *
+ * With integrity COMM_INTEGRITY_SIPHASH every packet carries a SipHash-2-4 tag instead of the CRC, so packets injected
+ * by anyone without the pre-shared key (psk) are dropped. Every session has its own key, derived from the pre-shared
+ * key and the random nonces the client and the server exchange in the connection init and its ACK; the packets of
+ * one received datagram are verified in one batch.
+ *
+ * With integrity COMM_INTEGRITY_AEAD the payload is also encrypted with ChaCha20-Poly1305 under the key of the
+ * session (the header is authenticated in the clear). The nonce of a packet is its direction and the sequence number
+ * carried in the trailer of the packet; the collected packets of a commPoll call are sealed in one batch and the
+ * packets of a received datagram are opened in one batch.
+ *
+ * With workers set, the AEAD batches are split into chunks of four packets run by a work-stealing thread pool together
+ * with the polling thread, so a large transfer of one session uses several cores. The polling thread waits for the
+ * whole batch, so the packets are still handled and delivered in their order.
+ *
+ * Messages are split into fragments whose size follows the loss of the session: it is halved while many fragments
+ * are retransmitted and doubled on a clean link (COMM_FRAG_MIN to COMM_FRAG_MAX).
+ *
+ * congestion selects how many packets a session keeps in flight: the fixed send window, a loss-based AIMD window, or
+ * the BBR model - the bottleneck bandwidth from the delivery rate of the acknowledged packets and the minimum round
+ * trip from the kernel timestamps set the window (a multiple of their product) and the pacing rate of the packets.
+ */
+
+typedef struct commContext commContext;
+
+/**
+ * Durability of the server message log
+ */
+typedef enum commDurability {
+    COMM_DURABILITY_NONE,       //messages are written to the log, the kernel syncs them to the disk on its own
+    COMM_DURABILITY_BATCH,      //messages received in one commPoll call are synced together (group commit)
+    COMM_DURABILITY_MESSAGE     //every message is synced before it is acknowledged
+} commDurability;
+
+/**
+ * Pages backing the memory arena of a context
+ */
+typedef enum commPages {
+    COMM_PAGES_NONE,            //ordinary pages
+    COMM_PAGES_TRANSPARENT,     //transparent huge pages
+    COMM_PAGES_EXPLICIT         //explicit huge pages (hugetlbfs pool), transparent ones if the pool is too small
+} commPages;
+
+/**
+ * Integrity protection of the packets
+ */
+typedef enum commIntegrity {
+    COMM_INTEGRITY_CRC,         //CRC32 - detects corrupted packets, anyone can forge a packet
+    COMM_INTEGRITY_SIPHASH,     //SipHash-2-4 tag with the key of the session (derived from the pre-shared key)
+    COMM_INTEGRITY_AEAD         //ChaCha20-Poly1305 - the payload is encrypted as well, the packets are authenticated
+} commIntegrity;
+
+/**
+ * Congestion control of the sessions
+ */
+typedef enum commCongestion {
+    COMM_CONGESTION_FIXED,      //sendWindow packets in flight, no pacing
+    COMM_CONGESTION_AIMD,       //loss-based window - slow start, additive increase, halved on a loss
+    COMM_CONGESTION_BBR         //model-based - window and pacing rate from the bottleneck bandwidth and minimum RTT
+} commCongestion;
+
+/**
+ * Priority class of a message
+ */
+typedef enum commPriority {
+    COMM_PRIORITY_NORMAL,       //default class
+    COMM_PRIORITY_INTERACTIVE,  //short interactive messages (chat), served before the other classes
+    COMM_PRIORITY_BULK          //bulk transfers, served with the capacity left by the other classes
+} commPriority;
+
+/**
+ * Types of the events reported by commPoll
+ */
+typedef enum commEventType {
+    COMM_EVENT_CONNECTED = 1,   //client: server has acknowledged the connection init packet
+    COMM_EVENT_MESSAGE,         //server: complete message has been received from a client,
+                                //client: message of another client has been relayed by the server
+    COMM_EVENT_SENT,            //client: submitted message has been delivered to the server
+    COMM_EVENT_FAILED,          //client: submitted message (or connection init) was rejected or dropped
+    COMM_EVENT_CLOSED,          //server: session of the client has ended (closed by both sides, or ended at once by
+                                //commDestroy), client: session closed with commShutdown has ended
+    COMM_EVENT_TIMEOUT,         //client: submitted message was not acknowledged after maxRetransmits attempts
+    COMM_EVENT_HISTORY,         //client: message of the log returned for a history request
+    COMM_EVENT_HISTORY_END,     //client: all the messages of a history request were returned
+    COMM_EVENT_EXPIRED,         //client: TTL of the submitted message expired before it was delivered
+    COMM_EVENT_BUSY,            //client: server is overloaded - sending (or connecting) is delayed until it recovers
+    COMM_EVENT_SHUTDOWN         //peer has closed its side of the session - it sends no new messages, the messages
+                                //to it are still delivered
+} commEventType;
+
+/**
+ * Event reported by commPoll or passed to a completion callback
+ * data of a COMM_EVENT_MESSAGE event is owned by the library and is valid until the next commPoll call,
+ * data of COMM_EVENT_SENT/COMM_EVENT_FAILED/COMM_EVENT_TIMEOUT/COMM_EVENT_EXPIRED is the buffer which was submitted
+ * by the application
+ * (failure of a history request is reported as COMM_EVENT_FAILED/COMM_EVENT_TIMEOUT with its requestId and no data),
+ * data of COMM_EVENT_HISTORY is owned by the library like the data of COMM_EVENT_MESSAGE
+ */
+typedef struct commEvent {
+    commEventType type;
+    struct sockaddr_in peer;    //address of the remote side
+    unsigned int messageId;     //id of the message within the session
+    unsigned long long sequence;    //sequence number of the message in the server message log (0 if not logged)
+    const char *data;
+    size_t length;
+    void *userData;             //userData of the submitted message
+    unsigned int channel;       //channel of the message
+    long long timestamp;        //time of the reception by the server in milliseconds since the epoch
+    struct sockaddr_in origin;  //address of the client which sent the message (relayed and history messages)
+    unsigned int requestId;     //history: id returned by commRequestHistory
+    char sender[COMM_NAME_MAX];     //name of the client which sent the message, empty if it has no name
+    char recipient[COMM_NAME_MAX];  //server: name of the client the message is relayed to, empty if it is not relayed
+    unsigned long long id;      //64-bit id of the message
+    commPriority priority;
+} commEvent;
+
+typedef void (*commCallback)(commContext *ctx, const commEvent *event);
+
+/**
+ * Message submitted for sending (zero-copy - only the descriptor is copied, data are read directly from the buffer)
+ * If onComplete is NULL, the completion is reported as an event by commPoll instead
+ */
+typedef struct commMessage {
+    const void *data;
+    size_t length;
+    commCallback onComplete;
+    void *userData;
+    unsigned int channel;       //channel (topic) of the message, stored in the server message log
+    const char *recipient;      //name of the client the server relays the message to (NULL for the server only)
+    unsigned long long id;      //unique id of the message for the deduplication (0 to let the library assign one)
+    commPriority priority;
+    int ttlMs;                  //time after which the message is dropped if it is not delivered (0 for no limit)
+} commMessage;
+
+/**
+ * History request - messages with sequence >= fromSequence and received at fromTimestamp or later, optionally only
+ * of one channel and/or one sender, at most limit messages (the oldest ones, or the newest ones if newest is set)
+ */
+typedef struct commHistoryQuery {
+    unsigned long long fromSequence;
+    long long fromTimestamp;    //milliseconds since the epoch, 0 for any time
+    unsigned int channel;       //COMM_ANY_CHANNEL for all channels
+    struct sockaddr_in sender;  //sin_family AF_INET to return only the messages of this client, 0 for all clients
+    unsigned int limit;         //0 or more than COMM_HISTORY_MAX for COMM_HISTORY_MAX
+    int newest;
+} commHistoryQuery;
+
+/**
+ * Context configuration
+ */
+typedef struct commConfig {
+    const char *host;           //client: server IP address, server: bind IP address (NULL for any address)
+    unsigned short port;
+    int retransmitTimeoutMs;    //time after which an unacknowledged packet is sent again
+    int maxRetransmits;         //number of resend attempts before the message is reported as timed out
+    int sendWindow;             //maximum number of packets waiting for acknowledgement
+    int maxInFlight;            //maximum number of submitted messages which are not completed yet
+    const char *logDirectory;   //server: directory of the persistent message log (NULL to disable the log)
+    size_t logSegmentSize;      //server: size of one log segment file
+    commDurability logDurability;   //server: when the logged messages are synced to the disk
+    const char *name;           //client: name under which the client receives relayed messages (NULL for none)
+    size_t relayQueueBytes;     //server: maximum size of the messages kept in memory for one offline recipient
+                                //(messages kept in the message log are not limited)
+    int relayMaxAgeMs;          //server: messages are not relayed after this time (0 for no limit)
+    int relayDrainRate;         //server: messages per second sent from the queue to a reconnected recipient
+                                //(0 for no limit), live messages are not limited
+    int dedupWindowMs;          //minimum time for which the ids of the delivered messages are remembered
+    int priorityWeights[COMM_PRIORITY_CLASSES];     //share of the started messages of every priority class
+    int clientPacketRate;       //server: packets per second processed from one client (0 for no limit)
+    int clientByteRate[COMM_PRIORITY_CLASSES];      //server: message bytes per second accepted from one client
+                                                    //in every priority class (0 for no limit)
+    int overloadLatencyMs;      //server: time the received packets may wait before the server is overloaded
+                                //(0 disables the overload protection)
+    int recvBufferSize;         //socket receive buffer size in bytes (0 for automatic sizing)
+    int sendBufferSize;         //socket send buffer size in bytes (0 for automatic sizing)
+    int maxSocketBuffer;        //maximum size of the automatically sized socket buffers
+    int udpOffload;             //coalesce the sent packets with UDP_SEGMENT and receive with UDP_GRO (if supported)
+    int zeroCopy;               //send large coalesced batches with MSG_ZEROCOPY (requires udpOffload)
+    int busyPollUs;             //spin this long for a packet before commPoll sleeps (0 to always sleep)
+    int cpu;                    //CPU the thread creating the context is pinned to (-1 for no pinning)
+    int timestamping;           //measure the round trips with the kernel (SO_TIMESTAMPING) timestamps
+    int ecn;                    //send the packets ECN capable (ECT(0)) and report the congestion experienced marks
+                                //of the received ones to the sender
+    size_t arenaSize;           //memory arena of the context and its buffers (0 to allocate them on the heap)
+    commPages hugePages;        //pages backing the arena
+    int numaNode;               //NUMA node of the arena (-1 for the node of the CPU of the creating thread)
+    commIntegrity integrity;    //protection of the packets, both sides have to use the same one
+    const void *psk;            //pre-shared key of the authenticated modes (at least 16 random bytes recommended)
+    size_t pskLength;
+    int workers;                //threads which seal and open the AEAD packets together with the polling thread
+                                //(0 for none, -1 for one per other online CPU)
+    int adaptiveFragments;      //fragment size of a session follows its loss (COMM_FRAG_MIN to COMM_FRAG_MAX),
+                                //otherwise the messages are split into COMM_FRAG_SIZE fragments
+    commCongestion congestion;  //congestion control of every session (sendWindow is the upper bound of its window)
+} commConfig;
+
+/**
+ * Counters and socket state of the context
+ */
+typedef struct commStats {
+    int recvBuffer;                     //effective socket buffer sizes reported by the kernel (including its overhead)
+    int sendBuffer;
+    unsigned long long kernelDrops;     //server: datagrams dropped by the kernel because the receive buffer was full
+    unsigned long long queueDrops;      //server: packets dropped because the receive queue of their client was full
+    unsigned long long rateDrops;       //server: packets and messages refused by the client rate limits
+    unsigned long long shedPackets;     //server: packets refused with a busy reply while the server was overloaded
+    unsigned long long gsoSends;        //sends of several packets coalesced with UDP_SEGMENT
+    unsigned long long groReceives;     //received datagrams of several packets coalesced by UDP_GRO
+    unsigned long long zeroCopySends;   //coalesced sends passed to the kernel with MSG_ZEROCOPY
+    unsigned long long zeroCopyCopied;  //zero-copy sends the kernel copied anyway (zero-copy is then switched off)
+    unsigned long long busyPollHits;    //busy polls which found a packet
+    unsigned long long busyPollMisses;  //busy polls which ended without a packet
+    int rtoMs;                          //retransmission timeout of the session measured last
+    long long srttUs;                   //smoothed round-trip time of the session measured last
+    unsigned long long rttSamples;      //acknowledged packets measured for the round-trip time
+    unsigned long long stampedSamples;  //samples with the kernel TX timestamp of the packet
+    unsigned long long timeoutRetransmits;  //packets sent again after their retransmission timeout
+    unsigned long long rackRetransmits;     //packets sent again after RACK declared them lost
+    unsigned long long tailProbes;          //tail-loss probes sent
+    unsigned long long ceReceived;      //data packets received with the congestion experienced (CE) mark
+    unsigned long long ceReported;      //CE marks of the sent packets reported by the peers
+    unsigned long long authFailures;    //packets dropped because their authentication tag did not match
+    unsigned long long workerTasks;     //chunks of the AEAD packets sealed or opened by the worker pool
+    unsigned long long stolenTasks;     //chunks a thread of the pool took over from the range of another one
+    unsigned long long arenaFallbacks;  //allocations served by the heap because the arena was full or the block was
+                                        //too large (the arena is too small if it grows)
+    int fragSize;                       //fragment size of the session evaluated last
+    unsigned long long fragResizes;     //changes of the fragment size of the sessions
+    int congestionWindow;               //congestion window (packets) of the session acknowledged last
+    long long bandwidth;                //BBR: bottleneck bandwidth estimate of that session (bytes per second)
+    long long pacingRate;               //BBR: its pacing rate (bytes per second)
+    long long minRttUs;                 //BBR: its minimum round-trip time
+    //latency histograms, bucket i counts the samples below 2^i microseconds (the last one also the longer ones):
+    //round trip between the kernel timestamps, its part spent in the network and the rest of the round trip seen by
+    //the application (processing, queueing and scheduling in both hosts)
+    unsigned long long rttHistogram[COMM_LATENCY_BUCKETS];
+    unsigned long long networkHistogram[COMM_LATENCY_BUCKETS];
+    unsigned long long hostHistogram[COMM_LATENCY_BUCKETS];
+} commStats;
+
+/**
+ * Fills the configuration with default values
+ * @param config Configuration to be initialized
+ */
+void commConfigInit(commConfig *config);
+
+/**
+ * Creates server context - binds the socket and starts receiving messages from clients
+ * @param config Configuration of the context (NULL for defaults)
+ * @return new context or NULL on error (errno is set)
+ */
+commContext *commServerCreate(const commConfig *config);
+
+/**
+ * Creates client context and sends connection init packet to the server
+ * @param config Configuration of the context (NULL for defaults)
+ * @return new context or NULL on error (errno is set)
+ */
+commContext *commClientCreate(const commConfig *config);
+
+/**
+ * Closes this side of the session (half-close) - no new messages are accepted, the submitted ones are still sent
+ * and after the last of them is acknowledged the peer receives a close frame (COMM_EVENT_SHUTDOWN on its side).
+ * The server closes its side of a client session in the same way once the client closed its side and the messages
+ * queued for it are sent. When both sides are closed, the session is kept for CLOSE_LINGER retransmission timeouts
+ * to acknowledge the frames the peer sends again, then it is released and COMM_EVENT_CLOSED is reported. A peer which
+ * does not acknowledge the close frame, or does not close its side and sends nothing for maxRetransmits + 1
+ * retransmission timeouts after it acknowledged it, is considered gone and the session is released as well
+ * @param ctx Context
+ * @param peer Client whose session the server closes (ignored by the client)
+ * @return 0 on success, -1 on error (errno is set - ENOTCONN if there is no such session or the client is not
+ *  connected)
+ */
+int commShutdown(commContext *ctx, const struct sockaddr_in *peer);
+
+/**
+ * Ends the communication and releases the context - a client which did not close its session with commShutdown
+ * ends it on the server at once with an empty datagram
+ * Messages which are not completed yet are dropped without calling their callbacks
+ * @param ctx Context to be destroyed
+ */
+void commDestroy(commContext *ctx);
+
+/**
+ * @param ctx Context
+ * @return socket file descriptor of the context, usable in external poll/epoll loops
+ */
+int commGetFd(commContext *ctx);
+
+/**
+ * @param ctx Context
+ * @param address Filled with the local address of the context socket
+ * @return 0 on success, -1 on error
+ */
+int commGetLocalAddress(commContext *ctx, struct sockaddr_in *address);
+
+/**
+ * @param ctx Context
+ * @param stats Filled with the counters and the socket buffer sizes of the context
+ */
+void commGetStats(commContext *ctx, commStats *stats);
+
+/**
+ * Prints the placement of the context (CPU and NUMA node of the thread, node and pages of the memory arena) and the
+ * NUMA node and interrupt CPU affinity of the network interfaces it uses, with hints how to align them
+ * @param ctx Context
+ * @param out Stream the report is printed to
+ */
+void commReportTopology(commContext *ctx, FILE *out);
+
+/**
+ * @param ctx Context
+ * @return number of submitted messages which are not completed yet
+ */
+int commInFlight(commContext *ctx);
+
+/**
+ * Submits a message for sending (client only), the call returns immediately
+ * @param ctx Client context
+ * @param message Message descriptor, the data buffer must stay valid until completion
+ * @return 0 if the message was queued, -1 on error (errno is set - EAGAIN if maxInFlight messages are not completed,
+ *  ENOTCONN if the server did not respond to the connection init, EPIPE after commShutdown)
+ */
+int commSubmit(commContext *ctx, const commMessage *message);
+
+/**
+ * Fills the history query with default values (all the messages of all the channels, the oldest ones first)
+ * @param query Query to be initialized
+ */
+void commHistoryQueryInit(commHistoryQuery *query);
+
+/**
+ * Requests the message history from the server (client only), the call returns immediately
+ * The messages are reported as COMM_EVENT_HISTORY events in the order of their sequence numbers and the request ends
+ * with COMM_EVENT_HISTORY_END (also if the server does not keep the log)
+ * @param ctx Client context
+ * @param query Query, it is copied
+ * @param requestId Filled with the id of the request, reported in the history events
+ * @return 0 if the request was queued, -1 on error (errno is set like by commSubmit)
+ */
+int commRequestHistory(commContext *ctx, const commHistoryQuery *query, unsigned int *requestId);
+
+/**
+ * Drives the protocol engine - receives and sends packets, handles retransmission timers and reports events
+ * Completion callbacks are called from this function and must not destroy the context
+ * @param ctx Context
+ * @param events Array for the reported events
+ * @param maxEvents Size of the events array
+ * @param timeoutMs Maximum time to wait for an event (0 to return immediately, -1 to wait without limit)
+ * @return number of reported events, -1 on error
+ */
+int commPoll(commContext *ctx, commEvent *events, int maxEvents, int timeoutMs);
+
+#endif //COMMUNICATOR_H
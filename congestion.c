@@ -0,0 +1,261 @@
+#include <string.h>
+#include "communicator.h"
+#include "congestion.h"
+
+#define INITIAL_WINDOW 10           //packets in flight before the first acknowledgement (RFC 6928)
+#define MIN_WINDOW 4                //smallest window of BBR (probe-RTT) and AIMD
+#define BBR_HIGH_GAIN 2.885         //startup gain - doubles the delivery rate every round trip (2/ln 2)
+#define BBR_CWND_GAIN 2.0           //window in bandwidth-delay products outside the startup
+#define BBR_FULL_GROWTH 1.25        //startup ends when the bandwidth grew less than this ...
+#define BBR_FULL_ROUNDS 3           //... in this many round trips
+#define BBR_MIN_RTT_US 10000000LL   //minimum round trip expires after 10 s
+#define BBR_PROBE_RTT_US 200000LL   //time the window stays at MIN_WINDOW in probe-RTT
+#define ECN_BETA 0.8                //AIMD window after a CE mark (RFC 8511 - marks come before the queue overflows)
+#define ECN_GAIN (1.0 / 16)         //BBR: weight of a round trip in the smoothed fraction of the marked packets
+#define PACING_BURST_US 2000        //credit kept for this long - timers of the engine have millisecond resolution
+
+enum { BBR_STARTUP, BBR_DRAIN, BBR_PROBE_BW, BBR_PROBE_RTT };
+
+static const double cycleGains[BBR_CYCLE] = { 1.25, 0.75, 1, 1, 1, 1, 1, 1 };
+
+void congestionInit(congestionState *cc, int mode, int maxWindow) {
+    memset(cc, 0, sizeof(*cc));
+    cc->mode = mode;
+    cc->maxWindow = maxWindow;
+    cc->cwnd = INITIAL_WINDOW;
+    cc->ssthresh = maxWindow;
+    cc->state = BBR_STARTUP;
+    cc->pacingGain = BBR_HIGH_GAIN;
+    cc->cwndGain = BBR_HIGH_GAIN;
+}
+
+void congestionSent(const congestionState *cc, congestionSample *sample, long long now) {
+    sample->delivered = cc->delivered;
+    sample->deliveredUs = cc->deliveredUs != 0 ? cc->deliveredUs : now;
+    sample->sentUs = now;
+}
+
+/**
+ * @return bandwidth-delay product in packets, 0 if the model has no estimate yet
+ */
+static double bdpPackets(const congestionState *cc, size_t packetBytes) {
+    return cc->bandwidth * (double) cc->minRttUs / 1e6 / (double) packetBytes;
+}
+
+/**
+ * Moves BBR to the state and sets its gains
+ */
+static void enterState(congestionState *cc, int state, long long now) {
+    cc->state = state;
+    switch (state) {
+        case BBR_STARTUP:
+            cc->pacingGain = BBR_HIGH_GAIN;
+            cc->cwndGain = BBR_HIGH_GAIN;
+            break;
+        case BBR_DRAIN:
+            cc->pacingGain = 1 / BBR_HIGH_GAIN;
+            cc->cwndGain = BBR_HIGH_GAIN;
+            break;
+        case BBR_PROBE_BW:
+            cc->cycleIndex = 0;
+            cc->cycleStartUs = now;
+            cc->pacingGain = cycleGains[0];
+            cc->cwndGain = BBR_CWND_GAIN;
+            break;
+        default:
+            cc->probeRttDoneUs = 0;
+            cc->pacingGain = 1;
+            cc->cwndGain = 1;
+            break;
+    }
+}
+
+/**
+ * Runs the BBR state machine after an acknowledgement
+ * @param roundStart The acknowledgement started a new round trip
+ */
+static void bbrUpdate(congestionState *cc, int roundStart, int inFlight, size_t packetBytes, long long now) {
+    if (cc->state == BBR_STARTUP && roundStart) {
+        //pipe is full when the bandwidth stops growing
+        if (cc->bandwidth >= cc->fullBandwidth * BBR_FULL_GROWTH) {
+            cc->fullBandwidth = cc->bandwidth;
+            cc->fullRounds = 0;
+        } else if (++cc->fullRounds >= BBR_FULL_ROUNDS) {
+            cc->filled = 1;
+            enterState(cc, BBR_DRAIN, now);
+        }
+    }
+    if (cc->state == BBR_DRAIN && inFlight <= bdpPackets(cc, packetBytes))
+        enterState(cc, BBR_PROBE_BW, now);
+    if (cc->state == BBR_PROBE_BW && cc->minRttUs > 0 && now - cc->cycleStartUs > cc->minRttUs) {
+        cc->cycleIndex = (cc->cycleIndex + 1) % BBR_CYCLE;
+        cc->cycleStartUs = now;
+        //a marked path has no spare bandwidth - the probing phase keeps the rate
+        cc->pacingGain = cc->marked && cycleGains[cc->cycleIndex] > 1 ? 1 : cycleGains[cc->cycleIndex];
+    }
+    if (cc->state != BBR_PROBE_RTT && cc->minRttUs > 0 && now - cc->minRttAtUs > BBR_MIN_RTT_US)
+        enterState(cc, BBR_PROBE_RTT, now);
+    if (cc->state == BBR_PROBE_RTT) {
+        if (cc->probeRttDoneUs == 0 && inFlight <= MIN_WINDOW)
+            cc->probeRttDoneUs = now + (BBR_PROBE_RTT_US > cc->minRttUs ? BBR_PROBE_RTT_US : cc->minRttUs);
+        if (cc->probeRttDoneUs != 0 && now >= cc->probeRttDoneUs) {
+            cc->minRttAtUs = now;   //minimum measured during the probe (or kept if the path did not change)
+            enterState(cc, cc->filled ? BBR_PROBE_BW : BBR_STARTUP, now);
+        }
+    }
+}
+
+/**
+ * Measures the bytes acknowledged above the bandwidth since the start of the epoch - the epoch starts again when the
+ * acknowledgements fall behind the bandwidth
+ */
+static void updateAggregation(congestionState *cc, int roundStart, size_t bytes, long long now) {
+    double expected = cc->bandwidth * (double) (now - cc->epochUs) / 1e6;
+    if (roundStart && cc->round % BBR_BW_ROUNDS == 0) {
+        cc->extraAcked[1] = cc->extraAcked[0];
+        cc->extraAcked[0] = 0;
+    }
+    if (cc->epochUs == 0 || cc->epochAcked <= expected) {
+        cc->epochUs = now;
+        cc->epochAcked = 0;
+        expected = 0;
+    }
+    cc->epochAcked += (double) bytes;
+    if (cc->epochAcked - expected > cc->extraAcked[0])
+        cc->extraAcked[0] = cc->epochAcked - expected;
+}
+
+void congestionAcked(congestionState *cc, const congestionSample *sample, size_t bytes, int inFlight,
+                     size_t packetBytes, long long now) {
+    long long interval;
+    int roundStart = 0, i;
+
+    cc->delivered += bytes;
+    cc->deliveredUs = now;
+    if (cc->mode == COMM_CONGESTION_AIMD) {
+        cc->cwnd += cc->cwnd < cc->ssthresh ? 1 : 1 / cc->cwnd;     //slow start, then congestion avoidance
+        if (cc->cwnd > cc->maxWindow)
+            cc->cwnd = cc->maxWindow;
+        return;
+    }
+    if (cc->mode != COMM_CONGESTION_BBR)
+        return;
+
+    if (sample->delivered >= cc->roundEnd) {
+        if (cc->roundAcked > 0) {
+            double share = cc->roundMarked < cc->roundAcked ? (double) cc->roundMarked / cc->roundAcked : 1;
+            cc->markedShare += ECN_GAIN * (share - cc->markedShare);
+        }
+        cc->marked = cc->roundMarked > 0;
+        cc->roundAcked = cc->roundMarked = 0;
+        cc->roundEnd = cc->delivered;
+        cc->round++;
+        cc->roundBw[cc->round % BBR_BW_ROUNDS] = 0;
+        roundStart = 1;
+    }
+    cc->roundAcked++;
+    //delivery rate - bytes acknowledged since the packet was sent over the longer of the send and the ACK intervals,
+    //so a burst of acknowledgements does not inflate it
+    interval = now - sample->deliveredUs;
+    if (sample->sentUs - sample->deliveredUs > interval)
+        interval = sample->sentUs - sample->deliveredUs;
+    if (interval > 0) {
+        double rate = (double) (cc->delivered - sample->delivered) * 1e6 / (double) interval;
+        if (rate > cc->roundBw[cc->round % BBR_BW_ROUNDS])
+            cc->roundBw[cc->round % BBR_BW_ROUNDS] = rate;
+    }
+    cc->bandwidth = 0;
+    for (i = 0; i < BBR_BW_ROUNDS; i++)
+        cc->bandwidth = cc->roundBw[i] > cc->bandwidth ? cc->roundBw[i] : cc->bandwidth;
+    updateAggregation(cc, roundStart, bytes, now);
+    bbrUpdate(cc, roundStart, inFlight, packetBytes, now);
+}
+
+void congestionRtt(congestionState *cc, long long rttUs, long long now) {
+    if (rttUs <= 0)
+        rttUs = 1;
+    if (cc->minRttUs == 0 || rttUs <= cc->minRttUs || now - cc->minRttAtUs > BBR_MIN_RTT_US) {
+        cc->minRttUs = rttUs;
+        cc->minRttAtUs = now;
+    }
+}
+
+void congestionLost(congestionState *cc, const congestionSample *sample, long long now) {
+    if (cc->mode != COMM_CONGESTION_AIMD || sample->sentUs < cc->reducedUs)
+        return;     //packets sent before the last reduction were lost in the same congestion event
+    cc->ssthresh = cc->cwnd / 2 > MIN_WINDOW ? cc->cwnd / 2 : MIN_WINDOW;
+    cc->cwnd = cc->ssthresh;
+    cc->reducedUs = now;
+}
+
+void congestionMarked(congestionState *cc, const congestionSample *sample, int marks, long long now) {
+    if (cc->mode == COMM_CONGESTION_BBR) {
+        cc->roundMarked += marks;
+        return;
+    }
+    if (cc->mode != COMM_CONGESTION_AIMD || sample->sentUs < cc->reducedUs)
+        return;     //one reduction per round trip, like the losses
+    cc->cwnd = cc->cwnd * ECN_BETA > MIN_WINDOW ? cc->cwnd * ECN_BETA : MIN_WINDOW;
+    cc->ssthresh = cc->cwnd;
+    cc->reducedUs = now;
+}
+
+int congestionWindow(const congestionState *cc, size_t packetBytes) {
+    double window;
+    switch (cc->mode) {
+        case COMM_CONGESTION_AIMD:
+            window = cc->cwnd;
+            break;
+        case COMM_CONGESTION_BBR:
+            if (cc->state == BBR_PROBE_RTT)
+                window = MIN_WINDOW;
+            else if (cc->bandwidth == 0 || cc->minRttUs == 0)
+                window = INITIAL_WINDOW;
+            else {
+                double extra = cc->extraAcked[0] > cc->extraAcked[1] ? cc->extraAcked[0] : cc->extraAcked[1];
+                window = cc->cwndGain * bdpPackets(cc, packetBytes) + extra / (double) packetBytes + 0.5;
+            }
+            window *= 1 - cc->markedShare / 2;
+            if (window < MIN_WINDOW)
+                window = MIN_WINDOW;
+            if (cc->state != BBR_PROBE_RTT && window < INITIAL_WINDOW)
+                window = INITIAL_WINDOW;
+            break;
+        default:
+            return cc->maxWindow;
+    }
+    return window < cc->maxWindow ? (int) window : cc->maxWindow;
+}
+
+double congestionPacingRate(const congestionState *cc) {
+    return cc->mode == COMM_CONGESTION_BBR ? cc->pacingGain * cc->bandwidth : 0;
+}
+
+/**
+ * Adds the credit earned since the last refill, up to PACING_BURST_US of the rate (at least two packets)
+ */
+static double refilledCredit(const congestionState *cc, double rate, size_t bytes, long long now) {
+    double credit = cc->credit + rate * (double) (now - cc->creditUs) / 1e6, burst = rate * PACING_BURST_US / 1e6;
+    if (burst < 2.0 * (double) bytes)
+        burst = 2.0 * (double) bytes;
+    return credit < burst ? credit : burst;
+}
+
+int congestionPace(congestionState *cc, size_t bytes, long long now) {
+    double rate = congestionPacingRate(cc);
+    if (rate <= 0)
+        return 1;
+    cc->credit = refilledCredit(cc, rate, bytes, now);
+    cc->creditUs = now;
+    if (cc->credit < (double) bytes)
+        return 0;
+    cc->credit -= (double) bytes;
+    return 1;
+}
+
+long long congestionPaceDelay(const congestionState *cc, size_t bytes, long long now) {
+    double rate = congestionPacingRate(cc), credit;
+    if (rate <= 0 || (credit = refilledCredit(cc, rate, bytes, now)) >= (double) bytes)
+        return 0;
+    return (long long) (((double) bytes - credit) * 1e6 / rate) + 1;
+}
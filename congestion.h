@@ -0,0 +1,141 @@
+#ifndef CONGESTION_H
+#define CONGESTION_H
+
+#include <stddef.h>
+
+/**
+ * @brief Congestion control of one session. The controller decides how many packets may be in flight (the congestion
+ * window) and, in the model-based mode, how fast they are sent (the pacing rate). Three modes are implemented:
+ *
+ * fixed - the window is the configured send window, nothing is paced (the behaviour without congestion control);
+ * AIMD - loss-based: slow start, then one packet more per window of acknowledged packets, the window is halved once
+ * per round trip on a loss;
+ * BBR - model-based: the bottleneck bandwidth is the maximum delivery rate of the last BBR_BW_ROUNDS round trips, the
+ * minimum round trip comes from the kernel timestamps, the window is a multiple of their product (the bandwidth-delay
+ * product) and the packets are paced at a multiple of the bandwidth. The multiples follow the BBR states: startup
+ * doubles the rate every round trip until the bandwidth stops growing, drain empties the queue built by the startup,
+ * probe-bandwidth cycles the rate around the estimate and probe-RTT shrinks the window for a moment when the minimum
+ * round trip has not been seen for BBR_MIN_RTT_US, so a stale one is measured again. Losses do not change the model.
+ * The acknowledgements of a receiver which polls its socket arrive in bursts, so the window keeps room for the
+ * largest burst above the bandwidth (the ACK aggregation) - otherwise the sender idles between them.
+ *
+ * Packets marked by ECN capable routers with congestion experienced (CE) signal a queue before it overflows: AIMD
+ * reduces the window to 80 % once per round trip (RFC 8511), BBR keeps the fraction of the marked packets of every
+ * round trip smoothed (like DCTCP), shrinks the window by half of it and does not probe for more bandwidth in the
+ * round trip after a mark.
+ *
+ * Times are in microseconds of a monotonic clock, sizes in bytes.
+ */
+
+#define BBR_BW_ROUNDS 10        //round trips of the bandwidth maximum filter
+#define BBR_CYCLE 8             //phases of the probe-bandwidth gain cycle
+
+/**
+ * State of the session recorded when a packet is sent - the delivery rate sample of its acknowledgement starts here
+ */
+typedef struct congestionSample {
+    unsigned long long delivered;   //bytes delivered to the peer before the packet was sent
+    long long deliveredUs;          //time the last of them was acknowledged
+    long long sentUs;               //time the packet was sent
+} congestionSample;
+
+typedef struct congestionState {
+    int mode;                       //commCongestion
+    int maxWindow;                  //upper bound of the window (packets)
+    double cwnd;                    //AIMD: congestion window (packets)
+    double ssthresh;                //AIMD: slow start threshold (packets)
+    long long reducedUs;            //AIMD: time of the last window reduction - older losses belong to it
+
+    unsigned long long delivered;   //bytes acknowledged
+    long long deliveredUs;          //time of the last acknowledgement
+    unsigned long long round;       //round trips counted by the delivered bytes
+    unsigned long long roundEnd;    //delivered bytes at which the current round trip ends
+    double roundBw[BBR_BW_ROUNDS];  //maximum delivery rate of the last round trips (bytes per second)
+    double bandwidth;               //bottleneck bandwidth estimate - maximum of roundBw
+    long long minRttUs;             //minimum round trip, 0 before the first sample
+    long long minRttAtUs;           //time the minimum was measured
+    int state;                      //BBR state
+    double pacingGain, cwndGain;
+    int cycleIndex;                 //phase of the probe-bandwidth gain cycle
+    long long cycleStartUs;
+    double fullBandwidth;           //bandwidth at the last growth of the startup by 25 %
+    int fullRounds;                 //round trips of the startup without such growth
+    int filled;                     //startup found the bottleneck bandwidth
+    long long probeRttDoneUs;       //end of the probe-RTT state, 0 until the window drained
+    long long epochUs;              //start of the current ACK aggregation epoch
+    double epochAcked;              //bytes acknowledged in the epoch
+    double extraAcked[2];           //maximum bytes acknowledged above the bandwidth in the epochs of the current and
+                                    //the previous BBR_BW_ROUNDS round trips
+
+    int roundAcked;                 //BBR: packets acknowledged in the current round trip
+    int roundMarked;                //BBR: CE marks reported in the current round trip
+    int marked;                     //BBR: the previous round trip had CE marks
+    double markedShare;             //BBR: smoothed fraction of the marked packets
+
+    double credit;                  //pacing: bytes which can be sent now
+    long long creditUs;             //time of the last refill of the credit
+} congestionState;
+
+/**
+ * Starts the controller of a new session
+ * @param mode commCongestion
+ * @param maxWindow Size of the send window of the session (packets)
+ */
+void congestionInit(congestionState *cc, int mode, int maxWindow);
+
+/**
+ * Records the state of the session in the sample of the packet which is being sent (or sent again)
+ */
+void congestionSent(const congestionState *cc, congestionSample *sample, long long now);
+
+/**
+ * Updates the model with the acknowledgement of the packet
+ * @param sample Sample recorded when the packet was sent
+ * @param bytes Size of the packet
+ * @param inFlight Packets still in flight
+ * @param packetBytes Typical size of the packets of the session
+ */
+void congestionAcked(congestionState *cc, const congestionSample *sample, size_t bytes, int inFlight,
+                     size_t packetBytes, long long now);
+
+/**
+ * Updates the minimum round trip with the sample of an acknowledged packet
+ */
+void congestionRtt(congestionState *cc, long long rttUs, long long now);
+
+/**
+ * Reacts to the loss of the packet (sent again after its timeout)
+ * @param sample Sample recorded when the packet was sent
+ */
+void congestionLost(congestionState *cc, const congestionSample *sample, long long now);
+
+/**
+ * Reacts to the congestion experienced marks the peer reported in the acknowledgement of the packet
+ * @param sample Sample recorded when the packet was sent
+ * @param marks Packets received with CE since the previous report
+ */
+void congestionMarked(congestionState *cc, const congestionSample *sample, int marks, long long now);
+
+/**
+ * @param packetBytes Typical size of the packets of the session
+ * @return number of packets which may be in flight
+ */
+int congestionWindow(const congestionState *cc, size_t packetBytes);
+
+/**
+ * Takes the pacing credit of the packet
+ * @return 1 if the packet can be sent now, 0 if it has to wait
+ */
+int congestionPace(congestionState *cc, size_t bytes, long long now);
+
+/**
+ * @return time (microseconds from now) until the credit of the packet is there, 0 if it can be sent now
+ */
+long long congestionPaceDelay(const congestionState *cc, size_t bytes, long long now);
+
+/**
+ * @return pacing rate in bytes per second, 0 if the packets are not paced
+ */
+double congestionPacingRate(const congestionState *cc);
+
+#endif //CONGESTION_H
@@ -0,0 +1,81 @@
+#include "crc32.h"
+
+#define CRC_STREAMS 4   //messages hashed in lockstep by crc32Batch
+
+/**
+ * Slicing-by-8 tables - crcTable[0] is the byte table, crcTable[k] advances the CRC of a byte by k more zero bytes,
+ * so 8 bytes are folded with 8 independent lookups
+ */
+static unsigned int crcTable[8][256];
+
+__attribute__((constructor)) static void crcInit(void) {
+    unsigned int crc, i;
+    int j;
+    for (i = 0; i < 256; i++) {
+        crc = i;
+        for (j = 0; j < 8; j++)
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        crcTable[0][i] = crc;
+    }
+    for (i = 0; i < 256; i++) {
+        for (j = 1; j < 8; j++)
+            crcTable[j][i] = (crcTable[j - 1][i] >> 8) ^ crcTable[0][crcTable[j - 1][i] & 0xFF];
+    }
+}
+
+/**
+ * @return CRC updated with the 8 bytes
+ */
+static inline unsigned int crcWord(unsigned int crc, const unsigned char *p) {
+    unsigned int lo = crc ^ (p[0] | (unsigned int) p[1] << 8 | (unsigned int) p[2] << 16 | (unsigned int) p[3] << 24);
+    return crcTable[7][lo & 0xFF] ^ crcTable[6][(lo >> 8) & 0xFF] ^ crcTable[5][(lo >> 16) & 0xFF] ^
+           crcTable[4][lo >> 24] ^ crcTable[3][p[4]] ^ crcTable[2][p[5]] ^ crcTable[1][p[6]] ^ crcTable[0][p[7]];
+}
+
+/**
+ * @return CRC updated with the bytes
+ */
+static unsigned int crcUpdate(unsigned int crc, const unsigned char *message, size_t length) {
+    size_t i;
+    for (i = 0; i + 8 <= length; i += 8)
+        crc = crcWord(crc, message + i);
+    for (; i < length; i++)
+        crc = crcTable[0][(crc ^ message[i]) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+unsigned int crc32b(const unsigned char *message, size_t length) {
+    return ~crcUpdate(0xFFFFFFFF, message, length);
+}
+
+unsigned long long crc32Batch(const unsigned char *const *messages, const size_t *lengths, const unsigned int *expected,
+                              int count) {
+    unsigned long long valid = 0;
+    unsigned int crc[CRC_STREAMS];
+    size_t common, i;
+    int first, s;
+
+    if (count > CRC32_BATCH_MAX)
+        count = CRC32_BATCH_MAX;
+    for (first = 0; first + CRC_STREAMS <= count; first += CRC_STREAMS) {
+        //streams advance together over the length they have in common (fragments of a message are equally long),
+        //each stream finishes its own rest
+        common = lengths[first];
+        for (s = 1; s < CRC_STREAMS; s++)
+            common = lengths[first + s] < common ? lengths[first + s] : common;
+        common -= common % 8;
+        for (s = 0; s < CRC_STREAMS; s++)
+            crc[s] = 0xFFFFFFFF;
+        for (i = 0; i < common; i += 8) {
+            for (s = 0; s < CRC_STREAMS; s++)
+                crc[s] = crcWord(crc[s], messages[first + s] + i);
+        }
+        for (s = 0; s < CRC_STREAMS; s++) {
+            crc[s] = ~crcUpdate(crc[s], messages[first + s] + common, lengths[first + s] - common);
+            valid |= (unsigned long long) (crc[s] == expected[first + s]) << (first + s);
+        }
+    }
+    for (; first < count; first++)     //streams left over - one by one
+        valid |= (unsigned long long) (crc32b(messages[first], lengths[first]) == expected[first]) << first;
+    return valid;
+}
@@ -0,0 +1,29 @@
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stddef.h>
+
+#define CRC32_BATCH_MAX 64  //maximum number of the messages verified by one crc32Batch call
+
+/**
+ * Basic CRC32 algorithm
+ * @param message Message to be hashed
+ * @param length Length of the message
+ * @return CRC32-hashed message
+ */
+unsigned int crc32b(const unsigned char *message, size_t length);
+
+/**
+ * Verifies the CRC32 of a batch of independent messages (the packets of one received datagram). The messages are
+ * hashed in groups of four interleaved streams, so the table lookups of one stream overlap the dependency chain of
+ * the others
+ * @param messages Messages to be verified
+ * @param lengths Lengths of the messages
+ * @param expected Expected CRC32 of every message
+ * @param count Number of the messages, at most CRC32_BATCH_MAX
+ * @return bitmask with bit i set if message i matches its CRC
+ */
+unsigned long long crc32Batch(const unsigned char *const *messages, const size_t *lengths, const unsigned int *expected,
+                              int count);
+
+#endif //CRC32_H
@@ -0,0 +1,136 @@
+#include <stdlib.h>
+#include <string.h>
+#include "dedup.h"
+
+#define BUCKET_SLOTS 4      //fingerprints in one bucket
+#define MAX_KICKS 500       //relocations tried before the generation is considered full
+
+typedef struct generation {
+    unsigned int *slots;    //buckets * BUCKET_SLOTS fingerprints, 0 is an empty slot
+    long long startedAt;
+} generation;
+
+struct dedupFilter {
+    generation generations[2];
+    int current;            //index of the generation the ids are inserted into
+    size_t mask;            //number of buckets - 1
+    long long periodMs;
+};
+
+/**
+ * @return 64-bit mix of the id (splitmix64 finalizer)
+ */
+static unsigned long long mix(unsigned long long x) {
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+/**
+ * @return alternative bucket of the fingerprint stored in the bucket
+ */
+static size_t altBucket(const dedupFilter *filter, size_t bucket, unsigned int fingerprint) {
+    return (bucket ^ (size_t) mix(fingerprint)) & filter->mask;
+}
+
+static int bucketHas(const unsigned int *slots, size_t bucket, unsigned int fingerprint) {
+    const unsigned int *b = slots + bucket * BUCKET_SLOTS;
+    return b[0] == fingerprint || b[1] == fingerprint || b[2] == fingerprint || b[3] == fingerprint;
+}
+
+static int bucketPut(unsigned int *slots, size_t bucket, unsigned int fingerprint) {
+    unsigned int *b = slots + bucket * BUCKET_SLOTS;
+    int i;
+    for (i = 0; i < BUCKET_SLOTS; i++) {
+        if (b[i] == 0) {
+            b[i] = fingerprint;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Starts a new generation in place of the older one
+ */
+static void rotate(dedupFilter *filter, long long now) {
+    generation *older = &filter->generations[!filter->current];
+    memset(older->slots, 0, (filter->mask + 1) * BUCKET_SLOTS * sizeof(unsigned int));
+    older->startedAt = now;
+    filter->current = !filter->current;
+}
+
+dedupFilter *dedupCreate(size_t buckets, long long periodMs) {
+    dedupFilter *filter = calloc(1, sizeof(dedupFilter));
+    size_t count = 1;
+    int i;
+    if (filter == NULL)
+        return NULL;
+    while (count < buckets)
+        count <<= 1;
+    filter->mask = count - 1;
+    filter->periodMs = periodMs;
+    for (i = 0; i < 2; i++) {
+        if ((filter->generations[i].slots = calloc(count * BUCKET_SLOTS, sizeof(unsigned int))) == NULL) {
+            dedupDestroy(filter);
+            return NULL;
+        }
+    }
+    return filter;
+}
+
+int dedupContains(dedupFilter *filter, unsigned long long id, long long now) {
+    unsigned long long hash = mix(id);
+    unsigned int fingerprint = (unsigned int) (hash >> 32) | 1;     //non-zero
+    size_t first = (size_t) hash & filter->mask, second = altBucket(filter, first, fingerprint);
+    int i;
+
+    if (now - filter->generations[filter->current].startedAt >= filter->periodMs)
+        rotate(filter, now);
+    for (i = 0; i < 2; i++) {
+        const unsigned int *slots = filter->generations[i].slots;
+        if (bucketHas(slots, first, fingerprint) || bucketHas(slots, second, fingerprint))
+            return 1;
+    }
+    return 0;
+}
+
+void dedupInsert(dedupFilter *filter, unsigned long long id, long long now) {
+    unsigned long long hash = mix(id);
+    unsigned int fingerprint = (unsigned int) (hash >> 32) | 1;
+    size_t bucket = (size_t) hash & filter->mask;
+    unsigned int *slots;
+    int kick;
+
+    if (now - filter->generations[filter->current].startedAt >= filter->periodMs)
+        rotate(filter, now);
+    slots = filter->generations[filter->current].slots;
+    if (bucketPut(slots, bucket, fingerprint) || bucketPut(slots, altBucket(filter, bucket, fingerprint), fingerprint))
+        return;
+
+    //both buckets are full - fingerprints are relocated to their alternative buckets
+    bucket = altBucket(filter, bucket, fingerprint);
+    for (kick = 0; kick < MAX_KICKS; kick++) {
+        unsigned int *b = slots + bucket * BUCKET_SLOTS;
+        int slot = (int) (mix(fingerprint + kick) % BUCKET_SLOTS);
+        unsigned int evicted = b[slot];
+        b[slot] = fingerprint;
+        fingerprint = evicted;
+        bucket = altBucket(filter, bucket, fingerprint);
+        if (bucketPut(slots, bucket, fingerprint))
+            return;
+    }
+    //generation is full - a new one is started, the fingerprint left over is kept in it
+    rotate(filter, now);
+    bucketPut(filter->generations[filter->current].slots, bucket, fingerprint);
+}
+
+void dedupDestroy(dedupFilter *filter) {
+    if (filter == NULL)
+        return;
+    free(filter->generations[0].slots);
+    free(filter->generations[1].slots);
+    free(filter);
+}
@@ -0,0 +1,39 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <stddef.h>
+
+/**
+ * @brief Time-bounded set of 64-bit message ids, used to reject duplicate messages. It is a cuckoo filter (buckets of
+ * 32-bit fingerprints, every id has two candidate buckets) split into two generations: ids are inserted into the
+ * current one and looked up in both, the older generation is cleared and reused when the current one is older than
+ * the period or full. So an id is remembered at least for one period (unless the filter is full sooner), the memory
+ * is fixed and both operations take constant time. A lookup can report an id which was not inserted with
+ * the probability of about 2^-27.
+ */
+
+typedef struct dedupFilter dedupFilter;
+
+/**
+ * Creates the filter
+ * @param buckets Number of buckets of one generation (rounded up to a power of two), 4 ids fit into a bucket
+ * @param periodMs Minimum time for which an inserted id is remembered
+ * @return new filter or NULL if there is not enough memory
+ */
+dedupFilter *dedupCreate(size_t buckets, long long periodMs);
+
+/**
+ * @param now Current time in milliseconds (monotonic)
+ * @return non-zero if the id was inserted (within the period), 0 otherwise
+ */
+int dedupContains(dedupFilter *filter, unsigned long long id, long long now);
+
+/**
+ * Inserts the id into the current generation
+ * @param now Current time in milliseconds (monotonic)
+ */
+void dedupInsert(dedupFilter *filter, unsigned long long id, long long now);
+
+void dedupDestroy(dedupFilter *filter);
+
+#endif //DEDUP_H
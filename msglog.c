@@ -0,0 +1,883 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "crc32.h"
+#include "msglog.h"
+
+#define SEGMENT_NAME_LEN 20     //segment files are named by their base sequence number padded to 20 digits
+
+/**
+ * Segment of the log with its indexes
+ * Indexes of the active segment are built in the memory in the order of the appends. Indexes of a finished segment
+ * are sorted and written to the index files, segments of the previous runs are loaded (mapped) when they are queried
+ * for the first time.
+ */
+typedef struct logSegment {
+    unsigned long long baseSequence;
+    unsigned long long endSequence;     //sequence number after the last record
+    char *map;                          //mapping of the segment, NULL if it is not loaded yet
+    size_t mapSize;
+    size_t dataSize;                    //end of the valid records
+    logIndexEntry *index;               //sparse offset index
+    size_t indexCount, indexCapacity;
+    logKeyEntry *channels, *senders;    //secondary index
+    size_t keyCount, keyCapacity;
+    int sorted;                         //secondary index is sorted by the keys
+    void *indexMap, *keyMap;            //mappings of the index files, the indexes point into them if they are loaded
+    size_t indexMapSize, keyMapSize;
+} logSegment;
+
+struct msgLog {
+    char *directory;
+    size_t segmentSize;                 //size of the new segments
+    logSegment *segments;               //sorted by the base sequence, the last one is the active segment
+    size_t segmentCount, segmentCapacity;
+    int fd;                             //file descriptor of the active segment
+    size_t writeOffset;                 //end of the written data in the active segment
+    size_t syncedOffset;                //data before this offset are synced to the disk
+    unsigned long long nextSequence;
+    logNamesHeader *names;              //mapping of the names file
+    int namesDirty;                     //names table was changed since the last commit
+};
+
+static size_t alignRecord(size_t size) {
+    return (size + LOG_RECORD_ALIGN - 1) & ~(size_t) (LOG_RECORD_ALIGN - 1);
+}
+
+/**
+ * @return CRC of the record (header fields after the crc and the message)
+ */
+static unsigned int recordChecksum(const logRecordHeader *record, const void *data, size_t length) {
+    unsigned int crc = crc32b((const unsigned char *) record + sizeof(record->crc), sizeof(*record) - sizeof(record->crc));
+    return crc ^ crc32b(data, length);
+}
+
+static void segmentPath(const msgLog *log, unsigned long long baseSequence, const char *extension, char *path,
+                        size_t size) {
+    snprintf(path, size, "%s/%0*llu%s", log->directory, SEGMENT_NAME_LEN, baseSequence, extension);
+}
+
+static logSegment *activeSegment(msgLog *log) {
+    return log->segmentCount > 0 ? &log->segments[log->segmentCount - 1] : NULL;
+}
+
+/**
+ * Adds a segment after the existing ones
+ * @return new segment, NULL if there is not enough memory
+ */
+static logSegment *addSegment(msgLog *log, unsigned long long baseSequence) {
+    logSegment *segment;
+    if (log->segmentCount == log->segmentCapacity) {
+        size_t capacity = log->segmentCapacity ? log->segmentCapacity * 2 : 16;
+        logSegment *resized = realloc(log->segments, capacity * sizeof(logSegment));
+        if (resized == NULL)
+            return NULL;
+        log->segments = resized;
+        log->segmentCapacity = capacity;
+    }
+    segment = &log->segments[log->segmentCount++];
+    memset(segment, 0, sizeof(*segment));
+    segment->baseSequence = baseSequence;
+    segment->endSequence = baseSequence;
+    return segment;
+}
+
+static int compareBase(const void *a, const void *b) {
+    unsigned long long x = *(const unsigned long long *) a, y = *(const unsigned long long *) b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Finds the segment files in the log directory and adds them to the log (not loaded)
+ * @return 0 on success, -1 on error
+ */
+static int listSegments(msgLog *log) {
+    DIR *dir;
+    struct dirent *entry;
+    unsigned long long *bases = NULL;
+    size_t count = 0, capacity = 0, i;
+
+    if ((dir = opendir(log->directory)) == NULL)
+        return -1;
+    while ((entry = readdir(dir)) != NULL) {
+        char *end;
+        unsigned long long base;
+        if (strlen(entry->d_name) != SEGMENT_NAME_LEN + 4 || strcmp(entry->d_name + SEGMENT_NAME_LEN, ".log") != 0)
+            continue;
+        base = strtoull(entry->d_name, &end, 10);
+        if (end != entry->d_name + SEGMENT_NAME_LEN)
+            continue;
+        if (count == capacity) {
+            unsigned long long *resized;
+            capacity = capacity ? capacity * 2 : 16;
+            if ((resized = realloc(bases, capacity * sizeof(*bases))) == NULL) {
+                free(bases);
+                closedir(dir);
+                return -1;
+            }
+            bases = resized;
+        }
+        bases[count++] = base;
+    }
+    closedir(dir);
+
+    qsort(bases, count, sizeof(*bases), compareBase);
+    for (i = 0; i < count; i++) {
+        if (addSegment(log, bases[i]) == NULL) {
+            free(bases);
+            return -1;
+        }
+    }
+    free(bases);
+    return 0;
+}
+
+/**
+ * Adds the record to the indexes of the segment
+ * @return 0 on success, -1 if there is not enough memory
+ */
+static int indexRecord(logSegment *segment, const logRecordHeader *record, size_t offset) {
+    if ((record->sequence - segment->baseSequence) % LOG_INDEX_INTERVAL == 0) {
+        if (segment->indexCount == segment->indexCapacity) {
+            size_t capacity = segment->indexCapacity ? segment->indexCapacity * 2 : 64;
+            logIndexEntry *resized = realloc(segment->index, capacity * sizeof(logIndexEntry));
+            if (resized == NULL)
+                return -1;
+            segment->index = resized;
+            segment->indexCapacity = capacity;
+        }
+        segment->index[segment->indexCount].sequence = record->sequence;
+        segment->index[segment->indexCount].offset = offset;
+        segment->index[segment->indexCount].timestamp = record->timestamp;
+        segment->indexCount++;
+    }
+    if (segment->keyCount == segment->keyCapacity) {
+        size_t capacity = segment->keyCapacity ? segment->keyCapacity * 2 : 256;
+        logKeyEntry *channels = realloc(segment->channels, capacity * sizeof(logKeyEntry));
+        logKeyEntry *senders;
+        if (channels == NULL)
+            return -1;
+        segment->channels = channels;
+        if ((senders = realloc(segment->senders, capacity * sizeof(logKeyEntry))) == NULL)
+            return -1;
+        segment->senders = senders;
+        segment->keyCapacity = capacity;
+    }
+    segment->channels[segment->keyCount].key = record->channel;
+    segment->senders[segment->keyCount].key = LOG_SENDER_KEY(record->senderAddress, record->senderPort);
+    segment->channels[segment->keyCount].sequence = segment->senders[segment->keyCount].sequence = record->sequence;
+    segment->channels[segment->keyCount].offset = segment->senders[segment->keyCount].offset = offset;
+    segment->keyCount++;
+    return 0;
+}
+
+/**
+ * Scans the records of the mapped segment and builds its indexes in the memory
+ * Records are valid while their CRC matches and their sequence numbers follow each other, the rest is a torn tail
+ * @param size Size of the segment file
+ * @return 0 on success, -1 if there is not enough memory
+ */
+static int scanSegment(logSegment *segment, size_t size) {
+    size_t offset = alignRecord(sizeof(logSegmentHeader));
+    segment->endSequence = segment->baseSequence;
+    while (offset + sizeof(logRecordHeader) <= size) {
+        const logRecordHeader *record = (const logRecordHeader *) (segment->map + offset);
+        if (record->length == 0 || record->sequence != segment->endSequence ||
+            offset + sizeof(*record) + record->length > size ||
+            record->crc != recordChecksum(record, record + 1, record->length))
+            break;
+        if (indexRecord(segment, record, offset) < 0)
+            return -1;
+        offset += alignRecord(sizeof(*record) + record->length);
+        segment->endSequence++;
+    }
+    segment->dataSize = offset;
+    return 0;
+}
+
+static int compareKeys(const void *a, const void *b) {
+    const logKeyEntry *x = a, *y = b;
+    if (x->key != y->key)
+        return x->key < y->key ? -1 : 1;
+    return x->sequence < y->sequence ? -1 : x->sequence > y->sequence;
+}
+
+/**
+ * Writes the header and two arrays to the file and syncs it
+ * @return 0 on success, -1 on error
+ */
+static int writeFile(const char *path, const void *header, size_t headerSize, const void *data1, size_t size1,
+                     const void *data2, size_t size2) {
+    const void *parts[3] = { header, data1, data2 };
+    size_t sizes[3] = { headerSize, size1, size2 };
+    int fd, i;
+
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+        return -1;
+    for (i = 0; i < 3; i++) {
+        const char *p = parts[i];
+        size_t left = sizes[i];
+        while (left > 0) {
+            ssize_t written = write(fd, p, left);
+            if (written < 0) {
+                if (errno == EINTR)
+                    continue;
+                close(fd);
+                return -1;
+            }
+            p += written;
+            left -= (size_t) written;
+        }
+    }
+    if (fsync(fd) < 0) {
+        close(fd);
+        return -1;
+    }
+    return close(fd);
+}
+
+/**
+ * Sorts the secondary index of the finished segment and writes the index files
+ * @return 0 on success, -1 on error
+ */
+static int writeIndexes(msgLog *log, logSegment *segment) {
+    char path[4096];
+    logKeyFileHeader header;
+
+    if (!segment->sorted) {
+        qsort(segment->channels, segment->keyCount, sizeof(logKeyEntry), compareKeys);
+        qsort(segment->senders, segment->keyCount, sizeof(logKeyEntry), compareKeys);
+        segment->sorted = 1;
+    }
+    segmentPath(log, segment->baseSequence, ".idx", path, sizeof(path));
+    if (writeFile(path, NULL, 0, segment->index, segment->indexCount * sizeof(logIndexEntry), NULL, 0) < 0)
+        return -1;
+    header.magic = LOG_KEYS_MAGIC;
+    header.version = LOG_VERSION;
+    header.count = segment->keyCount;
+    segmentPath(log, segment->baseSequence, ".sidx", path, sizeof(path));
+    return writeFile(path, &header, sizeof(header), segment->channels, segment->keyCount * sizeof(logKeyEntry),
+                     segment->senders, segment->keyCount * sizeof(logKeyEntry));
+}
+
+/**
+ * Maps the index file
+ * @return mapping or NULL if the file does not exist or cannot be mapped
+ */
+static void *mapFile(const char *path, size_t *size) {
+    struct stat st;
+    void *map;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+    *size = (size_t) st.st_size;
+    return map;
+}
+
+/**
+ * Loads the indexes of the finished segment from its index files
+ * @return 0 on success, -1 if the files are missing or damaged
+ */
+static int loadIndexes(msgLog *log, logSegment *segment) {
+    char path[4096];
+    const logKeyFileHeader *header;
+
+    segmentPath(log, segment->baseSequence, ".idx", path, sizeof(path));
+    if ((segment->indexMap = mapFile(path, &segment->indexMapSize)) == NULL)
+        return -1;
+    segmentPath(log, segment->baseSequence, ".sidx", path, sizeof(path));
+    if ((segment->keyMap = mapFile(path, &segment->keyMapSize)) == NULL)
+        return -1;
+    header = segment->keyMap;
+    if (segment->indexMapSize % sizeof(logIndexEntry) != 0 || segment->keyMapSize < sizeof(*header) ||
+        header->magic != LOG_KEYS_MAGIC || header->version != LOG_VERSION ||
+        segment->keyMapSize != sizeof(*header) + 2 * header->count * sizeof(logKeyEntry))
+        return -1;
+
+    segment->index = segment->indexMap;
+    segment->indexCount = segment->indexMapSize / sizeof(logIndexEntry);
+    segment->channels = (logKeyEntry *) (header + 1);
+    segment->senders = segment->channels + header->count;
+    segment->keyCount = header->count;
+    segment->sorted = 1;
+    segment->endSequence = segment->baseSequence + header->count;
+    segment->dataSize = segment->mapSize;   //finished segment is truncated to its used size
+    return 0;
+}
+
+/**
+ * Releases the indexes of the segment (memory or mappings of the index files)
+ */
+static void releaseIndexes(logSegment *segment) {
+    if (segment->indexMap != NULL)
+        munmap(segment->indexMap, segment->indexMapSize);
+    else
+        free(segment->index);
+    if (segment->keyMap != NULL) {
+        munmap(segment->keyMap, segment->keyMapSize);
+    } else {
+        free(segment->channels);
+        free(segment->senders);
+    }
+    segment->indexMap = segment->keyMap = NULL;
+    segment->index = NULL;
+    segment->channels = segment->senders = NULL;
+    segment->indexCount = segment->indexCapacity = segment->keyCount = segment->keyCapacity = 0;
+    segment->sorted = 0;
+}
+
+/**
+ * Maps the finished segment of a previous run and loads its indexes (rebuilds them if the index files are damaged)
+ * @return 0 on success, -1 on error
+ */
+static int loadSegment(msgLog *log, logSegment *segment) {
+    char path[4096];
+    struct stat st;
+    const logSegmentHeader *header;
+    int fd;
+
+    if (segment->map != NULL)
+        return 0;
+    segmentPath(log, segment->baseSequence, ".log", path, sizeof(path));
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return -1;
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < alignRecord(sizeof(*header))) {
+        close(fd);
+        return -1;
+    }
+    segment->map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment->map == MAP_FAILED) {
+        segment->map = NULL;
+        return -1;
+    }
+    segment->mapSize = (size_t) st.st_size;
+    header = (const logSegmentHeader *) segment->map;
+    if (header->magic != LOG_SEGMENT_MAGIC || header->version != LOG_VERSION ||
+        header->baseSequence != segment->baseSequence) {
+        munmap(segment->map, segment->mapSize);
+        segment->map = NULL;
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (loadIndexes(log, segment) == 0)
+        return 0;
+    releaseIndexes(segment);
+    if (scanSegment(segment, segment->mapSize) < 0) {
+        releaseIndexes(segment);
+        return -1;
+    }
+    writeIndexes(log, segment);     //index files are rebuilt, they are not needed for this run if writing fails
+    return 0;
+}
+
+/**
+ * Creates and maps a new active segment starting with the next sequence number
+ * @return 0 on success, -1 on error
+ */
+static int createSegment(msgLog *log) {
+    char path[4096];
+    logSegmentHeader header;
+    logSegment *segment;
+
+    segmentPath(log, log->nextSequence, ".log", path, sizeof(path));
+    if ((log->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0)
+        return -1;
+    if ((segment = addSegment(log, log->nextSequence)) == NULL)
+        goto error;
+    //segment is preallocated, so the appends do not have to allocate the disk blocks
+    if (fallocate(log->fd, 0, 0, (off_t) log->segmentSize) < 0 &&
+        (errno != EOPNOTSUPP || ftruncate(log->fd, (off_t) log->segmentSize) < 0))
+        goto error;
+    segment->map = mmap(NULL, log->segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, log->fd, 0);
+    if (segment->map == MAP_FAILED) {
+        segment->map = NULL;
+        goto error;
+    }
+    segment->mapSize = log->segmentSize;
+
+    header.magic = LOG_SEGMENT_MAGIC;
+    header.version = LOG_VERSION;
+    header.baseSequence = log->nextSequence;
+    memcpy(segment->map, &header, sizeof(header));
+    log->writeOffset = alignRecord(sizeof(header));
+    log->syncedOffset = 0;
+    segment->dataSize = log->writeOffset;
+    return 0;
+
+error:
+    if (segment != NULL)
+        log->segmentCount--;
+    close(log->fd);
+    unlink(path);
+    log->fd = -1;
+    return -1;
+}
+
+/**
+ * Syncs the active segment, writes its index files and truncates it to the used size
+ * The mapping stays for reading, the area after the used size is never accessed
+ */
+static void finishSegment(msgLog *log) {
+    logSegment *segment = activeSegment(log);
+    if (log->fd < 0)
+        return;
+    msgLogCommit(log);
+    writeIndexes(log, segment);
+    if (ftruncate(log->fd, (off_t) log->writeOffset) == 0)
+        fsync(log->fd);
+    close(log->fd);
+    log->fd = -1;
+}
+
+/**
+ * Maps the last segment and finds the end of its valid records
+ * A segment which was not finished (it still has the preallocated size) stays active for appending,
+ * otherwise the next sequence number is taken from it and a new segment is started
+ * @return 0 on success, -1 on error
+ */
+static int recoverSegment(msgLog *log) {
+    char path[4096];
+    struct stat st;
+    const logSegmentHeader *header;
+    logSegment *segment = activeSegment(log);
+
+    segmentPath(log, segment->baseSequence, ".log", path, sizeof(path));
+    if ((log->fd = open(path, O_RDWR)) < 0 || fstat(log->fd, &st) < 0)
+        return -1;
+    log->nextSequence = segment->baseSequence;
+    if ((size_t) st.st_size < alignRecord(sizeof(*header))) {   //crash during the segment creation - it is created again
+        close(log->fd);
+        log->segmentCount--;
+        return createSegment(log);
+    }
+    segment->map = mmap(NULL, (size_t) st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, log->fd, 0);
+    if (segment->map == MAP_FAILED) {
+        segment->map = NULL;
+        return -1;
+    }
+    segment->mapSize = (size_t) st.st_size;
+    header = (const logSegmentHeader *) segment->map;
+    if (header->magic != LOG_SEGMENT_MAGIC || header->version != LOG_VERSION ||
+        header->baseSequence != segment->baseSequence) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (scanSegment(segment, segment->mapSize) < 0)
+        return -1;
+    log->nextSequence = segment->endSequence;
+    log->writeOffset = segment->dataSize;
+    log->syncedOffset = segment->dataSize;
+
+    if (segment->mapSize < log->segmentSize) {  //segment was finished - continue in a new one
+        writeIndexes(log, segment);
+        close(log->fd);
+        log->fd = -1;
+        return createSegment(log);
+    }
+    if (log->writeOffset + sizeof(logRecordHeader) <= segment->mapSize)
+        memset(segment->map + log->writeOffset, 0, sizeof(logRecordHeader));   //end marker after the last valid record
+    return 0;
+}
+
+/**
+ * @return names table entries (they follow the header of the names file)
+ */
+static logNameEntry *nameEntries(const msgLog *log) {
+    return (logNameEntry *) (log->names + 1);
+}
+
+/**
+ * Opens (or creates) and maps the names file
+ * @return 0 on success, -1 on error
+ */
+static int openNames(msgLog *log) {
+    char path[4096];
+    size_t size = sizeof(logNamesHeader) + LOG_MAX_NAMES * sizeof(logNameEntry);
+    struct stat st;
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/names", log->directory);
+    if ((fd = open(path, O_RDWR | O_CREAT, 0644)) < 0)
+        return -1;
+    if (fstat(fd, &st) < 0 || ((size_t) st.st_size < size && ftruncate(fd, (off_t) size) < 0)) {
+        close(fd);
+        return -1;
+    }
+    log->names = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (log->names == MAP_FAILED) {
+        log->names = NULL;
+        return -1;
+    }
+    if (st.st_size == 0) {  //new names file
+        log->names->magic = LOG_NAMES_MAGIC;
+        log->names->version = LOG_VERSION;
+        log->namesDirty = 1;
+    } else if (log->names->magic != LOG_NAMES_MAGIC || log->names->version != LOG_VERSION ||
+               log->names->count > LOG_MAX_NAMES) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+msgLog *msgLogOpen(const char *directory, size_t segmentSize) {
+    msgLog *log;
+
+    if (segmentSize < 4096) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (mkdir(directory, 0755) < 0 && errno != EEXIST)
+        return NULL;
+    if ((log = calloc(1, sizeof(msgLog))) == NULL)
+        return NULL;
+    log->fd = -1;
+    log->segmentSize = segmentSize;
+    log->nextSequence = 1;
+    if ((log->directory = strdup(directory)) == NULL || openNames(log) < 0 || listSegments(log) < 0 ||
+        (log->segmentCount > 0 ? recoverSegment(log) : createSegment(log)) < 0) {
+        msgLogClose(log);
+        return NULL;
+    }
+    return log;
+}
+
+int msgLogAppend(msgLog *log, logRecordHeader *record, const void *data, size_t length) {
+    size_t size = alignRecord(sizeof(*record) + length);
+    logSegment *segment = activeSegment(log);
+
+    if (length == 0 || length > 0xFFFFFFFFu || size + alignRecord(sizeof(logSegmentHeader)) > log->segmentSize) {
+        errno = length == 0 ? EINVAL : EMSGSIZE;
+        return -1;
+    }
+    if (log->fd < 0 || log->writeOffset + size > segment->mapSize) {    //segment is full - roll to a new one
+        finishSegment(log);
+        if (createSegment(log) < 0)
+            return -1;
+        segment = activeSegment(log);
+    }
+
+    record->length = (unsigned int) length;
+    record->sequence = log->nextSequence;
+    if (indexRecord(segment, record, log->writeOffset) < 0)
+        return -1;
+    record->crc = recordChecksum(record, data, length);
+    memcpy(segment->map + log->writeOffset + sizeof(*record), data, length);
+    memcpy(segment->map + log->writeOffset, record, sizeof(*record));
+    log->writeOffset += size;
+    log->nextSequence++;
+    segment->dataSize = log->writeOffset;
+    segment->endSequence = log->nextSequence;
+    return 0;
+}
+
+int msgLogCommit(msgLog *log) {
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t start;
+    logSegment *segment = activeSegment(log);
+    if (log->namesDirty) {
+        if (msync(log->names, sizeof(logNamesHeader) + log->names->count * sizeof(logNameEntry), MS_SYNC) < 0)
+            return -1;
+        log->namesDirty = 0;
+    }
+    if (log->fd < 0 || log->syncedOffset == log->writeOffset)
+        return 0;
+    start = log->syncedOffset & ~(page - 1);
+    if (msync(segment->map + start, log->writeOffset - start, MS_SYNC) < 0)
+        return -1;
+    log->syncedOffset = log->writeOffset;
+    return 0;
+}
+
+unsigned long long msgLogNextSequence(msgLog *log) {
+    return log->nextSequence;
+}
+
+/**
+ * @return non-zero if the record matches all the conditions of the query
+ */
+static int recordMatches(const logQuery *query, const logRecordHeader *record) {
+    return record->sequence >= query->fromSequence && record->timestamp >= query->fromTimestamp &&
+           (!query->filterChannel || record->channel == query->channel) &&
+           (!query->filterSender || LOG_SENDER_KEY(record->senderAddress, record->senderPort) == query->sender);
+}
+
+static void addResult(logRecordRef *results, size_t *count, const logRecordHeader *record) {
+    results[*count].header = record;
+    results[*count].data = (const char *) (record + 1);
+    (*count)++;
+}
+
+/**
+ * Finds the range of the secondary index entries with the key (the whole index if it is not sorted yet)
+ */
+static void keyRange(const logSegment *segment, const logKeyEntry *keys, unsigned long long key, size_t *from,
+                     size_t *to) {
+    size_t lo = 0, hi = segment->keyCount;
+    if (!segment->sorted) {
+        *from = 0;
+        *to = segment->keyCount;
+        return;
+    }
+    while (lo < hi) {   //first entry with the key
+        size_t mid = lo + (hi - lo) / 2;
+        if (keys[mid].key < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *from = lo;
+    hi = segment->keyCount;
+    while (lo < hi) {   //first entry after the key
+        size_t mid = lo + (hi - lo) / 2;
+        if (keys[mid].key <= key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *to = lo;
+}
+
+/**
+ * Query of one channel or sender - reads only the secondary index entries with the key and their records
+ */
+static size_t queryByKey(msgLog *log, const logQuery *query, logRecordRef *results) {
+    unsigned long long key = query->filterChannel ? query->channel : query->sender;
+    size_t count = 0, k, j, from, to;
+
+    for (k = 0; k < log->segmentCount && count < query->limit; k++) {
+        size_t index = query->newest ? log->segmentCount - 1 - k : k;
+        logSegment *segment = &log->segments[index];
+        const logKeyEntry *keys;
+
+        if (index + 1 < log->segmentCount && log->segments[index + 1].baseSequence <= query->fromSequence) {
+            if (query->newest)
+                break;
+            continue;   //whole segment is before the requested sequence
+        }
+        if (loadSegment(log, segment) < 0)
+            continue;
+        keys = query->filterChannel ? segment->channels : segment->senders;
+        keyRange(segment, keys, key, &from, &to);
+        for (j = 0; j < to - from && count < query->limit; j++) {
+            const logKeyEntry *entry = &keys[query->newest ? to - 1 - j : from + j];
+            const logRecordHeader *record = (const logRecordHeader *) (segment->map + entry->offset);
+            if (entry->key == key && recordMatches(query, record))
+                addResult(results, &count, record);
+        }
+    }
+    if (query->newest) {    //results were collected from the newest one
+        for (j = 0; j < count / 2; j++) {
+            logRecordRef swap = results[j];
+            results[j] = results[count - 1 - j];
+            results[count - 1 - j] = swap;
+        }
+    }
+    return count;
+}
+
+/**
+ * @return index of the segment which contains the sequence number (the first one if it is before all the segments)
+ */
+static size_t findSegment(const msgLog *log, unsigned long long sequence) {
+    size_t lo = 0, hi = log->segmentCount;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (log->segments[mid].baseSequence <= sequence)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/**
+ * @return sequence number from which the records received at the time or later start (approximately - the records
+ *  are in the order of the reception, the sparse index is searched)
+ */
+static unsigned long long seekTime(msgLog *log, long long timestamp) {
+    size_t lo = 0, hi = log->segmentCount, from, to;
+    logSegment *segment;
+
+    while (hi - lo > 1) {   //last segment whose first record is not newer than the time
+        size_t mid = lo + (hi - lo) / 2;
+        segment = &log->segments[mid];
+        if (loadSegment(log, segment) == 0 && segment->indexCount > 0 && segment->index[0].timestamp <= timestamp)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    segment = &log->segments[lo];
+    if (loadSegment(log, segment) < 0 || segment->indexCount == 0)
+        return segment->baseSequence;
+    from = 0;
+    to = segment->indexCount;
+    while (to - from > 1) {
+        size_t mid = from + (to - from) / 2;
+        if (segment->index[mid].timestamp <= timestamp)
+            from = mid;
+        else
+            to = mid;
+    }
+    return segment->index[from].sequence;
+}
+
+/**
+ * Query of all the records from the sequence number (or time) - seeks with the sparse index and reads the records
+ * sequentially
+ */
+static size_t queryBySequence(msgLog *log, const logQuery *query, logRecordRef *results) {
+    unsigned long long start = query->fromSequence;
+    size_t count = 0, k;
+
+    if (query->fromTimestamp > 0) {
+        unsigned long long timed = seekTime(log, query->fromTimestamp);
+        if (timed > start)
+            start = timed;
+    }
+    if (query->newest && log->nextSequence - start > query->limit)
+        start = log->nextSequence - query->limit;
+
+    for (k = findSegment(log, start); k < log->segmentCount && count < query->limit; k++) {
+        logSegment *segment = &log->segments[k];
+        size_t offset, from = 0, to;
+        if (loadSegment(log, segment) < 0)
+            continue;
+        to = segment->indexCount;
+        while (to - from > 1) {     //last index entry before the start
+            size_t mid = from + (to - from) / 2;
+            if (segment->index[mid].sequence <= start)
+                from = mid;
+            else
+                to = mid;
+        }
+        offset = segment->indexCount > 0 && segment->index[from].sequence <= start ? segment->index[from].offset :
+                 alignRecord(sizeof(logSegmentHeader));
+        while (offset < segment->dataSize && count < query->limit) {
+            const logRecordHeader *record = (const logRecordHeader *) (segment->map + offset);
+            if (record->sequence >= start && recordMatches(query, record))
+                addResult(results, &count, record);
+            offset += alignRecord(sizeof(*record) + record->length);
+        }
+    }
+    return count;
+}
+
+size_t msgLogQuery(msgLog *log, const logQuery *query, logRecordRef *results) {
+    if (query->limit == 0 || log->segmentCount == 0)
+        return 0;
+    if (query->filterChannel || query->filterSender)
+        return queryByKey(log, query, results);
+    return queryBySequence(log, query, results);
+}
+
+int msgLogRecord(msgLog *log, unsigned long long sequence, logRecordRef *result) {
+    logSegment *segment;
+    size_t offset, from = 0, to;
+
+    if (log->segmentCount == 0 || sequence == 0 || sequence >= log->nextSequence)
+        return -1;
+    segment = &log->segments[findSegment(log, sequence)];
+    if (loadSegment(log, segment) < 0 || sequence < segment->baseSequence || sequence >= segment->endSequence)
+        return -1;
+    to = segment->indexCount;
+    while (to - from > 1) {     //last index entry before the record
+        size_t mid = from + (to - from) / 2;
+        if (segment->index[mid].sequence <= sequence)
+            from = mid;
+        else
+            to = mid;
+    }
+    offset = segment->indexCount > 0 && segment->index[from].sequence <= sequence ? segment->index[from].offset :
+             alignRecord(sizeof(logSegmentHeader));
+    while (offset < segment->dataSize) {
+        const logRecordHeader *record = (const logRecordHeader *) (segment->map + offset);
+        if (record->sequence == sequence) {
+            result->header = record;
+            result->data = (const char *) (record + 1);
+            return 0;
+        }
+        offset += alignRecord(sizeof(*record) + record->length);
+    }
+    return -1;
+}
+
+unsigned int msgLogNameId(msgLog *log, const char *name) {
+    logNameEntry *entries = nameEntries(log);
+    unsigned int i;
+    for (i = 0; i < log->names->count; i++) {
+        if (strncmp(entries[i].name, name, LOG_NAME_MAX) == 0)
+            return i + 1;
+    }
+    if (log->names->count == LOG_MAX_NAMES)
+        return 0;
+    strncpy(entries[i].name, name, LOG_NAME_MAX - 1);
+    entries[i].cursor = 0;
+    log->names->count++;
+    log->namesDirty = 1;
+    return i + 1;
+}
+
+unsigned int msgLogNameCount(msgLog *log) {
+    return log->names->count;
+}
+
+const char *msgLogName(msgLog *log, unsigned int id) {
+    if (id == 0 || id > log->names->count)
+        return NULL;
+    return nameEntries(log)[id - 1].name;
+}
+
+unsigned long long msgLogCursor(msgLog *log, unsigned int id) {
+    if (id == 0 || id > log->names->count)
+        return 0;
+    return nameEntries(log)[id - 1].cursor;
+}
+
+void msgLogSetCursor(msgLog *log, unsigned int id, unsigned long long sequence) {
+    if (id == 0 || id > log->names->count)
+        return;
+    nameEntries(log)[id - 1].cursor = sequence;
+    log->namesDirty = 1;
+}
+
+void msgLogClose(msgLog *log) {
+    size_t i;
+    if (log == NULL)
+        return;
+    if (log->fd >= 0) {
+        msgLogCommit(log);
+        close(log->fd);
+    }
+    for (i = 0; i < log->segmentCount; i++) {
+        if (log->segments[i].map != NULL)
+            munmap(log->segments[i].map, log->segments[i].mapSize);
+        releaseIndexes(&log->segments[i]);
+    }
+    if (log->names != NULL) {
+        if (log->namesDirty)
+            msync(log->names, sizeof(logNamesHeader) + log->names->count * sizeof(logNameEntry), MS_SYNC);
+        munmap(log->names, sizeof(logNamesHeader) + LOG_MAX_NAMES * sizeof(logNameEntry));
+    }
+    free(log->segments);
+    free(log->directory);
+    free(log);
+}
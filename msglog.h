@@ -0,0 +1,212 @@
+#ifndef MSGLOG_H
+#define MSGLOG_H
+
+#include <stddef.h>
+
+/**
+ * @brief Persistent append-only message log used by the server. Messages are appended as records to segment files
+ * (<base sequence>.log) in the log directory. Every segment is preallocated with fallocate, mapped into the memory
+ * and written sequentially, the dirty part of the mapping is synced to the disk by msgLogCommit, so several appended
+ * records share one sync (group commit). A finished segment is truncated to its used size and a new one is started.
+ *
+ * Every segment has two index files, written when the segment is finished (and rebuilt from the segment if they are
+ * missing): sparse offset index (<base>.idx) with an entry for every LOG_INDEX_INTERVAL-th record, used to seek by
+ * sequence number or time, and secondary index (<base>.sidx) with the records sorted by channel and by sender, used to
+ * find the messages of one channel or sender without scanning. Both files and the segments are read through mmap,
+ * the records returned by msgLogQuery point directly into the mappings and stay valid until the log is closed.
+ *
+ * The log also keeps the table of client names (names file), so the records can refer to their sender and recipient
+ * by a small id, and the drain cursor of every recipient - the sequence number of the last record the recipient has
+ * acknowledged. The table is mapped and synced together with the records.
+ */
+
+#define LOG_SEGMENT_MAGIC 0x474F4C43u   //"CLOG"
+#define LOG_KEYS_MAGIC 0x59454B43u      //"CKEY"
+#define LOG_NAMES_MAGIC 0x4D414E43u     //"CNAM"
+#define LOG_VERSION 4
+#define LOG_RECORD_ALIGN 8              //records start at offsets aligned to 8 bytes
+#define LOG_INDEX_INTERVAL 64           //sparse index has an entry for every 64th record of a segment
+#define LOG_NAME_MAX 32                 //maximum length of a client name including the terminating zero
+#define LOG_MAX_NAMES 4096              //capacity of the names table
+
+#define LOG_SENDER_KEY(address, port) (((unsigned long long) (address) << 16) | (unsigned short) (port))
+
+/**
+ * Header at the beginning of every segment file
+ */
+typedef struct logSegmentHeader {
+    unsigned int magic;
+    unsigned int version;
+    unsigned long long baseSequence;    //sequence number of the first record in the segment
+} logSegmentHeader;
+
+/**
+ * Header of one record, followed by length bytes of the message
+ * CRC covers the rest of the header and the message, zero length with zero CRC marks the end of the written data
+ */
+typedef struct logRecordHeader {
+    unsigned int crc;
+    unsigned int length;
+    unsigned long long sequence;
+    long long timestamp;                //time of the reception in milliseconds since the epoch
+    unsigned int senderAddress;         //IPv4 address and port of the sender (network byte order)
+    unsigned short senderPort;
+    unsigned short priority;            //priority class of the message
+    unsigned int messageId;             //id of the message within the session of the sender
+    unsigned int channel;
+    unsigned int senderId;              //name id of the sender, 0 if the sender has no name
+    unsigned int recipientId;           //name id of the client the message is relayed to, 0 if it is not relayed
+    unsigned long long id;              //64-bit id of the message assigned by its sender (for deduplication)
+    long long deadline;                 //time (milliseconds since the epoch) when the TTL expires, 0 for no limit
+} logRecordHeader;
+
+/**
+ * Entry of the sparse offset index (.idx file is an array of them)
+ */
+typedef struct logIndexEntry {
+    unsigned long long sequence;
+    unsigned long long offset;          //offset of the record in the segment
+    long long timestamp;
+} logIndexEntry;
+
+/**
+ * Entry of the secondary index, key is the channel or LOG_SENDER_KEY of the sender
+ */
+typedef struct logKeyEntry {
+    unsigned long long key;
+    unsigned long long sequence;
+    unsigned long long offset;
+} logKeyEntry;
+
+/**
+ * Header of the .sidx file, followed by count entries sorted by channel and count entries sorted by sender
+ * (entries with the same key are sorted by the sequence number)
+ */
+typedef struct logKeyFileHeader {
+    unsigned int magic;
+    unsigned int version;
+    unsigned long long count;
+} logKeyFileHeader;
+
+/**
+ * Header of the names file, followed by LOG_MAX_NAMES entries (name id is the index of the entry + 1)
+ */
+typedef struct logNamesHeader {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int count;
+    unsigned int reserved;
+} logNamesHeader;
+
+typedef struct logNameEntry {
+    char name[LOG_NAME_MAX];
+    unsigned long long cursor;          //sequence number of the last record acknowledged by the client
+} logNameEntry;
+
+/**
+ * Record found by msgLogQuery - pointers into the segment mapping
+ */
+typedef struct logRecordRef {
+    const logRecordHeader *header;
+    const char *data;
+} logRecordRef;
+
+/**
+ * History query - records with sequence >= fromSequence and timestamp >= fromTimestamp, optionally only of one
+ * channel and/or one sender; at most limit records, the first ones or (newest set) the last ones
+ */
+typedef struct logQuery {
+    unsigned long long fromSequence;
+    long long fromTimestamp;
+    int filterChannel;
+    unsigned int channel;
+    int filterSender;
+    unsigned long long sender;          //LOG_SENDER_KEY of the sender
+    size_t limit;
+    int newest;
+} logQuery;
+
+typedef struct msgLog msgLog;
+
+/**
+ * Opens the log in the directory (the directory is created if it does not exist), the last segment is scanned and the
+ * writing continues after its last valid record
+ * @param directory Log directory
+ * @param segmentSize Size of a segment file in bytes
+ * @return opened log or NULL on error (errno is set)
+ */
+msgLog *msgLogOpen(const char *directory, size_t segmentSize);
+
+/**
+ * Appends the record to the log, the record is not durable until msgLogCommit is called
+ * @param log Log
+ * @param record Header of the record - sequence, length and crc are filled by the log
+ * @param data Message
+ * @param length Length of the message
+ * @return 0 on success, -1 on error (errno is set)
+ */
+int msgLogAppend(msgLog *log, logRecordHeader *record, const void *data, size_t length);
+
+/**
+ * Syncs all the appended records to the disk
+ * @return 0 on success, -1 on error
+ */
+int msgLogCommit(msgLog *log);
+
+/**
+ * @return sequence number of the next appended record
+ */
+unsigned long long msgLogNextSequence(msgLog *log);
+
+/**
+ * Finds the records matching the query, seeks with the indexes instead of scanning the whole log
+ * @param log Log
+ * @param query Query
+ * @param results Array with room for query->limit records, filled in the order of the sequence numbers
+ * @return number of found records
+ */
+size_t msgLogQuery(msgLog *log, const logQuery *query, logRecordRef *results);
+
+/**
+ * Finds the record with the sequence number
+ * @param log Log
+ * @param sequence Sequence number
+ * @param result Filled with the record
+ * @return 0 on success, -1 if there is no such record
+ */
+int msgLogRecord(msgLog *log, unsigned long long sequence, logRecordRef *result);
+
+/**
+ * Finds the name in the names table, adds it if it is not there
+ * @param log Log
+ * @param name Client name
+ * @return name id, 0 if the table is full
+ */
+unsigned int msgLogNameId(msgLog *log, const char *name);
+
+/**
+ * @return number of the names in the names table (ids are 1..count)
+ */
+unsigned int msgLogNameCount(msgLog *log);
+
+/**
+ * @return name with the id, NULL if there is no such name
+ */
+const char *msgLogName(msgLog *log, unsigned int id);
+
+/**
+ * @return drain cursor of the name (0 if nothing was acknowledged yet)
+ */
+unsigned long long msgLogCursor(msgLog *log, unsigned int id);
+
+/**
+ * Moves the drain cursor of the name, the cursor is synced to the disk with the next msgLogCommit
+ */
+void msgLogSetCursor(msgLog *log, unsigned int id, unsigned long long sequence);
+
+/**
+ * Commits the appended records and closes the log
+ */
+void msgLogClose(msgLog *log);
+
+#endif //MSGLOG_H
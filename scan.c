@@ -0,0 +1,43 @@
+#include <limits.h>
+#include "scan.h"
+
+int scanFind(const long long *values, int count, long long value) {
+    int i, found = -1;
+    for (i = 0; i < count; i++)
+        found = values[i] == value ? i : found;
+    return found;
+}
+
+long long scanMin(const long long *values, int count) {
+    long long nearest = LLONG_MAX;
+    int i;
+    for (i = 0; i < count; i++)
+        nearest = values[i] < nearest ? values[i] : nearest;
+    return nearest;
+}
+
+long long scanSum(const long long *values, int count) {
+    long long sum = 0;
+    int i;
+    for (i = 0; i < count; i++)
+        sum += values[i];
+    return sum;
+}
+
+int scanDue(const long long *values, int count, long long limit, int *due) {
+    int i, n = 0;
+    for (i = 0; i < count; i++) {
+        due[n] = i;
+        n += values[i] <= limit;
+    }
+    return n;
+}
+
+int scanAbove(const long long *values, int count, long long limit, int *found) {
+    int i, n = 0;
+    for (i = 0; i < count; i++) {
+        found[n] = i;
+        n += values[i] > limit;
+    }
+    return n;
+}
@@ -0,0 +1,39 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+/**
+ * @brief Scan kernels over the dense session arrays of a context - loops without early exits and data-dependent
+ * branches, so the compiler turns them into SIMD compares and blends. They are generic over the count, the context
+ * scans its session table with them and commbench sweeps large synthetic arrays.
+ */
+
+/**
+ * @return index of the last value equal to value, -1 if there is none
+ */
+int scanFind(const long long *values, int count, long long value);
+
+/**
+ * @return smallest of the values, LLONG_MAX if count is 0
+ */
+long long scanMin(const long long *values, int count);
+
+/**
+ * @return sum of the values
+ */
+long long scanSum(const long long *values, int count);
+
+/**
+ * Collects the indexes of the values not greater than limit
+ * @param due Array of count indexes
+ * @return number of the collected indexes
+ */
+int scanDue(const long long *values, int count, long long limit, int *due);
+
+/**
+ * Collects the indexes of the values greater than limit
+ * @param found Array of count indexes
+ * @return number of the collected indexes
+ */
+int scanAbove(const long long *values, int count, long long limit, int *found);
+
+#endif //SCAN_H
@@ -0,0 +1,139 @@
+#include <string.h>
+#include "siphash.h"
+
+#define SIP_LANES 4     //messages hashed in lockstep by sipHashBatch
+
+#define ROTL(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+
+/**
+ * @return little-endian 64-bit word of the 8 bytes
+ */
+static inline unsigned long long loadWord(const unsigned char *p) {
+    return (unsigned long long) p[0] | (unsigned long long) p[1] << 8 | (unsigned long long) p[2] << 16 |
+           (unsigned long long) p[3] << 24 | (unsigned long long) p[4] << 32 | (unsigned long long) p[5] << 40 |
+           (unsigned long long) p[6] << 48 | (unsigned long long) p[7] << 56;
+}
+
+/**
+ * One SipRound of the state v
+ */
+static inline void sipRound(unsigned long long *v) {
+    v[0] += v[1];
+    v[1] = ROTL(v[1], 13);
+    v[1] ^= v[0];
+    v[0] = ROTL(v[0], 32);
+    v[2] += v[3];
+    v[3] = ROTL(v[3], 16);
+    v[3] ^= v[2];
+    v[0] += v[3];
+    v[3] = ROTL(v[3], 21);
+    v[3] ^= v[0];
+    v[2] += v[1];
+    v[1] = ROTL(v[1], 17);
+    v[1] ^= v[2];
+    v[2] = ROTL(v[2], 32);
+}
+
+/**
+ * Initializes the state v from the key
+ */
+static void sipInit(unsigned long long *v, const unsigned char *key) {
+    unsigned long long k0 = loadWord(key), k1 = loadWord(key + 8);
+    v[0] = k0 ^ 0x736f6d6570736575ULL;
+    v[1] = k1 ^ 0x646f72616e646f6dULL;
+    v[2] = k0 ^ 0x6c7967656e657261ULL;
+    v[3] = k1 ^ 0x7465646279746573ULL;
+}
+
+/**
+ * Compresses the 64-bit word into the state v
+ */
+static inline void sipCompress(unsigned long long *v, unsigned long long m) {
+    v[3] ^= m;
+    sipRound(v);
+    sipRound(v);
+    v[0] ^= m;
+}
+
+/**
+ * Absorbs the rest of the message after its first offset bytes (hashed already) and finalizes the state v
+ * @return tag of the message
+ */
+static unsigned long long sipFinish(unsigned long long *v, const unsigned char *message, size_t length, size_t offset) {
+    unsigned char last[8] = { 0 };
+    for (; offset + 8 <= length; offset += 8)
+        sipCompress(v, loadWord(message + offset));
+    memcpy(last, message + offset, length - offset);
+    sipCompress(v, loadWord(last) | (unsigned long long) (length & 0xFF) << 56);
+    v[2] ^= 0xFF;
+    sipRound(v);
+    sipRound(v);
+    sipRound(v);
+    sipRound(v);
+    return v[0] ^ v[1] ^ v[2] ^ v[3];
+}
+
+unsigned long long sipHash(const unsigned char *key, const unsigned char *message, size_t length) {
+    unsigned long long v[4];
+    sipInit(v, key);
+    return sipFinish(v, message, length, 0);
+}
+
+void sipHashBatch(const unsigned char *key, const unsigned char *const *messages, const size_t *lengths,
+                  unsigned long long *tags, int count) {
+    unsigned long long v0[SIP_LANES], v1[SIP_LANES], v2[SIP_LANES], v3[SIP_LANES], m[SIP_LANES], init[4], v[4];
+    size_t common, i;
+    int first, s;
+
+    sipInit(init, key);
+    for (first = 0; first + SIP_LANES <= count; first += SIP_LANES) {
+        //lanes advance together over the length they have in common (fragments of a message are equally long),
+        //each lane finishes its own rest - the state is kept by lanes, so every step is one operation on all lanes
+        common = lengths[first];
+        for (s = 1; s < SIP_LANES; s++)
+            common = lengths[first + s] < common ? lengths[first + s] : common;
+        common -= common % 8;
+        for (s = 0; s < SIP_LANES; s++) {
+            v0[s] = init[0];
+            v1[s] = init[1];
+            v2[s] = init[2];
+            v3[s] = init[3];
+        }
+        for (i = 0; i < common; i += 8) {
+            int r;
+            for (s = 0; s < SIP_LANES; s++) {
+                m[s] = loadWord(messages[first + s] + i);
+                v3[s] ^= m[s];
+            }
+            for (r = 0; r < 2; r++) {
+                for (s = 0; s < SIP_LANES; s++) {
+                    v0[s] += v1[s];
+                    v1[s] = ROTL(v1[s], 13);
+                    v1[s] ^= v0[s];
+                    v0[s] = ROTL(v0[s], 32);
+                    v2[s] += v3[s];
+                    v3[s] = ROTL(v3[s], 16);
+                    v3[s] ^= v2[s];
+                    v0[s] += v3[s];
+                    v3[s] = ROTL(v3[s], 21);
+                    v3[s] ^= v0[s];
+                    v2[s] += v1[s];
+                    v1[s] = ROTL(v1[s], 17);
+                    v1[s] ^= v2[s];
+                    v2[s] = ROTL(v2[s], 32);
+                }
+            }
+            for (s = 0; s < SIP_LANES; s++)
+                v0[s] ^= m[s];
+        }
+        for (s = 0; s < SIP_LANES; s++) {
+            v[0] = v0[s];
+            v[1] = v1[s];
+            v[2] = v2[s];
+            v[3] = v3[s];
+            tags[first + s] = sipFinish(v, messages[first + s], lengths[first + s], common);
+        }
+    }
+    for (; first < count; first++)     //messages left over - one by one
+        tags[first] = sipHash(key, messages[first], lengths[first]);
+}
@@ -0,0 +1,30 @@
+#ifndef SIPHASH_H
+#define SIPHASH_H
+
+#include <stddef.h>
+
+#define SIPHASH_KEY_SIZE 16     //size of the SipHash key in bytes
+
+/**
+ * SipHash-2-4 keyed hash (64-bit tag) - a MAC fast enough for short messages
+ * @param key 128-bit key
+ * @param message Message to be authenticated
+ * @param length Length of the message
+ * @return tag of the message
+ */
+unsigned long long sipHash(const unsigned char *key, const unsigned char *message, size_t length);
+
+/**
+ * Computes the SipHash-2-4 tags of a batch of messages under one key (the packets of one received datagram). The
+ * messages are hashed in groups of four lanes kept in arrays, so the compiler runs the rounds of the lanes as SIMD
+ * operations
+ * @param key 128-bit key
+ * @param messages Messages to be authenticated
+ * @param lengths Lengths of the messages
+ * @param tags Filled with the tags of the messages
+ * @param count Number of the messages
+ */
+void sipHashBatch(const unsigned char *key, const unsigned char *const *messages, const size_t *lengths,
+                  unsigned long long *tags, int count);
+
+#endif //SIPHASH_H
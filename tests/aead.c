@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <string.h>
+#include "aead.h"
+#include "check.h"
+#define MAX_LENGTH 300
+
+/**
+ * @brief Tests of ChaCha20-Poly1305 - the AEAD test vector of RFC 8439, and sealed batches opening again with the
+ * tampered packets rejected and left untouched.
+ */
+
+/**
+ * Test vector of RFC 8439 section 2.8.2
+ */
+static int testVector(void) {
+    static const unsigned char nonce[AEAD_NONCE_SIZE] = {
+        0x07, 0x00, 0x00, 0x00, 0x40, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47
+    };
+    static const unsigned char aad[] = {
+        0x50, 0x51, 0x52, 0x53, 0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7
+    };
+    static const char plaintext[] = "Ladies and Gentlemen of the class of '99: If I could offer you only one tip for "
+                                    "the future, sunscreen would be it.";
+    static const unsigned char ciphertext[] = {
+        0xd3, 0x1a, 0x8d, 0x34, 0x64, 0x8e, 0x60, 0xdb, 0x7b, 0x86, 0xaf, 0xbc, 0x53, 0xef, 0x7e, 0xc2,
+        0xa4, 0xad, 0xed, 0x51, 0x29, 0x6e, 0x08, 0xfe, 0xa9, 0xe2, 0xb5, 0xa7, 0x36, 0xee, 0x62, 0xd6,
+        0x3d, 0xbe, 0xa4, 0x5e, 0x8c, 0xa9, 0x67, 0x12, 0x82, 0xfa, 0xfb, 0x69, 0xda, 0x92, 0x72, 0x8b,
+        0x1a, 0x71, 0xde, 0x0a, 0x9e, 0x06, 0x0b, 0x29, 0x05, 0xd6, 0xa5, 0xb6, 0x7e, 0xcd, 0x3b, 0x36,
+        0x92, 0xdd, 0xbd, 0x7f, 0x2d, 0x77, 0x8b, 0x8c, 0x98, 0x03, 0xae, 0xe3, 0x28, 0x09, 0x1b, 0x58,
+        0xfa, 0xb3, 0x24, 0xe4, 0xfa, 0xd6, 0x75, 0x94, 0x55, 0x85, 0x80, 0x8b, 0x48, 0x31, 0xd7, 0xbc,
+        0x3f, 0xf4, 0xde, 0xf0, 0x8e, 0x4b, 0x7a, 0x9d, 0xe5, 0x76, 0xd2, 0x65, 0x86, 0xce, 0xc6, 0x4b,
+        0x61, 0x16
+    };
+    static const unsigned char expectedTag[AEAD_TAG_SIZE] = {
+        0x1a, 0xe1, 0x0b, 0x59, 0x4f, 0x09, 0xe2, 0x6a, 0x7e, 0x90, 0x2e, 0xcb, 0xd0, 0x60, 0x06, 0x91
+    };
+    unsigned char key[AEAD_KEY_SIZE], data[sizeof(plaintext) - 1], tag[AEAD_TAG_SIZE];
+    aeadPacket packet = { nonce, aad, sizeof(aad), data, sizeof(data), tag };
+    int i;
+
+    CHECK(sizeof(data) == sizeof(ciphertext));
+    for (i = 0; i < AEAD_KEY_SIZE; i++)
+        key[i] = (unsigned char) (0x80 + i);
+    memcpy(data, plaintext, sizeof(data));
+    aeadSealBatch(key, &packet, 1);
+    CHECK(memcmp(data, ciphertext, sizeof(data)) == 0);
+    CHECK(memcmp(tag, expectedTag, AEAD_TAG_SIZE) == 0);
+    CHECK(aeadOpenBatch(key, &packet, 1) == 1);
+    CHECK(memcmp(data, plaintext, sizeof(data)) == 0);
+    return 0;
+}
+
+/**
+ * Batches of every count - every packet opens again except the ones with a flipped bit in the tag, the data or the
+ * additional data, which stay encrypted
+ */
+static int testBatch(void) {
+    static unsigned char plain[AEAD_BATCH_MAX][MAX_LENGTH], data[AEAD_BATCH_MAX][MAX_LENGTH];
+    unsigned char key[AEAD_KEY_SIZE], nonces[AEAD_BATCH_MAX][AEAD_NONCE_SIZE], aads[AEAD_BATCH_MAX][16];
+    unsigned char tags[AEAD_BATCH_MAX][AEAD_TAG_SIZE];
+    aeadPacket packets[AEAD_BATCH_MAX];
+    unsigned long long valid;
+    int count, i, j;
+
+    for (i = 0; i < AEAD_KEY_SIZE; i++)
+        key[i] = (unsigned char) (i * 13 + 5);
+    for (i = 0; i < AEAD_BATCH_MAX; i++) {
+        for (j = 0; j < MAX_LENGTH; j++)
+            plain[i][j] = (unsigned char) (i * 31 + j * 17);
+        memset(nonces[i], 0, AEAD_NONCE_SIZE);
+        nonces[i][0] = (unsigned char) i;
+        memset(aads[i], i, sizeof(aads[i]));
+    }
+    for (count = 1; count <= AEAD_BATCH_MAX; count++) {
+        for (i = 0; i < count; i++) {
+            memcpy(data[i], plain[i], MAX_LENGTH);
+            packets[i] = (aeadPacket) { nonces[i], aads[i], (size_t) (i % 17), data[i],
+                                        (size_t) ((i * 37 + count * 11) % MAX_LENGTH), tags[i] };
+        }
+        aeadSealBatch(key, packets, count);
+        for (i = 0; i < count; i++)
+            CHECK(packets[i].length == 0 || memcmp(data[i], plain[i], packets[i].length) != 0);
+        for (i = 1; i < count; i += 4) {
+            if (i % 3 == 0 && packets[i].length > 0)
+                data[i][0] ^= 1;
+            else if (i % 3 == 1 && packets[i].aadLength > 0)
+                aads[i][0] ^= 1;
+            else
+                tags[i][i % AEAD_TAG_SIZE] ^= 1;
+        }
+        valid = aeadOpenBatch(key, packets, count);
+        for (i = 0; i < count; i++) {
+            CHECK((valid >> i & 1) == (i % 4 != 1));
+            CHECK((memcmp(data[i], plain[i], packets[i].length) == 0) == (i % 4 != 1 || packets[i].length == 0));
+        }
+        CHECK(count == AEAD_BATCH_MAX || valid >> count == 0);
+        for (i = 1; i < count; i += 4)
+            if (i % 3 == 1 && packets[i].aadLength > 0)
+                aads[i][0] ^= 1;
+    }
+    return 0;
+}
+
+int main(void) {
+    static const testCase tests[] = {
+        { "rfc 8439 vector", testVector },
+        { "batch", testBatch },
+    };
+
+    return RUN_TESTS(tests);
+}
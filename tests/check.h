@@ -0,0 +1,44 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/**
+ * @brief Assertion and runner of the test programs - a failed check prints its location and makes the test function
+ * return 1, the runner reports every test of the table and fails if any of them failed.
+ */
+#define CHECK(condition) do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            return 1; \
+        } \
+    } while (0)
+
+/**
+ * Test of a program - returns 0 if it passed
+ */
+typedef struct testCase {
+    const char *name;
+    int (*run)(void);
+} testCase;
+
+/**
+ * Runs the tests in the order of the table and prints the result of every one
+ * @return exit status of the program - 0 if all the tests passed, 1 otherwise
+ */
+static inline int runTests(const testCase *tests, size_t count) {
+    int failed = 0;
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        int result = tests[i].run();
+        printf("%s: %s\n", tests[i].name, result == 0 ? "ok" : "FAILED");
+        failed += result != 0;
+    }
+    return failed > 0;
+}
+
+#define RUN_TESTS(tests) runTests(tests, sizeof(tests) / sizeof((tests)[0]))
+
+#endif //CHECK_H
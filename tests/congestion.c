@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <string.h>
+#include "communicator.h"
+#include "congestion.h"
+#include "check.h"
+#define PACKET 1000             //bytes of every packet of the simulated flow
+#define RATE 1000000.0          //bottleneck bandwidth of the simulated link (bytes per second)
+#define RTT_US 10000            //round trip of the link
+#define INTERVAL_US 1000        //time between two packets at the bottleneck bandwidth
+#define IN_FLIGHT (RTT_US / INTERVAL_US)    //packets in flight at the bandwidth-delay product
+#define MAX_WINDOW 256
+
+/**
+ * @brief Tests of the congestion control - synthetic sequences of acknowledgements, losses and CE marks passed to the
+ * controller, checking the window and the pacing rate after every transition of the model.
+ */
+
+/**
+ * Flow at the bottleneck bandwidth - a packet is sent every INTERVAL_US and acknowledged RTT_US later
+ */
+typedef struct flow {
+    congestionState cc;
+    congestionSample samples[IN_FLIGHT];    //packets in flight, by their number modulo IN_FLIGHT
+    long long now;
+    int sent;
+    double maxGain;     //largest pacing gain seen by the acknowledgements since the last reset
+} flow;
+
+static void startFlow(flow *f, int mode) {
+    memset(f, 0, sizeof(*f));
+    congestionInit(&f->cc, mode, MAX_WINDOW);
+    f->now = 1000000;
+}
+
+/**
+ * Runs the flow for the number of packets - every acknowledgement reports marks CE marked packets
+ */
+static void runFlow(flow *f, int packets, int marks) {
+    int i;
+    for (i = 0; i < packets; i++, f->sent++, f->now += INTERVAL_US) {
+        congestionSample *sample = &f->samples[f->sent % IN_FLIGHT];
+        if (f->sent >= IN_FLIGHT) {
+            double gain;
+            congestionRtt(&f->cc, RTT_US, f->now);
+            if (marks > 0)
+                congestionMarked(&f->cc, sample, marks, f->now);
+            congestionAcked(&f->cc, sample, PACKET, IN_FLIGHT - 1, PACKET, f->now);
+            if (f->cc.bandwidth > 0 && (gain = congestionPacingRate(&f->cc) / f->cc.bandwidth) > f->maxGain)
+                f->maxGain = gain;
+        }
+        congestionSent(&f->cc, sample, f->now);
+    }
+}
+
+/**
+ * Fixed window - the configured window, nothing is paced and losses do not matter
+ */
+static int testFixed(void) {
+    congestionState cc;
+    congestionSample sample;
+
+    congestionInit(&cc, COMM_CONGESTION_FIXED, 32);
+    CHECK(congestionWindow(&cc, PACKET) == 32);
+    congestionSent(&cc, &sample, 1000);
+    congestionLost(&cc, &sample, 2000);
+    CHECK(congestionWindow(&cc, PACKET) == 32);
+    CHECK(congestionPacingRate(&cc) == 0);
+    CHECK(congestionPace(&cc, PACKET, 3000) == 1 && congestionPaceDelay(&cc, PACKET, 3000) == 0);
+    return 0;
+}
+
+/**
+ * AIMD - slow start adds a packet per acknowledgement, a loss halves the window once per round trip (down to the
+ * minimum), congestion avoidance adds a packet per window and the window stays below the send window
+ */
+static int testAimd(void) {
+    congestionState cc;
+    congestionSample first, late;
+    long long now = 1000;
+    int i;
+
+    congestionInit(&cc, COMM_CONGESTION_AIMD, 64);
+    CHECK(congestionWindow(&cc, PACKET) == 10);
+    congestionSent(&cc, &first, now);
+    for (i = 0; i < 10; i++)
+        congestionAcked(&cc, &first, PACKET, 0, PACKET, now += 100);
+    CHECK(congestionWindow(&cc, PACKET) == 20);
+
+    congestionLost(&cc, &first, now += 100);
+    CHECK(congestionWindow(&cc, PACKET) == 10);
+    congestionLost(&cc, &first, now += 100);       //sent before the reduction - the same congestion event
+    CHECK(congestionWindow(&cc, PACKET) == 10);
+    congestionSent(&cc, &late, now += 100);
+    congestionLost(&cc, &late, now += 100);
+    CHECK(congestionWindow(&cc, PACKET) == 5);
+    congestionSent(&cc, &late, now += 100);
+    congestionLost(&cc, &late, now += 100);
+    CHECK(congestionWindow(&cc, PACKET) == 4);
+    CHECK(congestionPacingRate(&cc) == 0);
+
+    for (i = 0; i < 4; i++)
+        congestionAcked(&cc, &late, PACKET, 0, PACKET, now += 100);
+    CHECK(congestionWindow(&cc, PACKET) == 4 || congestionWindow(&cc, PACKET) == 5);
+    CHECK(cc.cwnd > 4.9 && cc.cwnd < 5.1);
+    for (i = 0; i < 10000; i++)
+        congestionAcked(&cc, &late, PACKET, 0, PACKET, now += 100);
+    CHECK(congestionWindow(&cc, PACKET) == 64);
+    return 0;
+}
+
+/**
+ * BBR on a link of a constant rate - the startup paces at the high gain until the bandwidth stops growing, then the
+ * model holds the bottleneck bandwidth and the minimum round trip, the window is about twice their product and the
+ * packets are paced around the bandwidth; losses do not change the model
+ */
+static int testBbr(void) {
+    flow f;
+    double bdp = RATE * RTT_US / 1e6 / PACKET;
+    int window;
+
+    startFlow(&f, COMM_CONGESTION_BBR);
+    CHECK(congestionWindow(&f.cc, PACKET) == 10);
+    runFlow(&f, 2 * IN_FLIGHT, 0);
+    CHECK(!f.cc.filled);
+    CHECK(f.cc.bandwidth > 0);
+    CHECK(congestionPacingRate(&f.cc) > 2.8 * f.cc.bandwidth);
+
+    runFlow(&f, 20 * IN_FLIGHT, 0);
+    CHECK(f.cc.filled);
+    CHECK(f.cc.bandwidth > 0.95 * RATE && f.cc.bandwidth < 1.05 * RATE);
+    CHECK(f.cc.minRttUs == RTT_US);
+    f.maxGain = 0;
+    runFlow(&f, 20 * IN_FLIGHT, 0);
+    CHECK(f.maxGain > 1.2 && f.maxGain < 1.3);     //probing phase of the gain cycle
+    CHECK(congestionPacingRate(&f.cc) <= 1.25 * f.cc.bandwidth);
+    window = congestionWindow(&f.cc, PACKET);
+    CHECK(window >= 2 * bdp && window <= 2 * bdp + 3);
+
+    congestionLost(&f.cc, &f.samples[0], f.now);
+    CHECK(congestionWindow(&f.cc, PACKET) == window);
+    return 0;
+}
+
+/**
+ * Pacing credit - a burst of two packets is sent at once, the next one waits for the credit earned at the rate
+ */
+static int testPacing(void) {
+    flow f;
+    long long delay;
+    double rate;
+
+    startFlow(&f, COMM_CONGESTION_BBR);
+    runFlow(&f, 40 * IN_FLIGHT, 0);
+    rate = congestionPacingRate(&f.cc);
+    CHECK(rate > 0);
+    CHECK(congestionPace(&f.cc, PACKET, f.now) == 1);
+    CHECK(congestionPace(&f.cc, PACKET, f.now) == 1);
+    CHECK(congestionPace(&f.cc, PACKET, f.now) == 0);
+    delay = congestionPaceDelay(&f.cc, PACKET, f.now);
+    CHECK(delay > 0 && delay <= PACKET * 1e6 / rate + 1);
+    CHECK(congestionPace(&f.cc, PACKET, f.now + delay / 2) == 0);
+    CHECK(congestionPace(&f.cc, PACKET, f.now + delay) == 1);
+    return 0;
+}
+
+/**
+ * CE marks - AIMD reduces the window to 80 % once per round trip, BBR shrinks its window by half of the smoothed
+ * share of the marked packets and does not probe for bandwidth while the round trips are marked
+ */
+static int testMarks(void) {
+    congestionState cc;
+    congestionSample first, late;
+    long long now = 1000;
+    flow f;
+    int i, window, markedWindow;
+
+    congestionInit(&cc, COMM_CONGESTION_AIMD, 64);
+    congestionSent(&cc, &first, now);
+    for (i = 0; i < 10; i++)
+        congestionAcked(&cc, &first, PACKET, 0, PACKET, now += 100);
+    congestionMarked(&cc, &first, 1, now += 100);
+    CHECK(congestionWindow(&cc, PACKET) == 16);
+    congestionMarked(&cc, &first, 3, now += 100);     //same round trip
+    CHECK(congestionWindow(&cc, PACKET) == 16);
+    congestionSent(&cc, &late, now += 100);
+    congestionMarked(&cc, &late, 1, now += 100);
+    CHECK(cc.cwnd > 12.7 && cc.cwnd < 12.9);
+    congestionInit(&cc, COMM_CONGESTION_FIXED, 32);
+    congestionMarked(&cc, &late, 1, now += 100);
+    CHECK(congestionWindow(&cc, PACKET) == 32);
+
+    startFlow(&f, COMM_CONGESTION_BBR);
+    runFlow(&f, 40 * IN_FLIGHT, 0);
+    window = congestionWindow(&f.cc, PACKET);
+    runFlow(&f, 2 * IN_FLIGHT, 1);
+    f.maxGain = 0;
+    runFlow(&f, 20 * IN_FLIGHT, 1);
+    CHECK(f.maxGain <= 1.0);
+    CHECK(f.cc.markedShare > 0.5);
+    CHECK((markedWindow = congestionWindow(&f.cc, PACKET)) < 0.8 * window);
+    CHECK(f.cc.bandwidth > 0.95 * RATE);
+
+    runFlow(&f, 2 * IN_FLIGHT, 0);
+    f.maxGain = 0;
+    runFlow(&f, 20 * IN_FLIGHT, 0);
+    CHECK(f.maxGain > 1.2);
+    CHECK(congestionWindow(&f.cc, PACKET) > markedWindow);
+    return 0;
+}
+
+int main(void) {
+    static const testCase tests[] = {
+        { "fixed", testFixed },
+        { "aimd", testAimd },
+        { "bbr", testBbr },
+        { "pacing", testPacing },
+        { "marks", testMarks },
+    };
+
+    return RUN_TESTS(tests);
+}
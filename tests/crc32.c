@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "crc32.h"
+#include "check.h"
+#define MAX_LENGTH 1500
+
+/**
+ * @brief Tests of the CRC32 kernels - the check value of the CRC-32 standard, and the batch verification agreeing with
+ * the single-stream CRC for every count and length of the messages.
+ */
+
+/**
+ * CRC of "123456789" is the check value 0xCBF43926
+ */
+static int testCheckValue(void) {
+    CHECK(crc32b((const unsigned char *) "123456789", 9) == 0xCBF43926u);
+    CHECK(crc32b((const unsigned char *) "", 0) == 0);
+    return 0;
+}
+
+/**
+ * Batch of messages of different lengths (including the tails shorter than a slice of 8 bytes) - the bitmask marks
+ * exactly the messages whose expected CRC matches, every other one is given a wrong CRC
+ */
+static int testBatch(void) {
+    const unsigned char *messages[CRC32_BATCH_MAX];
+    size_t lengths[CRC32_BATCH_MAX];
+    unsigned int expected[CRC32_BATCH_MAX];
+    unsigned long long valid;
+    unsigned char *data = malloc(CRC32_BATCH_MAX * MAX_LENGTH);
+    int count, i;
+
+    CHECK(data != NULL);
+    srand(1);
+    for (i = 0; i < CRC32_BATCH_MAX * MAX_LENGTH; i++)
+        data[i] = (unsigned char) rand();
+    for (count = 1; count <= CRC32_BATCH_MAX; count++) {
+        for (i = 0; i < count; i++) {
+            messages[i] = data + i * MAX_LENGTH;
+            lengths[i] = (size_t) ((i * 37 + count * 11) % MAX_LENGTH);
+            expected[i] = crc32b(messages[i], lengths[i]) ^ (i % 3 == 1 ? 1u << (i % 32) : 0);
+        }
+        valid = crc32Batch(messages, lengths, expected, count);
+        for (i = 0; i < count; i++)
+            CHECK((valid >> i & 1) == (i % 3 != 1));
+        CHECK(count == CRC32_BATCH_MAX || valid >> count == 0);
+    }
+    free(data);
+    return 0;
+}
+
+int main(void) {
+    static const testCase tests[] = {
+        { "check value", testCheckValue },
+        { "batch", testBatch },
+    };
+
+    return RUN_TESTS(tests);
+}
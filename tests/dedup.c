@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include "dedup.h"
+#include "check.h"
+#define BUCKETS 4096
+#define PERIOD_MS 1000
+#define INSERTED 10000
+#define PROBES 1000000
+
+/**
+ * @brief Tests of the message id filter - no inserted id is missed, ids which were not inserted are rarely reported,
+ * and the ids are forgotten after two periods (or when newer ids fill the filter).
+ */
+
+/**
+ * @return id number i of a sequence which does not repeat (odd multiplier, so the mapping is a bijection)
+ */
+static unsigned long long sampleId(unsigned long long i) {
+    return (i + 1) * 0x9E3779B97F4A7C15ULL;
+}
+
+/**
+ * Every inserted id is found, of the ids which were not inserted only a few are reported (about 2^-27 each)
+ */
+static int testMembership(void) {
+    dedupFilter *filter;
+    unsigned long long i;
+    int falsePositives = 0;
+
+    CHECK((filter = dedupCreate(BUCKETS, PERIOD_MS)) != NULL);
+    for (i = 0; i < INSERTED; i++)
+        dedupInsert(filter, sampleId(i), 0);
+    for (i = 0; i < INSERTED; i++)
+        CHECK(dedupContains(filter, sampleId(i), 0));
+    for (i = INSERTED; i < INSERTED + PROBES; i++)
+        falsePositives += dedupContains(filter, sampleId(i), 0) != 0;
+    CHECK(falsePositives < 10);
+    dedupDestroy(filter);
+    return 0;
+}
+
+/**
+ * Id is remembered for at least one period - it moves to the older generation, which is cleared a period later
+ */
+static int testExpiry(void) {
+    dedupFilter *filter;
+
+    CHECK((filter = dedupCreate(BUCKETS, PERIOD_MS)) != NULL);
+    dedupInsert(filter, sampleId(1), 0);
+    CHECK(dedupContains(filter, sampleId(1), PERIOD_MS - 1));
+    CHECK(dedupContains(filter, sampleId(1), PERIOD_MS));
+    dedupInsert(filter, sampleId(2), PERIOD_MS);
+    CHECK(!dedupContains(filter, sampleId(1), 2 * PERIOD_MS));
+    CHECK(dedupContains(filter, sampleId(2), 2 * PERIOD_MS));
+    dedupDestroy(filter);
+    return 0;
+}
+
+/**
+ * Full generation starts a new one - the newest ids are still found
+ */
+static int testFull(void) {
+    enum { SMALL = 64, COUNT = 16 * SMALL, RECENT = SMALL };   //four times the ids a generation holds
+    dedupFilter *filter;
+    unsigned long long i;
+
+    CHECK((filter = dedupCreate(SMALL, PERIOD_MS)) != NULL);
+    for (i = 0; i < COUNT; i++)
+        dedupInsert(filter, sampleId(i), 0);
+    for (i = COUNT - RECENT; i < COUNT; i++)
+        CHECK(dedupContains(filter, sampleId(i), 0));
+    dedupDestroy(filter);
+    return 0;
+}
+
+int main(void) {
+    static const testCase tests[] = {
+        { "membership", testMembership },
+        { "expiry", testExpiry },
+        { "full", testFull },
+    };
+
+    return RUN_TESTS(tests);
+}
@@ -0,0 +1,901 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
+#include "communicator.h"
+#include "check.h"
+#define MAX_EVENTS 16
+#define MAX_ORDER 256           //completions of the client recorded in their order
+#define BASE_PORT 47600         //every test uses its own pair of ports - the server and the relay
+#define TEST_TIMEOUT_MS 20000   //longest run of one test
+#define WIRE_DATA 10            //packet types the relay recognizes (PKT_* of communicator.c)
+#define WIRE_CLOSE 6
+#define WIRE_TYPE_MASK 0x3F
+
+/**
+ * @brief Loopback tests of libcommunicator. A client and a server run in one process and talk through a relay socket
+ * which drops the datagrams chosen by the test - at random, every copy of one packet, the close frames of the server
+ * or everything (the peer is gone); a second client can talk to the server directly. The socket calls of the
+ * offload paths are wrapped, so a test can make the kernel refuse UDP_SEGMENT/UDP_GRO or MSG_ZEROCOPY and hold back
+ * the zero-copy completions. The tests are meant to run under AddressSanitizer, so the paths which complete and
+ * release messages while a reply is being handled are checked for the use of the released memory.
+ */
+
+static int refuseOffload;       //UDP_GRO option and UDP_SEGMENT sends fail like on a kernel without the offload
+static int refuseZeroCopy;      //MSG_ZEROCOPY sends fail with ENOBUFS (too many pinned pages)
+static int holdCompletions;     //error queue reads find nothing - zero-copy buffers stay with the kernel
+
+/**
+ * Wire layout of the packet header - the relay drops the packets by their type and number
+ */
+typedef struct wireHeader {
+    int checksum;
+    unsigned int messageId;
+    short packetNumber;
+    short packetCount;
+    unsigned char type;
+} wireHeader;
+
+typedef struct harness {
+    commContext *server, *client;
+    commContext *direct;            //client connected to the server without the relay, NULL if there is none
+    int relay;                      //socket between the client and the server
+    struct sockaddr_in serverAddr, clientAddr;
+    int clientKnown;
+    int dropPercent;                //random loss in both directions
+    short dropPacket;               //every copy of this data packet of the client is dropped (0 for none)
+    int dropServerClose;            //close frames of the server are dropped
+    int blackhole;                  //every datagram is dropped - the server is gone
+    int connected, sent, timeouts, clientClosed, expired, busy;     //client events
+    void *order[MAX_ORDER];         //userData of the messages of the client in the order of their COMM_EVENT_SENT
+    int messages, serverClosed;     //server events
+    int fromDirect;                 //messages the server received from the direct client
+    struct sockaddr_in directAddr;
+    int directConnected, directSent, directBusy, directMessages;    //direct client events
+    char relayedSender[COMM_NAME_MAX];  //sender of the last message relayed to the direct client
+    size_t receivedBytes;
+    int corrupted;                  //received messages whose content does not match the pattern
+} harness;
+
+static long long nowMs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Send wrapper - refuses the offload options the test turned off, otherwise sends
+ */
+ssize_t sendmsg(int fd, const struct msghdr *msg, int flags) {
+    static ssize_t (*next)(int, const struct msghdr *, int);
+    struct cmsghdr *cmsg;
+
+    if (next == NULL)
+        next = (ssize_t (*)(int, const struct msghdr *, int)) dlsym(RTLD_NEXT, "sendmsg");
+    if (refuseZeroCopy && (flags & MSG_ZEROCOPY)) {
+        errno = ENOBUFS;
+        return -1;
+    }
+    for (cmsg = CMSG_FIRSTHDR(msg); refuseOffload && cmsg != NULL; cmsg = CMSG_NXTHDR((struct msghdr *) msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_SEGMENT) {
+            errno = EIO;
+            return -1;
+        }
+    }
+    return next(fd, msg, flags);
+}
+
+/**
+ * Receive wrapper - the error queue looks empty while the completions are held
+ */
+ssize_t recvmsg(int fd, struct msghdr *msg, int flags) {
+    static ssize_t (*next)(int, struct msghdr *, int);
+
+    if (next == NULL)
+        next = (ssize_t (*)(int, struct msghdr *, int)) dlsym(RTLD_NEXT, "recvmsg");
+    if (holdCompletions && (flags & MSG_ERRQUEUE)) {
+        errno = EAGAIN;
+        return -1;
+    }
+    return next(fd, msg, flags);
+}
+
+/**
+ * Socket option wrapper - UDP_GRO is refused with the other offload options
+ */
+int setsockopt(int fd, int level, int option, const void *value, socklen_t length) {
+    static int (*next)(int, int, int, const void *, socklen_t);
+
+    if (next == NULL)
+        next = (int (*)(int, int, int, const void *, socklen_t)) dlsym(RTLD_NEXT, "setsockopt");
+    if (refuseOffload && level == SOL_UDP && option == UDP_GRO) {
+        errno = ENOPROTOOPT;
+        return -1;
+    }
+    return next(fd, level, option, value, length);
+}
+
+/**
+ * Starts the server and the relay on the ports of the test and the client connected through the relay
+ * @return 0 on success, -1 on error
+ */
+static int startHarness(harness *h, int test, const commConfig *config) {
+    commConfig settings = *config;
+    struct sockaddr_in relayAddr;
+
+    memset(h, 0, sizeof(*h));
+    memset(&h->serverAddr, 0, sizeof(h->serverAddr));
+    h->serverAddr.sin_family = AF_INET;
+    h->serverAddr.sin_port = htons(BASE_PORT + 2 * test);
+    h->serverAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    relayAddr = h->serverAddr;
+    relayAddr.sin_port = htons(BASE_PORT + 2 * test + 1);
+    if ((h->relay = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+        return -1;
+    fcntl(h->relay, F_SETFL, O_NONBLOCK);
+    if (bind(h->relay, (struct sockaddr *) &relayAddr, sizeof(relayAddr)) < 0) {
+        close(h->relay);
+        return -1;
+    }
+    settings.host = "127.0.0.1";
+    settings.port = (unsigned short) (BASE_PORT + 2 * test);
+    if ((h->server = commServerCreate(&settings)) == NULL) {
+        close(h->relay);
+        return -1;
+    }
+    settings.port = (unsigned short) (BASE_PORT + 2 * test + 1);
+    if ((h->client = commClientCreate(&settings)) == NULL) {
+        commDestroy(h->server);
+        close(h->relay);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Starts the direct client - connected to the server of the harness without the relay
+ * @return 0 on success, -1 on error
+ */
+static int startDirect(harness *h, const commConfig *config) {
+    commConfig settings = *config;
+    settings.host = "127.0.0.1";
+    settings.port = ntohs(h->serverAddr.sin_port);
+    if ((h->direct = commClientCreate(&settings)) == NULL)
+        return -1;
+    return commGetLocalAddress(h->direct, &h->directAddr);
+}
+
+static void stopHarness(harness *h) {
+    commDestroy(h->direct);
+    commDestroy(h->client);
+    commDestroy(h->server);
+    close(h->relay);
+}
+
+/**
+ * @return 1 if the relay drops the datagram
+ */
+static int dropped(const harness *h, const char *datagram, ssize_t n, int fromClient) {
+    wireHeader header;
+    if (h->blackhole || (h->dropPercent > 0 && rand() % 100 < h->dropPercent))
+        return 1;
+    if (n < (ssize_t) (offsetof(wireHeader, type) + 1))
+        return 0;   //control packets end with the type, the structure is padded
+    memcpy(&header, datagram, offsetof(wireHeader, type) + 1);
+    if (fromClient)
+        return h->dropPacket != 0 && (header.type & WIRE_TYPE_MASK) == WIRE_DATA &&
+               header.packetNumber == h->dropPacket;
+    return h->dropServerClose && (header.type & WIRE_TYPE_MASK) == WIRE_CLOSE;
+}
+
+/**
+ * Forwards the datagrams waiting in the relay socket
+ */
+static void relayPump(harness *h) {
+    char datagram[65536];
+    struct sockaddr_in from;
+    socklen_t length = sizeof(from);
+    ssize_t n;
+    int fromClient;
+
+    while ((n = recvfrom(h->relay, datagram, sizeof(datagram), 0, (struct sockaddr *) &from, &length)) >= 0) {
+        length = sizeof(from);
+        fromClient = from.sin_port != h->serverAddr.sin_port;
+        if (fromClient && !h->clientKnown) {
+            h->clientAddr = from;
+            h->clientKnown = 1;
+        }
+        if (dropped(h, datagram, n, fromClient))
+            continue;
+        if (fromClient)
+            sendto(h->relay, datagram, (size_t) n, 0, (struct sockaddr *) &h->serverAddr, sizeof(h->serverAddr));
+        else if (h->clientKnown)
+            sendto(h->relay, datagram, (size_t) n, 0, (struct sockaddr *) &h->clientAddr, sizeof(h->clientAddr));
+    }
+}
+
+/**
+ * Checks the content of a received message - byte i of a message of length bytes is (i + length) % 251
+ */
+static int patternValid(const char *data, size_t length) {
+    size_t i;
+    for (i = 0; i < length; i++) {
+        if ((unsigned char) data[i] != (i + length) % 251)
+            return 0;
+    }
+    return 1;
+}
+
+static char *patternMessage(size_t length) {
+    char *data = malloc(length);
+    size_t i;
+    for (i = 0; data != NULL && i < length; i++)
+        data[i] = (char) ((i + length) % 251);
+    return data;
+}
+
+/**
+ * Polls the server once and counts its events
+ */
+static void pollServer(harness *h) {
+    commEvent events[MAX_EVENTS];
+    int i, n;
+
+    if ((n = commPoll(h->server, events, MAX_EVENTS, 0)) > 0) {
+        for (i = 0; i < n; i++) {
+            if (events[i].type == COMM_EVENT_MESSAGE) {
+                h->messages++;
+                h->fromDirect += h->direct != NULL && events[i].peer.sin_port == h->directAddr.sin_port;
+                h->receivedBytes += events[i].length;
+                h->corrupted += !patternValid(events[i].data, events[i].length);
+            } else if (events[i].type == COMM_EVENT_CLOSED) {
+                h->serverClosed++;
+            }
+        }
+    }
+}
+
+/**
+ * Polls the client behind the relay once (waiting at most a millisecond) and counts its events
+ */
+static void pollClient(harness *h) {
+    commEvent events[MAX_EVENTS];
+    int i, n;
+
+    if ((n = commPoll(h->client, events, MAX_EVENTS, 1)) > 0) {
+        for (i = 0; i < n; i++) {
+            switch (events[i].type) {
+                case COMM_EVENT_CONNECTED:
+                    h->connected = 1;
+                    break;
+                case COMM_EVENT_SENT:
+                    if (h->sent < MAX_ORDER)
+                        h->order[h->sent] = events[i].userData;
+                    h->sent++;
+                    break;
+                case COMM_EVENT_TIMEOUT:
+                    h->timeouts++;
+                    break;
+                case COMM_EVENT_CLOSED:
+                    h->clientClosed = 1;
+                    break;
+                case COMM_EVENT_EXPIRED:
+                    h->expired++;
+                    break;
+                case COMM_EVENT_BUSY:
+                    h->busy++;
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+}
+
+/**
+ * Polls the direct client once, if there is one, and counts its events
+ */
+static void pollDirect(harness *h) {
+    commEvent events[MAX_EVENTS];
+    int i, n;
+
+    if (h->direct != NULL && (n = commPoll(h->direct, events, MAX_EVENTS, 0)) > 0) {
+        for (i = 0; i < n; i++) {
+            if (events[i].type == COMM_EVENT_CONNECTED) {
+                h->directConnected = 1;
+            } else if (events[i].type == COMM_EVENT_SENT) {
+                h->directSent++;
+            } else if (events[i].type == COMM_EVENT_BUSY) {
+                h->directBusy++;
+            } else if (events[i].type == COMM_EVENT_MESSAGE) {
+                h->directMessages++;
+                h->corrupted += !patternValid(events[i].data, events[i].length);
+                snprintf(h->relayedSender, sizeof(h->relayedSender), "%s", events[i].sender);
+            }
+        }
+    }
+}
+
+/**
+ * Polls all the contexts and the relay once
+ */
+static void step(harness *h) {
+    pollServer(h);
+    relayPump(h);
+    pollClient(h);
+    relayPump(h);
+    pollDirect(h);
+}
+
+/**
+ * Runs the harness until the counter reaches the value or the test times out
+ * @return 0 if the counter reached the value, -1 on timeout
+ */
+static int runUntil(harness *h, const int *counter, int value) {
+    long long deadline = nowMs() + TEST_TIMEOUT_MS;
+    while (*counter < value) {
+        if (nowMs() > deadline)
+            return -1;
+        step(h);
+    }
+    return 0;
+}
+
+/**
+ * Submits the message of the pattern
+ * @return 0 on success, -1 on error
+ */
+static int submitPattern(harness *h, char *data, size_t length) {
+    commMessage message;
+    memset(&message, 0, sizeof(message));
+    message.data = data;
+    message.length = length;
+    return commSubmit(h->client, &message);
+}
+
+/**
+ * Submits the message of the pattern with its priority and the userData reported by its completion
+ * @return 0 on success, -1 on error
+ */
+static int submitTagged(commContext *ctx, char *data, size_t length, commPriority priority, void *userData) {
+    commMessage message;
+    memset(&message, 0, sizeof(message));
+    message.data = data;
+    message.length = length;
+    message.priority = priority;
+    message.userData = userData;
+    return commSubmit(ctx, &message);
+}
+
+/**
+ * Bounded in-flight queue - a submit past maxInFlight fails with EAGAIN until a message completes, and the messages
+ * complete in the order of their submission
+ */
+static int testInFlightLimit(void) {
+    enum { LIMIT = 4, COUNT = 40, LENGTH = 3000 };
+    commConfig config;
+    harness h;
+    char *data;
+    int submitted = 0, i;
+
+    commConfigInit(&config);
+    config.maxInFlight = LIMIT;
+    CHECK(startHarness(&h, 0, &config) == 0);
+    CHECK(runUntil(&h, &h.connected, 1) == 0);
+    CHECK((data = patternMessage(LENGTH)) != NULL);
+    for (; submitted < LIMIT; submitted++)
+        CHECK(submitTagged(h.client, data, LENGTH, COMM_PRIORITY_NORMAL, (void *) (intptr_t) submitted) == 0);
+    errno = 0;
+    CHECK(submitTagged(h.client, data, LENGTH, COMM_PRIORITY_NORMAL, NULL) < 0 && errno == EAGAIN);
+    CHECK(commInFlight(h.client) == LIMIT);
+    while (submitted < COUNT) {
+        CHECK(runUntil(&h, &h.sent, submitted - LIMIT + 1) == 0);
+        //every completion makes room for exactly one more message
+        for (; submitted < h.sent + LIMIT && submitted < COUNT; submitted++)
+            CHECK(submitTagged(h.client, data, LENGTH, COMM_PRIORITY_NORMAL, (void *) (intptr_t) submitted) == 0);
+        CHECK(submitted == COUNT || submitTagged(h.client, data, LENGTH, COMM_PRIORITY_NORMAL, NULL) < 0);
+    }
+    CHECK(runUntil(&h, &h.sent, COUNT) == 0);
+    CHECK(runUntil(&h, &h.messages, COUNT) == 0);
+    CHECK(commInFlight(h.client) == 0);
+    for (i = 0; i < COUNT; i++)
+        CHECK(h.order[i] == (void *) (intptr_t) i);
+    CHECK(h.corrupted == 0 && h.timeouts == 0);
+    stopHarness(&h);
+    free(data);
+    return 0;
+}
+
+/**
+ * Store-and-forward - a message to a recipient which is offline waits on the server and is relayed to it, with the
+ * name of its sender, once the recipient connects
+ */
+static int testStoreAndForward(void) {
+    enum { LENGTH = 5000 };
+    commConfig config;
+    commMessage message;
+    harness h;
+    char *data;
+
+    commConfigInit(&config);
+    config.name = "alice";
+    CHECK(startHarness(&h, 1, &config) == 0);
+    CHECK(runUntil(&h, &h.connected, 1) == 0);
+    CHECK((data = patternMessage(LENGTH)) != NULL);
+    memset(&message, 0, sizeof(message));
+    message.data = data;
+    message.length = LENGTH;
+    message.recipient = "bob";
+    CHECK(commSubmit(h.client, &message) == 0);
+    CHECK(runUntil(&h, &h.sent, 1) == 0);
+    CHECK(runUntil(&h, &h.messages, 1) == 0);
+
+    config.name = "bob";
+    CHECK(startDirect(&h, &config) == 0);
+    CHECK(runUntil(&h, &h.directMessages, 1) == 0);
+    CHECK(strcmp(h.relayedSender, "alice") == 0);
+    CHECK(h.corrupted == 0);
+    stopHarness(&h);
+    free(data);
+    return 0;
+}
+
+/**
+ * Priorities - an interactive message submitted after a queue of bulk ones is sent first, and the normal messages
+ * get four times the share of the bulk ones (the default weights)
+ */
+static int testPriorities(void) {
+    enum { BULK = 20, NORMAL = 20, LENGTH = 10000 };
+    commConfig config;
+    harness h;
+    char *data;
+    int normal = 0, i;
+
+    commConfigInit(&config);
+    config.sendWindow = 8;
+    CHECK(startHarness(&h, 2, &config) == 0);
+    CHECK(runUntil(&h, &h.connected, 1) == 0);
+    CHECK((data = patternMessage(LENGTH)) != NULL);
+    for (i = 0; i < BULK; i++)
+        CHECK(submitTagged(h.client, data, LENGTH, COMM_PRIORITY_BULK, (void *) (intptr_t) COMM_PRIORITY_BULK) == 0);
+    CHECK(submitTagged(h.client, data, 100, COMM_PRIORITY_INTERACTIVE,
+                       (void *) (intptr_t) COMM_PRIORITY_INTERACTIVE) == 0);
+    for (i = 0; i < NORMAL; i++)
+        CHECK(submitTagged(h.client, data, LENGTH, COMM_PRIORITY_NORMAL, (void *) (intptr_t) COMM_PRIORITY_NORMAL) == 0);
+    CHECK(runUntil(&h, &h.sent, BULK + NORMAL + 1) == 0);
+    CHECK(h.order[0] == (void *) (intptr_t) COMM_PRIORITY_INTERACTIVE);
+    for (i = 1; i <= 10; i++)
+        normal += h.order[i] == (void *) (intptr_t) COMM_PRIORITY_NORMAL;
+    CHECK(normal >= 7);
+    CHECK(runUntil(&h, &h.messages, BULK + NORMAL + 1) == 0);
+    stopHarness(&h);
+    free(data);
+    return 0;
+}
+
+/**
+ * TTL - a message which cannot be delivered before its TTL is dropped and reported as expired
+ */
+static int testTtlExpiry(void) {
+    commConfig config;
+    commMessage message;
+    harness h;
+    char *data;
+
+    commConfigInit(&config);
+    config.retransmitTimeoutMs = 20;
+    CHECK(startHarness(&h, 3, &config) == 0);
+    CHECK(runUntil(&h, &h.connected, 1) == 0);
+    CHECK((data = patternMessage(1000)) != NULL);
+    h.blackhole = 1;
+    memset(&message, 0, sizeof(message));
+    message.data = data;
+    message.length = 1000;
+    message.ttlMs = 50;
+    CHECK(commSubmit(h.client, &message) == 0);
+    CHECK(runUntil(&h, &h.expired, 1) == 0);
+    CHECK(h.sent == 0 && h.timeouts == 0 && commInFlight(h.client) == 0);
+    stopHarness(&h);
+    free(data);
+    return 0;
+}
+
+/**
+ * Packet rate limit of the server - the packets above the rate are dropped and sent again by the client, so all the
+ * messages arrive, but not faster than the rate allows
+ */
+static int testRateLimit(void) {
+    enum { COUNT = 40, LENGTH = 5000, RATE = 1000, BURST = 128 };
+    commConfig config;
+    commStats stats;
+    harness h;
+    char *data;
+    long long start;
+    int i;
+
+    commConfigInit(&config);
+    config.retransmitTimeoutMs = 20;
+    config.maxRetransmits = 1000;
+    config.clientPacketRate = RATE;
+    config.adaptiveFragments = 0;
+    CHECK(startHarness(&h, 4, &config) == 0);
+    CHECK(runUntil(&h, &h.connected, 1) == 0);
+    CHECK((data = patternMessage(LENGTH)) != NULL);
+    start = nowMs();
+    for (i = 0; i < COUNT; i++)
+        CHECK(submitPattern(&h, data, LENGTH) == 0);
+    CHECK(runUntil(&h, &h.messages, COUNT) == 0);
+    //every message is ten fragments and the END packet, the bucket starts full
+    CHECK(nowMs() - start >= (COUNT * 11 - BURST) * 1000LL / RATE * 3 / 4);
+    commGetStats(h.server, &stats);
+    CHECK(stats.rateDrops > 0);
+    CHECK(h.corrupted == 0 && h.timeouts == 0);
+    stopHarness(&h);
+    free(data);
+    return 0;
+}
+
+/**
+ * Deficit round robin - a client which floods the server with a large window does not starve a client with a small
+ * one, the server processes their queued packets in equal shares
+ */
+static int testFairness(void) {
+    enum { COUNT = 30, LENGTH = 20000 };
+    commConfig config;
+    harness h;
+    char *data;
+    int i;
+
+    commConfigInit(&config);
+    config.retransmitTimeoutMs = 20;
+    config.maxRetransmits = 1000;
+    config.overloadLatencyMs = 0;
+    config.adaptiveFragments = 0;
+    config.sendWindow = 112;
+    CHECK(startHarness(&h, 5, &config) == 0);
+    config.sendWindow = 32;
+    CHECK(startDirect(&h, &config) == 0);
+    CHECK(runUntil(&h, &h.connected, 1) == 0);
+    CHECK(runUntil(&h, &h.directConnected, 1) == 0);
+    CHECK((data = patternMessage(LENGTH)) != NULL);
+    for (i = 0; i < COUNT; i++) {
+        CHECK(submitPattern(&h, data, LENGTH) == 0);
+        CHECK(submitTagged(h.direct, data, LENGTH, COMM_PRIORITY_NORMAL, NULL) == 0);
+    }
+    CHECK(runUntil(&h, &h.sent, COUNT / 2) == 0);
+    CHECK(h.fromDirect >= COUNT / 4);
+    CHECK(runUntil(&h, &h.messages, 2 * COUNT) == 0);
+    CHECK(h.corrupted == 0 && h.timeouts == 0);
+    stopHarness(&h);
+    free(data);
+    return 0;
+}
+
+/**
+ * Overload - received packets wait longer than overloadLatencyMs, the server sheds the bulk messages with busy
+ * replies (the client backs off and sends them later) and keeps accepting the normal ones of the other client
+ */
+static int testOverload(void) {
+    enum { COUNT = 10, LENGTH = 50000, WINDOW = 128 };
+    commConfig config;
+    commStats stats;
+    harness h;
+    char *data;
+    int i;
+
+    commConfigInit(&config);
+    config.maxRetransmits = 1000;
+    config.overloadLatencyMs = 100;
+    config.sendWindow = WINDOW;
+    CHECK(startHarness(&h, 6, &config) == 0);
+    CHECK(startDirect(&h, &config) == 0);
+    CHECK(runUntil(&h, &h.connected, 1) == 0);
+    CHECK(runUntil(&h, &h.directConnected, 1) == 0);
+    CHECK((data = patternMessage(LENGTH)) != NULL);
+    for (i = 0; i < COUNT; i++) {
+        CHECK(submitTagged(h.client, data, LENGTH, COMM_PRIORITY_BULK, NULL) == 0);
+        CHECK(submitTagged(h.direct, data, LENGTH, COMM_PRIORITY_NORMAL, NULL) == 0);
+    }
+    //the server reads a window of each client, but processes only a part of them in one poll - the rest waits in the
+    //receive queues past the latency (the windows are read one at a time, so the kernel drops nothing)
+    pollClient(&h);
+    relayPump(&h);
+    pollServer(&h);
+    pollDirect(&h);
+    pollServer(&h);
+    usleep(120000);
+    CHECK(runUntil(&h, &h.directSent, COUNT) == 0);
+    CHECK(runUntil(&h, &h.sent, COUNT) == 0);
+    commGetStats(h.server, &stats);
+    CHECK(stats.shedPackets > 0);
+    CHECK(h.busy > 0 && h.directBusy == 0);
+    CHECK(runUntil(&h, &h.messages, 2 * COUNT) == 0);
+    CHECK(h.corrupted == 0 && h.timeouts == 0);
+    stopHarness(&h);
+    free(data);
+    return 0;
+}
+
+/**
+ * UDP offload - the fragments are sent in UDP_SEGMENT batches and the server receives them coalesced by UDP_GRO;
+ * on a kernel which refuses both the packets are sent and received one by one
+ */
+static int testOffload(void) {
+    enum { COUNT = 10, LENGTH = 50000 };
+    commConfig config;
+    commStats clientStats, serverStats;
+    harness h;
+    char *data;
+    int i, refuse;
+
+    CHECK((data = patternMessage(LENGTH)) != NULL);
+    for (refuse = 0; refuse <= 1; refuse++) {
+        commConfigInit(&config);
+        refuseOffload = refuse;
+        CHECK(startHarness(&h, 7, &config) == 0);
+        CHECK(startDirect(&h, &config) == 0);
+        CHECK(runUntil(&h, &h.directConnected, 1) == 0);
+        for (i = 0; i < COUNT; i++)
+            CHECK(submitTagged(h.direct, data, LENGTH, COMM_PRIORITY_NORMAL, NULL) == 0);
+        CHECK(runUntil(&h, &h.directSent, COUNT) == 0);
+        CHECK(runUntil(&h, &h.fromDirect, COUNT) == 0);
+        CHECK(h.corrupted == 0);
+        commGetStats(h.direct, &clientStats);
+        commGetStats(h.server, &serverStats);
+        if (refuse) {
+            CHECK(clientStats.gsoSends == 0 && serverStats.groReceives == 0);
+        } else {
+            CHECK(clientStats.gsoSends > 0 && serverStats.groReceives > 0);
+        }
+        stopHarness(&h);
+    }
+    refuseOffload = 0;
+    free(data);
+    return 0;
+}
+
+/**
+ * MSG_ZEROCOPY - refused sends (ENOBUFS) are copied; a buffer stays with the kernel until its completion is read
+ * from the error queue, so with the completions held back at most the whole pool is sent without copying, and once
+ * they are read the copy made by the loopback device switches zero-copy off
+ */
+static int testZeroCopy(void) {
+    enum { COUNT = 30, LENGTH = 60000, POOL = 16 };
+    commConfig config;
+    commStats stats;
+    harness h;
+    char *data;
+    int i;
+
+    CHECK((data = patternMessage(LENGTH)) != NULL);
+    commConfigInit(&config);
+    config.zeroCopy = 1;
+    config.timestamping = 0;    //TX timestamps would queue up in the held error queue
+    config.adaptiveFragments = 0;
+    CHECK(startHarness(&h, 8, &config) == 0);
+    CHECK(runUntil(&h, &h.connected, 1) == 0);
+    refuseZeroCopy = 1;
+    for (i = 0; i < COUNT; i++)
+        CHECK(submitPattern(&h, data, LENGTH) == 0);
+    CHECK(runUntil(&h, &h.messages, COUNT) == 0);
+    commGetStats(h.client, &stats);
+    CHECK(stats.zeroCopySends == 0 && stats.gsoSends > 0);
+    refuseZeroCopy = 0;
+
+    holdCompletions = 1;
+    for (i = 0; i < COUNT; i++)
+        CHECK(submitPattern(&h, data, LENGTH) == 0);
+    CHECK(runUntil(&h, &h.messages, 2 * COUNT) == 0);
+    commGetStats(h.client, &stats);
+    CHECK(stats.zeroCopySends == POOL && stats.zeroCopyCopied == 0);
+    holdCompletions = 0;
+
+    for (i = 0; i < COUNT; i++)
+        CHECK(submitPattern(&h, data, LENGTH) == 0);
+    CHECK(runUntil(&h, &h.messages, 3 * COUNT) == 0);
+    commGetStats(h.client, &stats);
+    CHECK(stats.zeroCopyCopied > 0);
+    CHECK(h.corrupted == 0 && h.timeouts == 0);
+    stopHarness(&h);
+    free(data);
+    return 0;
+}
+
+/**
+ * Adaptive fragments - a lossy relay shrinks the fragments of the session to the minimum, a clean one grows them
+ * above the initial size again
+ */
+static int testFragmentSize(void) {
+    enum { LENGTH = 20000 };
+    commConfig config;
+    commStats stats;
+    harness h;
+    char *data;
+    long long deadline = nowMs() + TEST_TIMEOUT_MS;
+
+    commConfigInit(&config);
+    config.retransmitTimeoutMs = 20;
+    config.maxRetransmits = 1000;
+    CHECK(startHarness(&h, 9, &config) == 0);
+    CHECK(runUntil(&h, &h.connected, 1) == 0);
+    CHECK((data = patternMessage(LENGTH)) != NULL);
+    srand(2);
+    h.dropPercent = 15;
+    do {
+        CHECK(nowMs() < deadline);
+        CHECK(submitPattern(&h, data, LENGTH) == 0);
+        CHECK(runUntil(&h, &h.sent, h.sent + 1) == 0);
+        commGetStats(h.client, &stats);
+    } while (stats.fragSize > COMM_FRAG_MIN);
+    CHECK(stats.fragResizes > 0);
+    h.dropPercent = 0;
+    do {
+        CHECK(nowMs() < deadline);
+        CHECK(submitPattern(&h, data, LENGTH) == 0);
+        CHECK(runUntil(&h, &h.sent, h.sent + 1) == 0);
+        commGetStats(h.client, &stats);
+    } while (stats.fragSize <= COMM_FRAG_SIZE);
+    CHECK(runUntil(&h, &h.messages, h.sent) == 0);
+    CHECK(h.corrupted == 0 && h.timeouts == 0);
+    stopHarness(&h);
+    free(data);
+    return 0;
+}
+
+/**
+ * Random loss in both directions - every message is delivered once and intact
+ */
+static int testRandomLoss(void) {
+    enum { COUNT = 20, LENGTH = 20000 };
+    commConfig config;
+    harness h;
+    char *data[COUNT];
+    int i;
+
+    commConfigInit(&config);
+    config.retransmitTimeoutMs = 20;
+    config.udpOffload = 0;
+    CHECK(startHarness(&h, 10, &config) == 0);
+    srand(1);
+    h.dropPercent = 10;
+    CHECK(runUntil(&h, &h.connected, 1) == 0);
+    for (i = 0; i < COUNT; i++) {
+        CHECK((data[i] = patternMessage(LENGTH - i)) != NULL);
+        CHECK(submitPattern(&h, data[i], LENGTH - i) == 0);
+    }
+    CHECK(runUntil(&h, &h.sent, COUNT) == 0);
+    h.dropPercent = 0;
+    CHECK(runUntil(&h, &h.messages, COUNT) == 0);
+    CHECK(h.timeouts == 0);
+    CHECK(h.corrupted == 0);
+    stopHarness(&h);
+    for (i = 0; i < COUNT; i++)
+        free(data[i]);
+    return 0;
+}
+
+/**
+ * Every copy of one packet is lost - the message times out after maxRetransmits attempts (the last one is given up
+ * by RACK while the acknowledgements of the other packets are handled) and the session goes on
+ */
+static int testRetransmitExhaustion(void) {
+    enum { LENGTH = 100000 };
+    commConfig config;
+    harness h;
+    char *large, *small;
+
+    commConfigInit(&config);
+    config.maxRetransmits = 1;
+    config.udpOffload = 0;
+    CHECK(startHarness(&h, 11, &config) == 0);
+    CHECK(runUntil(&h, &h.connected, 1) == 0);
+    CHECK((large = patternMessage(LENGTH)) != NULL && (small = patternMessage(100)) != NULL);
+    h.dropPacket = 3;
+    CHECK(submitPattern(&h, large, LENGTH) == 0);
+    CHECK(runUntil(&h, &h.timeouts, 1) == 0);
+    CHECK(h.sent == 0);
+    h.dropPacket = 0;
+    CHECK(submitPattern(&h, small, 100) == 0);
+    CHECK(runUntil(&h, &h.sent, 1) == 0);
+    CHECK(runUntil(&h, &h.messages, 1) == 0);
+    CHECK(h.receivedBytes == 100 && h.corrupted == 0);
+    stopHarness(&h);
+    free(large);
+    free(small);
+    return 0;
+}
+
+/**
+ * Both sides close in order - the client and the server report the end of the session
+ */
+static int testOrderlyClose(void) {
+    commConfig config;
+    harness h;
+
+    commConfigInit(&config);
+    config.retransmitTimeoutMs = 20;
+    CHECK(startHarness(&h, 12, &config) == 0);
+    CHECK(runUntil(&h, &h.connected, 1) == 0);
+    CHECK(commShutdown(h.client, NULL) == 0);
+    CHECK(runUntil(&h, &h.clientClosed, 1) == 0);
+    CHECK(runUntil(&h, &h.serverClosed, 1) == 0);
+    stopHarness(&h);
+    return 0;
+}
+
+/**
+ * Close frames of the server are lost - the client does not wait for them forever after the server acknowledged
+ * its close, and the server gives up its unacknowledged close frame
+ */
+static int testPeerCloseLost(void) {
+    commConfig config;
+    harness h;
+    long long start;
+
+    commConfigInit(&config);
+    config.retransmitTimeoutMs = 20;
+    config.maxRetransmits = 3;
+    CHECK(startHarness(&h, 13, &config) == 0);
+    CHECK(runUntil(&h, &h.connected, 1) == 0);
+    h.dropServerClose = 1;
+    start = nowMs();
+    CHECK(commShutdown(h.client, NULL) == 0);
+    CHECK(runUntil(&h, &h.clientClosed, 1) == 0);
+    CHECK(runUntil(&h, &h.serverClosed, 1) == 0);
+    CHECK(nowMs() - start < TEST_TIMEOUT_MS / 2);
+    stopHarness(&h);
+    return 0;
+}
+
+/**
+ * Server is gone before the client closes - the client gives up its close frame after maxRetransmits attempts
+ */
+static int testPeerGone(void) {
+    commConfig config;
+    harness h;
+
+    commConfigInit(&config);
+    config.retransmitTimeoutMs = 20;
+    config.maxRetransmits = 3;
+    CHECK(startHarness(&h, 14, &config) == 0);
+    CHECK(runUntil(&h, &h.connected, 1) == 0);
+    h.blackhole = 1;
+    CHECK(commShutdown(h.client, NULL) == 0);
+    CHECK(runUntil(&h, &h.clientClosed, 1) == 0);
+    CHECK(commShutdown(h.client, NULL) < 0);
+    stopHarness(&h);
+    return 0;
+}
+
+int main(void) {
+    static const testCase tests[] = {
+        { "in-flight limit", testInFlightLimit },
+        { "store and forward", testStoreAndForward },
+        { "priorities", testPriorities },
+        { "ttl expiry", testTtlExpiry },
+        { "rate limit", testRateLimit },
+        { "fairness", testFairness },
+        { "overload", testOverload },
+        { "udp offload", testOffload },
+        { "zero copy", testZeroCopy },
+        { "fragment size", testFragmentSize },
+        { "random loss", testRandomLoss },
+        { "retransmit exhaustion", testRetransmitExhaustion },
+        { "orderly close", testOrderlyClose },
+        { "peer close lost", testPeerCloseLost },
+        { "peer gone", testPeerGone },
+    };
+
+    return RUN_TESTS(tests);
+}
@@ -0,0 +1,358 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "msglog.h"
+#include "check.h"
+#define SEGMENT_SIZE 4096       //small segments, so the records span several of them
+#define RECORDS 100
+#define CHANNELS 3
+#define SENDERS 4
+#define INDEXED 600             //records of the query tests - more than LOG_INDEX_INTERVAL in every segment
+#define INDEXED_SEGMENT (16 * 1024)
+#define BASE_TIME 1000000
+
+/**
+ * @brief Tests of the message log - the records and their indexes survive reopening the log, a torn last record
+ * is dropped by the recovery and overwritten by the next append, and the indexed queries return the same records as
+ * a scan of the whole log, whether the indexes are built in memory, read from the index files or rebuilt.
+ */
+
+static size_t align(size_t size) {
+    return (size + LOG_RECORD_ALIGN - 1) & ~(size_t) (LOG_RECORD_ALIGN - 1);
+}
+
+/**
+ * Removes the log directory with its files
+ */
+static void removeLog(const char *directory) {
+    char path[4096];
+    struct dirent *file;
+    DIR *dir = opendir(directory);
+    while (dir != NULL && (file = readdir(dir)) != NULL) {
+        if (file->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", directory, file->d_name);
+        unlink(path);
+    }
+    if (dir != NULL)
+        closedir(dir);
+    rmdir(directory);
+}
+
+/**
+ * Appends count records numbered from first, each with the text of its number on the channel number % CHANNELS
+ * @return 0 on success, -1 on error
+ */
+static int appendRecords(msgLog *log, int first, int count) {
+    logRecordHeader record;
+    char text[32];
+    int i;
+    for (i = first; i < first + count; i++) {
+        memset(&record, 0, sizeof(record));
+        record.channel = (unsigned int) (i % CHANNELS);
+        record.messageId = (unsigned int) i;
+        snprintf(text, sizeof(text), "message %d", i);
+        if (msgLogAppend(log, &record, text, strlen(text)) < 0)
+            return -1;
+    }
+    return msgLogCommit(log);
+}
+
+/**
+ * @return 1 if the record of the sequence number holds the text of the number
+ */
+static int recordValid(msgLog *log, unsigned long long sequence, int number) {
+    logRecordRef ref;
+    char text[32];
+    snprintf(text, sizeof(text), "message %d", number);
+    return msgLogRecord(log, sequence, &ref) == 0 && ref.header->length == strlen(text) &&
+           memcmp(ref.data, text, ref.header->length) == 0;
+}
+
+/**
+ * Finds the last segment file (the names are the zero-padded base sequence numbers, so the largest name is the last)
+ * @return 0 on success, -1 if there is none
+ */
+static int lastSegment(const char *directory, char *path, size_t size) {
+    struct dirent *file;
+    char last[256] = "";
+    DIR *dir = opendir(directory);
+    if (dir == NULL)
+        return -1;
+    while ((file = readdir(dir)) != NULL) {
+        size_t length = strlen(file->d_name);
+        if (length > 4 && strcmp(file->d_name + length - 4, ".log") == 0 && strcmp(file->d_name, last) > 0)
+            snprintf(last, sizeof(last), "%s", file->d_name);
+    }
+    closedir(dir);
+    snprintf(path, size, "%s/%s", directory, last);
+    return last[0] != '\0' ? 0 : -1;
+}
+
+/**
+ * Damages the message of the last record of the segment, as if the crash came while it was being written
+ * @return 0 on success, -1 on error
+ */
+static int tearLastRecord(const char *path) {
+    logRecordHeader record;
+    size_t offset = align(sizeof(logSegmentHeader)), last = 0;
+    char byte;
+    int fd = open(path, O_RDWR), result = -1;
+
+    if (fd < 0)
+        return -1;
+    while (pread(fd, &record, sizeof(record), (off_t) offset) == (ssize_t) sizeof(record) && record.length != 0) {
+        last = offset;
+        offset += align(sizeof(record) + record.length);
+    }
+    if (last != 0 && pread(fd, &byte, 1, (off_t) (last + sizeof(record))) == 1) {
+        byte ^= 0x5A;
+        if (pwrite(fd, &byte, 1, (off_t) (last + sizeof(record))) == 1)
+            result = 0;
+    }
+    close(fd);
+    return result;
+}
+
+/**
+ * Records written to several segments are found again after the log is reopened - by the sequence number and by the
+ * channel index
+ */
+static int testReopen(void) {
+    char directory[] = "/tmp/msglogtestXXXXXX";
+    logRecordRef results[RECORDS];
+    logQuery query;
+    msgLog *log;
+    size_t found, i;
+
+    CHECK(mkdtemp(directory) != NULL);
+    CHECK((log = msgLogOpen(directory, SEGMENT_SIZE)) != NULL);
+    CHECK(appendRecords(log, 1, RECORDS) == 0);
+    msgLogClose(log);
+
+    CHECK((log = msgLogOpen(directory, SEGMENT_SIZE)) != NULL);
+    CHECK(msgLogNextSequence(log) == RECORDS + 1);
+    for (i = 1; i <= RECORDS; i++)
+        CHECK(recordValid(log, i, (int) i));
+    memset(&query, 0, sizeof(query));
+    query.fromSequence = 1;
+    query.filterChannel = 1;
+    query.channel = 1;
+    query.limit = RECORDS;
+    found = msgLogQuery(log, &query, results);
+    CHECK(found == (RECORDS - 1) / CHANNELS + 1);     //numbers 1, 1 + CHANNELS, ...
+    for (i = 0; i < found; i++) {
+        CHECK(results[i].header->channel == 1);
+        CHECK(results[i].header->sequence == 1 + i * CHANNELS);
+    }
+    msgLogClose(log);
+    removeLog(directory);
+    return 0;
+}
+
+/**
+ * Torn last record is not returned after the recovery and its sequence number is used by the next record
+ */
+static int testTornTail(void) {
+    char directory[] = "/tmp/msglogtestXXXXXX", path[4096];
+    msgLog *log;
+
+    CHECK(mkdtemp(directory) != NULL);
+    CHECK((log = msgLogOpen(directory, SEGMENT_SIZE)) != NULL);
+    CHECK(appendRecords(log, 1, 10) == 0);
+    msgLogClose(log);
+    CHECK(lastSegment(directory, path, sizeof(path)) == 0);
+    CHECK(tearLastRecord(path) == 0);
+
+    CHECK((log = msgLogOpen(directory, SEGMENT_SIZE)) != NULL);
+    CHECK(msgLogNextSequence(log) == 10);
+    CHECK(recordValid(log, 9, 9));
+    CHECK(!recordValid(log, 10, 10));
+    CHECK(appendRecords(log, 11, 1) == 0);
+    msgLogClose(log);
+
+    CHECK((log = msgLogOpen(directory, SEGMENT_SIZE)) != NULL);
+    CHECK(msgLogNextSequence(log) == 11);
+    CHECK(recordValid(log, 10, 11));
+    msgLogClose(log);
+    removeLog(directory);
+    return 0;
+}
+
+/**
+ * Appends the records of the query tests - record i (sequence i) is on the channel i % CHANNELS, from the sender
+ * i % SENDERS and received at BASE_TIME + 10 * i
+ * @return 0 on success, -1 on error
+ */
+static int appendIndexed(msgLog *log) {
+    logRecordHeader record;
+    char text[32];
+    int i;
+    for (i = 1; i <= INDEXED; i++) {
+        memset(&record, 0, sizeof(record));
+        record.channel = (unsigned int) (i % CHANNELS);
+        record.senderAddress = 0x0100007Fu;
+        record.senderPort = (unsigned short) (5000 + i % SENDERS);
+        record.timestamp = BASE_TIME + 10LL * i;
+        snprintf(text, sizeof(text), "message %d", i);
+        if (msgLogAppend(log, &record, text, strlen(text)) < 0)
+            return -1;
+    }
+    return msgLogCommit(log);
+}
+
+/**
+ * @return 1 if record i of appendIndexed matches the query
+ */
+static int indexedMatches(const logQuery *query, int i) {
+    return (unsigned long long) i >= query->fromSequence && BASE_TIME + 10LL * i >= query->fromTimestamp &&
+           (!query->filterChannel || (unsigned int) (i % CHANNELS) == query->channel) &&
+           (!query->filterSender || LOG_SENDER_KEY(0x0100007Fu, 5000 + i % SENDERS) == query->sender);
+}
+
+/**
+ * Runs the query and compares it with a scan of all the records - the first or the last limit matching ones, in the
+ * order of the sequence numbers
+ * @return 0 if the results match, 1 otherwise
+ */
+static int checkQuery(msgLog *log, const logQuery *query) {
+    static logRecordRef results[INDEXED];
+    int expected[INDEXED], matching = 0, first, i;
+    size_t found;
+
+    for (i = 1; i <= INDEXED; i++) {
+        if (indexedMatches(query, i))
+            expected[matching++] = i;
+    }
+    first = query->newest && (size_t) matching > query->limit ? matching - (int) query->limit : 0;
+    found = msgLogQuery(log, query, results);
+    CHECK(found == ((size_t) matching < query->limit ? (size_t) matching : query->limit));
+    for (i = 0; i < (int) found; i++) {
+        char text[32];
+        snprintf(text, sizeof(text), "message %d", expected[first + i]);
+        CHECK(results[i].header->sequence == (unsigned long long) expected[first + i]);
+        CHECK(results[i].header->length == strlen(text) && memcmp(results[i].data, text, strlen(text)) == 0);
+    }
+    return 0;
+}
+
+/**
+ * Queries of the log - all the records, one channel, one sender or both, from a sequence number or a time, the oldest
+ * or the newest ones
+ * @return 0 if all of them match the scan, 1 otherwise
+ */
+static int checkQueries(msgLog *log) {
+    static const unsigned long long fromSequences[] = { 1, 2, 65, 300, INDEXED, INDEXED + 1 };
+    static const long long fromTimestamps[] = { 0, BASE_TIME + 10 * 129, BASE_TIME + 10 * 451 + 5 };
+    static const size_t limits[] = { 1, 7, 100, INDEXED };
+    logQuery query;
+    size_t s, t, l;
+    int filter;
+
+    for (s = 0; s < sizeof(fromSequences) / sizeof(fromSequences[0]); s++) {
+        for (t = 0; t < sizeof(fromTimestamps) / sizeof(fromTimestamps[0]); t++) {
+            for (l = 0; l < sizeof(limits) / sizeof(limits[0]); l++) {
+                for (filter = 0; filter < 8; filter++) {
+                    memset(&query, 0, sizeof(query));
+                    query.fromSequence = fromSequences[s];
+                    query.fromTimestamp = fromTimestamps[t];
+                    query.limit = limits[l];
+                    query.filterChannel = filter & 1;
+                    query.channel = 2;
+                    query.filterSender = (filter & 2) != 0;
+                    query.sender = LOG_SENDER_KEY(0x0100007Fu, 5001);
+                    query.newest = (filter & 4) != 0;
+                    CHECK(checkQuery(log, &query) == 0);
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * @return number of the files of the log directory with the extension
+ */
+static int countFiles(const char *directory, const char *extension) {
+    struct dirent *file;
+    size_t suffix = strlen(extension);
+    int count = 0;
+    DIR *dir = opendir(directory);
+    while (dir != NULL && (file = readdir(dir)) != NULL) {
+        size_t length = strlen(file->d_name);
+        count += length > suffix && strcmp(file->d_name + length - suffix, extension) == 0;
+    }
+    if (dir != NULL)
+        closedir(dir);
+    return count;
+}
+
+/**
+ * Removes (or truncates) the index files of the log directory
+ */
+static void damageIndexes(const char *directory, int truncateFiles) {
+    char path[4096];
+    struct dirent *file;
+    DIR *dir = opendir(directory);
+    while (dir != NULL && (file = readdir(dir)) != NULL) {
+        size_t length = strlen(file->d_name);
+        if ((length > 4 && strcmp(file->d_name + length - 4, ".idx") == 0) ||
+            (length > 5 && strcmp(file->d_name + length - 5, ".sidx") == 0)) {
+            snprintf(path, sizeof(path), "%s/%s", directory, file->d_name);
+            if (truncateFiles)
+                truncate(path, 12);
+            else
+                unlink(path);
+        }
+    }
+    if (dir != NULL)
+        closedir(dir);
+}
+
+/**
+ * Indexed queries over rolled segments - the seek by time, the channel and sender key ranges and the newest records
+ * (collected from the last segment back and returned in the order of the sequence numbers) match the scan with the
+ * indexes of the running log, the ones read from the .idx/.sidx files after reopening and the rebuilt ones
+ */
+static int testQueries(void) {
+    char directory[] = "/tmp/msglogtestXXXXXX";
+    msgLog *log;
+    int segments;
+
+    CHECK(mkdtemp(directory) != NULL);
+    CHECK((log = msgLogOpen(directory, INDEXED_SEGMENT)) != NULL);
+    CHECK(appendIndexed(log) == 0);
+    CHECK((segments = countFiles(directory, ".log")) >= 3);
+    CHECK(checkQueries(log) == 0);
+    msgLogClose(log);
+    CHECK(countFiles(directory, ".idx") == segments - 1 && countFiles(directory, ".sidx") == segments - 1);
+
+    CHECK((log = msgLogOpen(directory, INDEXED_SEGMENT)) != NULL);
+    CHECK(checkQueries(log) == 0);
+    msgLogClose(log);
+
+    damageIndexes(directory, 1);
+    CHECK((log = msgLogOpen(directory, INDEXED_SEGMENT)) != NULL);
+    CHECK(checkQueries(log) == 0);
+    msgLogClose(log);
+    damageIndexes(directory, 0);
+    CHECK((log = msgLogOpen(directory, INDEXED_SEGMENT)) != NULL);
+    CHECK(checkQueries(log) == 0);
+    msgLogClose(log);
+    CHECK(countFiles(directory, ".idx") == segments - 1 && countFiles(directory, ".sidx") == segments - 1);
+    removeLog(directory);
+    return 0;
+}
+
+int main(void) {
+    static const testCase tests[] = {
+        { "reopen", testReopen },
+        { "torn tail", testTornTail },
+        { "queries", testQueries },
+    };
+
+    return RUN_TESTS(tests);
+}
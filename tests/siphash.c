@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include "siphash.h"
+#include "check.h"
+#define MAX_LENGTH 64
+
+/**
+ * @brief Tests of SipHash-2-4 - the test vectors of the reference implementation, and the batch kernel agreeing with
+ * the single-stream one for every count and length of the messages.
+ */
+
+/**
+ * Vectors of the reference implementation - key 00 01 .. 0f, message 00 01 .. of the length
+ */
+static int testVectors(void) {
+    static const struct {
+        size_t length;
+        unsigned long long tag;
+    } vectors[] = {
+        { 0, 0x726fdb47dd0e0e31ULL },
+        { 1, 0x74f839c593dc67fdULL },
+        { 7, 0xab0200f58b01d137ULL },
+        { 8, 0x93f5f5799a932462ULL },
+        { 15, 0xa129ca6149be45e5ULL },
+    };
+    unsigned char key[SIPHASH_KEY_SIZE], message[MAX_LENGTH];
+    size_t i;
+
+    for (i = 0; i < SIPHASH_KEY_SIZE; i++)
+        key[i] = (unsigned char) i;
+    for (i = 0; i < MAX_LENGTH; i++)
+        message[i] = (unsigned char) i;
+    for (i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++)
+        CHECK(sipHash(key, message, vectors[i].length) == vectors[i].tag);
+    return 0;
+}
+
+/**
+ * Batch of messages of all the lengths up to MAX_LENGTH, in every count (full groups of four lanes and the rest)
+ */
+static int testBatch(void) {
+    unsigned char key[SIPHASH_KEY_SIZE], data[MAX_LENGTH][MAX_LENGTH];
+    const unsigned char *messages[MAX_LENGTH];
+    size_t lengths[MAX_LENGTH];
+    unsigned long long tags[MAX_LENGTH];
+    int count, i, j;
+
+    for (i = 0; i < SIPHASH_KEY_SIZE; i++)
+        key[i] = (unsigned char) (i * 7 + 3);
+    for (i = 0; i < MAX_LENGTH; i++) {
+        for (j = 0; j < MAX_LENGTH; j++)
+            data[i][j] = (unsigned char) (i * 31 + j * 17);
+        messages[i] = data[i];
+    }
+    for (count = 1; count <= MAX_LENGTH; count++) {
+        for (i = 0; i < count; i++)
+            lengths[i] = (size_t) ((i + count) % MAX_LENGTH);
+        sipHashBatch(key, messages, lengths, tags, count);
+        for (i = 0; i < count; i++)
+            CHECK(tags[i] == sipHash(key, messages[i], lengths[i]));
+    }
+    return 0;
+}
+
+int main(void) {
+    static const testCase tests[] = {
+        { "vectors", testVectors },
+        { "batch", testBatch },
+    };
+
+    return RUN_TESTS(tests);
+}
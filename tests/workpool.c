@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "aead.h"
+#include "workpool.h"
+#include "check.h"
+#define WORKERS 3
+#define PACKETS 256             //packets of the crypto batches
+#define CHUNK 4                 //packets of one task, like the chunks of the engine
+#define MAX_LENGTH 1400
+#define SESSIONS 4              //keys of the packets - consecutive chunks of a batch belong to different sessions
+
+/**
+ * @brief Tests of the work-stealing pool - every task of a batch runs exactly once whatever the count, and batches
+ * of ChaCha20-Poly1305 packets sealed and opened by the pool match the single-threaded results. Built with
+ * ThreadSanitizer as workpooltsan when the compiler supports it.
+ */
+
+/**
+ * Packets of a crypto batch - packet i belongs to session (i / CHUNK) % SESSIONS
+ */
+typedef struct cryptoBatch {
+    unsigned char keys[SESSIONS][AEAD_KEY_SIZE];
+    unsigned char nonces[PACKETS][AEAD_NONCE_SIZE];
+    unsigned char aad[PACKETS][8];
+    unsigned char data[PACKETS][MAX_LENGTH];
+    unsigned char tags[PACKETS][AEAD_TAG_SIZE];
+    aeadPacket packets[PACKETS];
+    unsigned long long valid;   //opening: bitmask of the valid packets of the first 64
+    int invalid;                //opening: packets rejected in the whole batch
+} cryptoBatch;
+
+static void countTask(void *arg, int index) {
+    __atomic_add_fetch(&((int *) arg)[index], 1, __ATOMIC_RELAXED);
+}
+
+static void sealTask(void *arg, int index) {
+    cryptoBatch *batch = arg;
+    aeadSealBatch(batch->keys[index % SESSIONS], batch->packets + index * CHUNK, CHUNK);
+}
+
+static void openTask(void *arg, int index) {
+    cryptoBatch *batch = arg;
+    unsigned long long valid = aeadOpenBatch(batch->keys[index % SESSIONS], batch->packets + index * CHUNK, CHUNK);
+    if (index * CHUNK < 64)
+        __atomic_fetch_or(&batch->valid, valid << (index * CHUNK), __ATOMIC_RELAXED);
+    __atomic_add_fetch(&batch->invalid, CHUNK - __builtin_popcountll(valid), __ATOMIC_RELAXED);
+}
+
+static cryptoBatch *newBatch(void) {
+    cryptoBatch *batch = calloc(1, sizeof(cryptoBatch));
+    int i, j;
+
+    for (i = 0; batch != NULL && i < PACKETS; i++) {
+        if (i < SESSIONS) {
+            for (j = 0; j < AEAD_KEY_SIZE; j++)
+                batch->keys[i][j] = (unsigned char) (i * 41 + j);
+        }
+        memcpy(batch->nonces[i], &i, sizeof(i));
+        memset(batch->aad[i], i, sizeof(batch->aad[i]));
+        for (j = 0; j < MAX_LENGTH; j++)
+            batch->data[i][j] = (unsigned char) (i * 13 + j);
+        batch->packets[i].nonce = batch->nonces[i];
+        batch->packets[i].aad = batch->aad[i];
+        batch->packets[i].aadLength = sizeof(batch->aad[i]);
+        batch->packets[i].data = batch->data[i];
+        batch->packets[i].length = (size_t) (i * 97) % MAX_LENGTH;
+        batch->packets[i].tag = batch->tags[i];
+    }
+    return batch;
+}
+
+/**
+ * Every task of a batch runs once for all the counts (fewer tasks than threads, ranges of unequal sizes)
+ */
+static int testTasks(void) {
+    static int runs[1000];
+    unsigned long long tasks, stolen, expected = 0;
+    workPool *pool;
+    int count, i;
+
+    errno = 0;
+    CHECK(workPoolCreate(0) == NULL && errno == EINVAL);
+    CHECK((pool = workPoolCreate(WORKERS)) != NULL);
+    for (count = 0; count <= 1000; count += count < 20 ? 1 : 97) {
+        memset(runs, 0, sizeof(runs));
+        workPoolRun(pool, countTask, runs, count);
+        for (i = 0; i < 1000; i++)
+            CHECK(runs[i] == (i < count));
+        expected += (unsigned long long) count;
+    }
+    workPoolCounters(pool, &tasks, &stolen);
+    CHECK(tasks == expected && stolen <= tasks);
+    workPoolDestroy(pool);
+    return 0;
+}
+
+/**
+ * Packets sealed by the pool match the packets sealed by one thread, the pool opens them again and rejects exactly
+ * the tampered ones - which stay encrypted
+ */
+static int testCrypto(void) {
+    cryptoBatch *pooled = newBatch(), *single = newBatch(), *plain = newBatch();
+    workPool *pool;
+    int round, i;
+
+    CHECK(pooled != NULL && single != NULL && plain != NULL);
+    CHECK((pool = workPoolCreate(WORKERS)) != NULL);
+    for (round = 0; round < 10; round++) {
+        workPoolRun(pool, sealTask, pooled, PACKETS / CHUNK);
+        for (i = 0; i < PACKETS / CHUNK; i++)
+            sealTask(single, i);
+        CHECK(memcmp(pooled->data, single->data, sizeof(pooled->data)) == 0);
+        CHECK(memcmp(pooled->tags, single->tags, sizeof(pooled->tags)) == 0);
+
+        for (i = round % 7; i < PACKETS; i += 7)
+            pooled->tags[i][round % AEAD_TAG_SIZE] ^= 1;
+        pooled->valid = 0;
+        pooled->invalid = 0;
+        workPoolRun(pool, openTask, pooled, PACKETS / CHUNK);
+        CHECK(pooled->invalid == (PACKETS - round % 7 + 6) / 7);
+        for (i = 0; i < PACKETS; i++) {
+            if ((i - round % 7) % 7 == 0 && i >= round % 7) {
+                CHECK(i >= 64 || !(pooled->valid >> i & 1));
+                CHECK(memcmp(pooled->data[i], single->data[i], pooled->packets[i].length) == 0);
+                pooled->tags[i][round % AEAD_TAG_SIZE] ^= 1;
+                aeadOpenBatch(pooled->keys[i / CHUNK % SESSIONS], &pooled->packets[i], 1);
+            } else {
+                CHECK(i >= 64 || (pooled->valid >> i & 1));
+            }
+        }
+        //both batches hold the plain text again, sealed with new nonces in the next round
+        for (i = 0; i < PACKETS / CHUNK; i++)
+            aeadOpenBatch(single->keys[i % SESSIONS], single->packets + i * CHUNK, CHUNK);
+        CHECK(memcmp(pooled->data, plain->data, sizeof(pooled->data)) == 0);
+        CHECK(memcmp(single->data, plain->data, sizeof(single->data)) == 0);
+        for (i = 0; i < PACKETS; i++) {
+            pooled->nonces[i][AEAD_NONCE_SIZE - 1] = (unsigned char) (round + 1);
+            single->nonces[i][AEAD_NONCE_SIZE - 1] = (unsigned char) (round + 1);
+        }
+    }
+    workPoolDestroy(pool);
+    free(pooled);
+    free(single);
+    free(plain);
+    return 0;
+}
+
+int main(void) {
+    static const testCase tests[] = {
+        { "tasks", testTasks },
+        { "crypto", testCrypto },
+    };
+
+    return RUN_TESTS(tests);
+}
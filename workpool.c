@@ -0,0 +1,171 @@
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include "workpool.h"
+
+/**
+ * Tasks of one thread - the owner takes them from the end, the thieves from the start
+ */
+typedef struct workDeque {
+    pthread_mutex_t lock;
+    int first, last;            //tasks first .. last-1 are left
+    struct workPool *pool;
+} workDeque;
+
+struct workPool {
+    int threads;                //worker threads, deque 0 belongs to the thread running the batch
+    pthread_t *workers;
+    workDeque *deques;
+    pthread_mutex_t lock;
+    pthread_cond_t start;       //new batch or stop
+    pthread_cond_t done;        //last task of the batch finished
+    unsigned long long batch;   //number of the current batch
+    int stop;
+    workTask task;
+    void *arg;
+    int remaining;              //tasks of the batch which are not finished yet
+    unsigned long long tasks;
+    unsigned long long stolen;
+};
+
+/**
+ * Takes the next task of the thread - the last one of its own range, or the first one of the range of another thread
+ * @param self Deque of the thread
+ * @return index of the task, -1 if no task is left
+ */
+static int takeTask(workPool *pool, int self) {
+    workDeque *deque = &pool->deques[self];
+    int index = -1, i;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->first < deque->last)
+        index = --deque->last;
+    pthread_mutex_unlock(&deque->lock);
+    //victims are visited from the next thread on, so the thieves spread over the ranges
+    for (i = 1; index < 0 && i <= pool->threads; i++) {
+        deque = &pool->deques[(self + i) % (pool->threads + 1)];
+        pthread_mutex_lock(&deque->lock);
+        if (deque->first < deque->last)
+            index = deque->first++;
+        pthread_mutex_unlock(&deque->lock);
+        if (index >= 0)
+            __atomic_add_fetch(&pool->stolen, 1, __ATOMIC_RELAXED);
+    }
+    return index;
+}
+
+/**
+ * Runs the tasks of the batch until none is left
+ */
+static void runTasks(workPool *pool, int self) {
+    int index;
+    while ((index = takeTask(pool, self)) >= 0) {
+        pool->task(pool->arg, index);
+        if (__atomic_sub_fetch(&pool->remaining, 1, __ATOMIC_ACQ_REL) == 0) {
+            pthread_mutex_lock(&pool->lock);
+            pthread_cond_signal(&pool->done);
+            pthread_mutex_unlock(&pool->lock);
+        }
+    }
+}
+
+static void *workerMain(void *arg) {
+    workDeque *deque = arg;
+    workPool *pool = deque->pool;
+    unsigned long long seen = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->stop && pool->batch == seen)
+            pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->stop) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        seen = pool->batch;
+        pthread_mutex_unlock(&pool->lock);
+        runTasks(pool, (int) (deque - pool->deques));
+    }
+}
+
+workPool *workPoolCreate(int threads) {
+    workPool *pool;
+    int i, err;
+
+    if (threads < 1) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if ((pool = calloc(1, sizeof(workPool))) == NULL ||
+        (pool->workers = calloc((size_t) threads, sizeof(pthread_t))) == NULL ||
+        (pool->deques = calloc((size_t) threads + 1, sizeof(workDeque))) == NULL) {
+        if (pool != NULL)
+            free(pool->workers);
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    for (i = 0; i <= threads; i++) {
+        pthread_mutex_init(&pool->deques[i].lock, NULL);
+        pool->deques[i].pool = pool;
+    }
+    for (i = 0; i < threads; i++) {
+        if ((err = pthread_create(&pool->workers[i], NULL, workerMain, &pool->deques[i + 1])) != 0) {
+            pool->threads = i;      //only the started workers are stopped
+            workPoolDestroy(pool);
+            errno = err;
+            return NULL;
+        }
+    }
+    pool->threads = threads;
+    return pool;
+}
+
+void workPoolRun(workPool *pool, workTask task, void *arg, int count) {
+    int i, ranges = pool->threads + 1;
+
+    if (count <= 0)
+        return;
+    pool->task = task;
+    pool->arg = arg;
+    __atomic_store_n(&pool->remaining, count, __ATOMIC_RELEASE);
+    for (i = 0; i < ranges; i++) {
+        pthread_mutex_lock(&pool->deques[i].lock);
+        pool->deques[i].first = (int) ((long long) count * i / ranges);
+        pool->deques[i].last = (int) ((long long) count * (i + 1) / ranges);
+        pthread_mutex_unlock(&pool->deques[i].lock);
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->batch++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    runTasks(pool, 0);
+    pthread_mutex_lock(&pool->lock);
+    while (__atomic_load_n(&pool->remaining, __ATOMIC_ACQUIRE) > 0)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+    pool->tasks += (unsigned long long) count;
+}
+
+void workPoolCounters(const workPool *pool, unsigned long long *tasks, unsigned long long *stolen) {
+    *tasks = pool->tasks;
+    *stolen = __atomic_load_n(&pool->stolen, __ATOMIC_RELAXED);
+}
+
+void workPoolDestroy(workPool *pool) {
+    int i;
+    if (pool == NULL)
+        return;
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (i = 0; i < pool->threads; i++)
+        pthread_join(pool->workers[i], NULL);
+    free(pool->workers);
+    free(pool->deques);
+    free(pool);
+}
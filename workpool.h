@@ -0,0 +1,45 @@
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+/**
+ * @brief Work-stealing thread pool for the CPU-heavy stages of the packet processing. The tasks of a batch are split
+ * into contiguous ranges, one for every worker and one for the calling thread. A thread takes the tasks from the end
+ * of its own range, and a thread which runs out of them steals from the start of the range of another one, so the
+ * work moves to the cores which are idle. The calling thread works on the batch too and returns when all of its
+ * tasks are done, so the results are used in the order of the batch.
+ */
+
+typedef struct workPool workPool;
+
+/**
+ * Task of a batch
+ * @param arg Argument of the batch
+ * @param index Index of the task in the batch
+ */
+typedef void (*workTask)(void *arg, int index);
+
+/**
+ * Creates the pool and starts its worker threads
+ * @param threads Number of the worker threads (the calling thread is not counted)
+ * @return new pool or NULL on error (errno is set)
+ */
+workPool *workPoolCreate(int threads);
+
+/**
+ * Runs the tasks 0 .. count-1 of the batch on the workers and the calling thread, returns when all of them are done
+ * Only one thread may run batches of the pool
+ */
+void workPoolRun(workPool *pool, workTask task, void *arg, int count);
+
+/**
+ * @param tasks Filled with the number of the tasks run by the pool
+ * @param stolen Filled with the number of the tasks stolen from the range of another thread
+ */
+void workPoolCounters(const workPool *pool, unsigned long long *tasks, unsigned long long *stolen);
+
+/**
+ * Stops the worker threads and releases the pool
+ */
+void workPoolDestroy(workPool *pool);
+
+#endif //WORKPOOL_H